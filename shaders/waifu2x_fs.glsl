@@ -1,36 +1,56 @@
 
 in vec2 v_texCoord;
 
-out float o_pixel;
+// 4 output planes per output texel, the planes are packed 4 per RGBA texel.
+// NUM_OUTPUT_TEXELS texels per fragment, one per draw buffer
+out vec4 o_pixel[NUM_OUTPUT_TEXELS];
 
-uniform float bias;
 uniform sampler2DArray inputTextures;
-uniform vec3 weightMatrix[3 * 128];
+
+// the slice of the draw in the weights buffer of the layer.
+// per output texel, input texel and tap a 4x4 matrix, the columns are
+// the input channels
+layout(std140) uniform Weights
+{
+	vec4 bias[NUM_OUTPUT_TEXELS];
+	vec4 weights[NUM_OUTPUT_TEXELS * NUM_INPUT_TEXELS * 9 * 4];
+};
+
+vec4 tap(int w, vec4 t)
+{
+	return mat4(weights[w], weights[w + 1], weights[w + 2], weights[w + 3]) * t;
+}
 
 void main()
 {
 	// Convolution Process
-	highp float s = 0.0;
-	for (int i = 0; i < NUM_INPUT_PLANES; i++) {
-		highp vec3 t0, t1, t2;
+	highp vec4 s[NUM_OUTPUT_TEXELS];
+	for (int o = 0; o < NUM_OUTPUT_TEXELS; o++) {
+		s[o] = bias[o];
+	}
+	for (int i = 0; i < NUM_INPUT_TEXELS; i++) {
+		// the neighbourhood is fetched once for every output texel
 		vec3 uvt = vec3(v_texCoord, i);
-		t0 = vec3(textureOffset(inputTextures, uvt, ivec2(-1, -1)).r,
-		          textureOffset(inputTextures, uvt, ivec2( 0, -1)).r,
-		          textureOffset(inputTextures, uvt, ivec2( 1, -1)).r);
-		t1 = vec3(textureOffset(inputTextures, uvt, ivec2(-1,  0)).r,
-		          texture      (inputTextures, uvt               ).r,
-		          textureOffset(inputTextures, uvt, ivec2( 1,  0)).r);
-		t2 = vec3(textureOffset(inputTextures, uvt, ivec2(-1,  1)).r,
-		          textureOffset(inputTextures, uvt, ivec2( 0,  1)).r,
-		          textureOffset(inputTextures, uvt, ivec2( 1,  1)).r);
-		
-		s += dot(t0, weightMatrix[i * 3 + 0]) +
-	         dot(t1, weightMatrix[i * 3 + 1]) +
-	         dot(t2, weightMatrix[i * 3 + 2]);
+		vec4 t0 = textureOffset(inputTextures, uvt, ivec2(-1, -1));
+		vec4 t1 = textureOffset(inputTextures, uvt, ivec2( 0, -1));
+		vec4 t2 = textureOffset(inputTextures, uvt, ivec2( 1, -1));
+		vec4 t3 = textureOffset(inputTextures, uvt, ivec2(-1,  0));
+		vec4 t4 = texture      (inputTextures, uvt               );
+		vec4 t5 = textureOffset(inputTextures, uvt, ivec2( 1,  0));
+		vec4 t6 = textureOffset(inputTextures, uvt, ivec2(-1,  1));
+		vec4 t7 = textureOffset(inputTextures, uvt, ivec2( 0,  1));
+		vec4 t8 = textureOffset(inputTextures, uvt, ivec2( 1,  1));
+
+		for (int o = 0; o < NUM_OUTPUT_TEXELS; o++) {
+			int w = (o * NUM_INPUT_TEXELS + i) * 9 * 4;
+			s[o] += tap(w +  0, t0) + tap(w +  4, t1) + tap(w +  8, t2) +
+			        tap(w + 12, t3) + tap(w + 16, t4) + tap(w + 20, t5) +
+			        tap(w + 24, t6) + tap(w + 28, t7) + tap(w + 32, t8);
+		}
 	}
 	
 	// Leaky ReLU Process
-	s += bias;
-	s = max(s, 0) + min(s, 0) * 0.1;
-	o_pixel = s;
+	for (int o = 0; o < NUM_OUTPUT_TEXELS; o++) {
+		o_pixel[o] = max(s[o], 0.0) + min(s[o], 0.0) * 0.1;
+	}
 }
@@ -0,0 +1,296 @@
+#include "activationTensor.hpp"
+#include "filterCPUBlocked.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace w2xc {
+
+static const FilterINT8Quantization noQuantization = { 1.0f, 0, 255 };
+
+ActivationTensor::ActivationTensor() :
+		nChannels(0), channelBlock(1), precision(Float32),
+		quantization(noQuantization), size(0, 0) {
+}
+
+ActivationTensor::ActivationTensor(int nChannels, cv::Size size,
+		int channelBlock, Precision precision) :
+		nChannels(0), channelBlock(1), precision(Float32),
+		quantization(noQuantization), size(0, 0) {
+	create(nChannels, size, channelBlock, precision);
+}
+
+size_t ActivationTensor::elementSize(Precision precision) {
+	switch (precision) {
+	case Float16:
+		return sizeof(unsigned short);
+	case Int8:
+		return sizeof(unsigned char);
+	default:
+		return sizeof(float);
+	}
+}
+
+size_t ActivationTensor::bufferSize(int nChannels, cv::Size size,
+		int channelBlock, Precision precision) {
+	int nBlocks = (nChannels + channelBlock - 1) / channelBlock;
+	size_t nElements = static_cast<size_t>(nBlocks) * channelBlock
+			* size.area();
+	// several narrow values per float of the buffer
+	size_t perFloat = sizeof(float) / elementSize(precision);
+	return (nElements + perFloat - 1) / perFloat;
+}
+
+void ActivationTensor::create(int nChannels, cv::Size size, int channelBlock,
+		Precision precision) {
+
+	this->nChannels = nChannels;
+	this->channelBlock = channelBlock;
+	this->precision = precision;
+	this->size = size;
+
+	buffer.resize(bufferSize(nChannels, size, channelBlock, precision));
+
+	// padding channels stay zero, the kernels read whole blocks
+	// (zero bits are 0.0 in the float precisions, the int8 kernel has
+	// zero weights for them)
+	int nPaddingChannels = getNBlocks() * channelBlock - nChannels;
+	if (nPaddingChannels > 0) {
+		size_t elementSize = ActivationTensor::elementSize(precision);
+		char *last = reinterpret_cast<char *>(buffer.data())
+				+ static_cast<size_t>(getNBlocks() - 1) * channelBlock
+				* size.area() * elementSize;
+		for (int i = 0; i < size.area(); i++) {
+			std::fill(last + (i * channelBlock + channelBlock
+					- nPaddingChannels) * elementSize,
+					last + (i + 1) * channelBlock * elementSize, 0);
+		}
+	}
+}
+
+int ActivationTensor::getNChannels() const {
+	return nChannels;
+}
+
+int ActivationTensor::getChannelBlock() const {
+	return channelBlock;
+}
+
+int ActivationTensor::getNBlocks() const {
+	return (nChannels + channelBlock - 1) / channelBlock;
+}
+
+cv::Size ActivationTensor::getSize() const {
+	return size;
+}
+
+ActivationTensor::Precision ActivationTensor::getPrecision() const {
+	return precision;
+}
+
+bool ActivationTensor::isHalfPrecision() const {
+	return precision == Float16;
+}
+
+void ActivationTensor::setQuantization(
+		const FilterINT8Quantization &quantization) {
+	this->quantization = quantization;
+}
+
+const FilterINT8Quantization &ActivationTensor::getQuantization() const {
+	return quantization;
+}
+
+float *ActivationTensor::ptr(int block, int y) {
+	return buffer.data() + (static_cast<size_t>(block) * size.height + y)
+			* size.width * channelBlock;
+}
+
+const float *ActivationTensor::ptr(int block, int y) const {
+	return buffer.data() + (static_cast<size_t>(block) * size.height + y)
+			* size.width * channelBlock;
+}
+
+unsigned short *ActivationTensor::halfPtr(int block, int y) {
+	return reinterpret_cast<unsigned short *>(buffer.data())
+			+ (static_cast<size_t>(block) * size.height + y)
+			* size.width * channelBlock;
+}
+
+const unsigned short *ActivationTensor::halfPtr(int block, int y) const {
+	return reinterpret_cast<const unsigned short *>(buffer.data())
+			+ (static_cast<size_t>(block) * size.height + y)
+			* size.width * channelBlock;
+}
+
+unsigned char *ActivationTensor::bytePtr(int block, int y) {
+	return reinterpret_cast<unsigned char *>(buffer.data())
+			+ (static_cast<size_t>(block) * size.height + y)
+			* size.width * channelBlock;
+}
+
+const unsigned char *ActivationTensor::bytePtr(int block, int y) const {
+	return reinterpret_cast<const unsigned char *>(buffer.data())
+			+ (static_cast<size_t>(block) * size.height + y)
+			* size.width * channelBlock;
+}
+
+cv::Mat ActivationTensor::plane(int c) {
+	CV_Assert(channelBlock == 1 && precision == Float32);
+	return cv::Mat(size, CV_32FC1, ptr(c, 0));
+}
+
+void ActivationTensor::reserve(int nChannels, cv::Size size,
+		int channelBlock, Precision precision) {
+	buffer.reserve(bufferSize(nChannels, size, channelBlock, precision));
+}
+
+void ActivationTensor::firstTouch(ThreadPool &pool) {
+	const size_t pageSize = 4096;
+	char *data = reinterpret_cast<char *>(buffer.data());
+	size_t bytes = buffer.getCapacity() * sizeof(float);
+	size_t nPages = (bytes + pageSize - 1) / pageSize;
+	int nThreads = pool.getNumberOfThreads();
+	pool.runOnEachThread([&](int thread) {
+		size_t begin = nPages * thread / nThreads * pageSize;
+		size_t end = std::min(nPages * (thread + 1) / nThreads * pageSize,
+				bytes);
+		if (begin < end) {
+			std::memset(data + begin, 0, end - begin);
+		}
+	});
+}
+
+float *ActivationTensor::writeRow(int block, int y) {
+	if (precision == Float32) {
+		return ptr(block, y);
+	}
+	// the channels which are not written are padding
+	rowBuffer.assign(static_cast<size_t>(size.width) * channelBlock, 0.0f);
+	return rowBuffer.data();
+}
+
+void ActivationTensor::storeRow(int block, int y) {
+	if (precision == Float16) {
+		filterCPUBlockedFloatToHalf(rowBuffer.data(), halfPtr(block, y),
+				rowBuffer.size());
+	} else if (precision == Int8) {
+		// round to nearest, saturate to the range of the quantization
+		unsigned char *dst = bytePtr(block, y);
+		float inverseScale = 1.0f / quantization.scale;
+		for (size_t i = 0; i < rowBuffer.size(); i++) {
+			int q = static_cast<int>(std::floor(rowBuffer[i] * inverseScale
+					+ quantization.zeroPoint + 0.5f));
+			dst[i] = static_cast<unsigned char>(
+					std::min(std::max(q, 0), quantization.maxValue));
+		}
+	}
+}
+
+const float *ActivationTensor::readRow(int block, int y) const {
+	if (precision == Float32) {
+		return ptr(block, y);
+	}
+	rowBuffer.resize(static_cast<size_t>(size.width) * channelBlock);
+	if (precision == Float16) {
+		filterCPUBlockedHalfToFloat(halfPtr(block, y), rowBuffer.data(),
+				rowBuffer.size());
+	} else {
+		const unsigned char *src = bytePtr(block, y);
+		for (size_t i = 0; i < rowBuffer.size(); i++) {
+			rowBuffer[i] = (src[i] - quantization.zeroPoint)
+					* quantization.scale;
+		}
+	}
+	return rowBuffer.data();
+}
+
+void ActivationTensor::fromPlanes(const std::vector<cv::Mat> &planes,
+		int channelBlock, Precision precision) {
+
+	create(static_cast<int>(planes.size()), planes[0].size(), channelBlock,
+			precision);
+
+	for (int block = 0; block < getNBlocks(); block++) {
+		int nBlockChannels = std::min(channelBlock,
+				nChannels - block * channelBlock);
+		for (int y = 0; y < size.height; y++) {
+			float *dst = writeRow(block, y);
+			for (int c = 0; c < nBlockChannels; c++) {
+				const float *src = planes[block * channelBlock + c].ptr<float>(y);
+				for (int x = 0; x < size.width; x++) {
+					dst[x * channelBlock + c] = src[x];
+				}
+			}
+			storeRow(block, y);
+		}
+	}
+}
+
+void ActivationTensor::toPlanes(std::vector<cv::Mat> &planes) const {
+
+	planes.resize(nChannels);
+
+	for (int c = 0; c < nChannels; c++) {
+		planes[c].create(size, CV_32FC1);
+	}
+
+	for (int block = 0; block < getNBlocks(); block++) {
+		int nBlockChannels = std::min(channelBlock,
+				nChannels - block * channelBlock);
+		for (int y = 0; y < size.height; y++) {
+			const float *src = readRow(block, y);
+			for (int c = 0; c < nBlockChannels; c++) {
+				float *dst = planes[block * channelBlock + c].ptr<float>(y);
+				for (int x = 0; x < size.width; x++) {
+					dst[x] = src[x * channelBlock + c];
+				}
+			}
+		}
+	}
+}
+
+void ActivationTensor::fromPlane(const cv::Mat &plane, int channelBlock,
+		Precision precision) {
+
+	create(1, plane.size(), channelBlock, precision);
+
+	for (int y = 0; y < size.height; y++) {
+		const float *src = plane.ptr<float>(y);
+		float *dst = writeRow(0, y);
+		for (int x = 0; x < size.width; x++) {
+			dst[x * channelBlock] = src[x];
+		}
+		storeRow(0, y);
+	}
+}
+
+void ActivationTensor::toPlane(int c, cv::Mat &plane) const {
+
+	plane.create(size, CV_32FC1);
+
+	for (int y = 0; y < size.height; y++) {
+		const float *src = readRow(c / channelBlock, y) + c % channelBlock;
+		float *dst = plane.ptr<float>(y);
+		for (int x = 0; x < size.width; x++) {
+			dst[x] = src[x * channelBlock];
+		}
+	}
+}
+
+void ActivationArena::reserve(int maxChannels, cv::Size size,
+		int channelBlock, ActivationTensor::Precision precision) {
+	buffers[0].reserve(maxChannels, size, channelBlock, precision);
+	buffers[1].reserve(maxChannels, size, channelBlock, precision);
+}
+
+ActivationTensor& ActivationArena::operator[](int index) {
+	return buffers[index];
+}
+
+void ActivationArena::firstTouch(ThreadPool &pool) {
+	buffers[0].firstTouch(pool);
+	buffers[1].firstTouch(pool);
+}
+
+}
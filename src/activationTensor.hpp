@@ -0,0 +1,144 @@
+/*
+ * activationTensor.hpp
+ *   activations of one layer in a single aligned buffer
+ *
+ *   The channels are stored in blocks of channelBlock channels which are
+ *   interleaved per pixel (NCHW[channelBlock]c) :
+ *     element (c, y, x) is at
+ *     ((c / channelBlock) * height + y) * width * channelBlock
+ *       + x * channelBlock + c % channelBlock
+ *   channelBlock == 1 is the plain planar layout, every channel of which
+ *   can be used as a cv::Mat without copying.
+ *
+ *   The elements are floats or, with Float16, IEEE 754 half
+ *   precision values (unsigned short) in the same layout : half the
+ *   footprint and memory traffic, the kernels accumulate in float.
+ *   Int8 tensors hold unsigned bytes of the affine quantization set by
+ *   setQuantization() (int8 engine, NCHW8c only), the plane copies
+ *   quantize and dequantize.
+ */
+
+#ifndef ACTIVATION_TENSOR_HPP_
+#define ACTIVATION_TENSOR_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <memory>
+#include "alignedBuffer.h"
+#include "filterINT8.h"
+#include "threadPool.hpp"
+
+namespace w2xc {
+
+class ActivationTensor {
+
+public:
+	// element type
+	enum Precision { Float32, Float16, Int8 };
+
+private:
+	int nChannels;
+	int channelBlock;
+	Precision precision;
+	FilterINT8Quantization quantization;
+	cv::Size size;
+
+	// buffer is reused by create() as long as it is large enough
+	AlignedBuffer buffer;
+
+	// float copy of one row of a Float16 / Int8 tensor for the plane copies
+	mutable AlignedBuffer rowBuffer;
+
+	// row of block for writing / reading as floats.
+	// Float16 / Int8 rows go through rowBuffer, storeRow() writes it back.
+	float *writeRow(int block, int y);
+	void storeRow(int block, int y);
+	const float *readRow(int block, int y) const;
+
+	static size_t elementSize(Precision precision);
+	static size_t bufferSize(int nChannels, cv::Size size, int channelBlock,
+			Precision precision);
+
+public:
+	// channel block of the interleaved layout used by the SIMD kernels
+	enum { blockedChannels = 8 };
+
+	ActivationTensor();
+	ActivationTensor(int nChannels, cv::Size size, int channelBlock,
+			Precision precision = Float32);
+
+	// (re)shape, keeps the buffer if it is large enough.
+	// the channels of the last block beyond nChannels are zero filled.
+	void create(int nChannels, cv::Size size, int channelBlock,
+			Precision precision = Float32);
+
+	int getNChannels() const;
+	int getChannelBlock() const;
+	int getNBlocks() const;
+	cv::Size getSize() const;
+	Precision getPrecision() const;
+	bool isHalfPrecision() const;
+
+	// quantization of the Int8 elements, kept by create()
+	void setQuantization(const FilterINT8Quantization &quantization);
+	const FilterINT8Quantization &getQuantization() const;
+
+	// row y of channel block (float tensors)
+	float *ptr(int block, int y);
+	const float *ptr(int block, int y) const;
+
+	// row y of channel block (half precision tensors)
+	unsigned short *halfPtr(int block, int y);
+	const unsigned short *halfPtr(int block, int y) const;
+
+	// row y of channel block (Int8 tensors)
+	unsigned char *bytePtr(int block, int y);
+	const unsigned char *bytePtr(int block, int y) const;
+
+	// channel c as a cv::Mat header (planar float layout only)
+	cv::Mat plane(int c);
+
+	// copy from / to separately allocated planes
+	void fromPlanes(const std::vector<cv::Mat> &planes, int channelBlock,
+			Precision precision = Float32);
+	void toPlanes(std::vector<cv::Mat> &planes) const;
+
+	// single plane versions, for the one channel input and output
+	void fromPlane(const cv::Mat &plane, int channelBlock,
+			Precision precision = Float32);
+	void toPlane(int c, cv::Mat &plane) const;
+
+	// grow the buffer for nChannels x size in channelBlock layout
+	void reserve(int nChannels, cv::Size size, int channelBlock,
+			Precision precision = Float32);
+
+	// zero fill the buffer from the threads of pool, thread i the i-th of
+	// nThreads contiguous parts : the part of the jobs the thread is dealt
+	// first. on NUMA machines the pages of a fresh buffer are placed on
+	// the node of the thread which touches them first.
+	void firstTouch(ThreadPool &pool);
+};
+
+/**
+ * two activation tensors which layers write in turn.
+ * the arena of an ExecutionPlan is reserved for the largest layer of
+ * its tile, so that layers, tiles and images do not allocate.
+ */
+class ActivationArena {
+
+private:
+	ActivationTensor buffers[2];
+
+public:
+	void reserve(int maxChannels, cv::Size size, int channelBlock,
+			ActivationTensor::Precision precision = ActivationTensor::Float32);
+
+	ActivationTensor& operator[](int index);
+
+	// ActivationTensor::firstTouch of both tensors
+	void firstTouch(ThreadPool &pool);
+};
+
+}
+
+#endif /* ACTIVATION_TENSOR_HPP_ */
@@ -0,0 +1,240 @@
+#include "alignedBuffer.h"
+#include <map>
+#include <mutex>
+#include <new>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+	#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#if defined(__APPLE__)
+	#include <mach/vm_statistics.h>
+	#endif
+	#if defined(__linux__)
+	#include <cstdio>
+	#endif
+#endif
+
+namespace {
+
+const size_t hugePageSize = 2 * 1024 * 1024;
+
+bool hugePagesEnabled = false;
+
+// live large buffers
+std::mutex statisticsMutex;
+size_t explicitBytes = 0;
+uint64_t nHeapFallbacks = 0;
+std::map<uintptr_t, size_t> transparentBlocks;	// address -> bytes
+
+size_t roundToHugePages(size_t bytes)
+{
+	return (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+}
+
+#if defined(_WIN32)
+
+// large pages need SeLockMemoryPrivilege in the token of the process,
+// the user must hold "Lock pages in memory"
+bool enableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(),
+			TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+		return false;
+	}
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege",
+			&privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+		&& GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+
+void *allocateExplicit(size_t bytes)
+{
+	static bool privileged = enableLockMemoryPrivilege();
+	if (!privileged || GetLargePageMinimum() == 0) {
+		return nullptr;
+	}
+	size_t largePageSize = GetLargePageMinimum();
+	size_t size = (bytes + largePageSize - 1) / largePageSize * largePageSize;
+	return VirtualAlloc(nullptr, size,
+		MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
+
+void freeExplicit(void *storage, size_t)
+{
+	VirtualFree(storage, 0, MEM_RELEASE);
+}
+
+void *allocateTransparent(size_t)
+{
+	return nullptr;
+}
+
+void freeTransparent(void *, size_t)
+{
+}
+
+#else
+
+void *allocateExplicit(size_t bytes)
+{
+	void *storage = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+	// pages reserved in vm.nr_hugepages
+	storage = mmap(nullptr, roundToHugePages(bytes), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#elif defined(__APPLE__) && defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+	// x86-64 only, fails on Apple silicon
+	storage = mmap(nullptr, roundToHugePages(bytes), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+#endif
+	(void)bytes;
+	return (storage == MAP_FAILED) ? nullptr : storage;
+}
+
+void freeExplicit(void *storage, size_t bytes)
+{
+	munmap(storage, roundToHugePages(bytes));
+}
+
+// a 2 MB aligned range of a larger mapping, which the kernel may back
+// with huge pages when it is touched
+void *allocateTransparent(size_t bytes)
+{
+#if defined(MADV_HUGEPAGE)
+	size_t size = roundToHugePages(bytes);
+	void *mapping = mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+		return nullptr;
+	}
+	char *begin = static_cast<char *>(mapping);
+	char *aligned = reinterpret_cast<char *>(roundToHugePages(
+		reinterpret_cast<uintptr_t>(begin)));
+	if (aligned > begin) {
+		munmap(begin, aligned - begin);
+	}
+	size_t tail = (begin + size + hugePageSize) - (aligned + size);
+	if (tail > 0) {
+		munmap(aligned + size, tail);
+	}
+	madvise(aligned, size, MADV_HUGEPAGE);
+	return aligned;
+#else
+	(void)bytes;
+	return nullptr;
+#endif
+}
+
+void freeTransparent(void *storage, size_t bytes)
+{
+	munmap(storage, roundToHugePages(bytes));
+}
+
+#endif
+
+}
+
+void *AlignedBuffer::allocate(size_t bytes, Pages &pages)
+{
+	pages = HeapPages;
+	if (hugePagesEnabled && bytes >= hugePageMinimumBytes) {
+		void *storage = allocateExplicit(bytes);
+		if (storage) {
+			pages = ExplicitHugePages;
+		} else if ((storage = allocateTransparent(bytes)) != nullptr) {
+			pages = TransparentHugePages;
+		}
+
+		std::lock_guard<std::mutex> lock(statisticsMutex);
+		if (pages == ExplicitHugePages) {
+			explicitBytes += bytes;
+			return storage;
+		}
+		if (pages == TransparentHugePages) {
+			transparentBlocks[reinterpret_cast<uintptr_t>(storage)] = bytes;
+			return storage;
+		}
+		nHeapFallbacks++;
+	}
+	return ::operator new(bytes);
+}
+
+void AlignedBuffer::deallocate(void *storage, size_t bytes, Pages pages)
+{
+	if (pages == HeapPages) {
+		::operator delete(storage);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(statisticsMutex);
+		if (pages == ExplicitHugePages) {
+			explicitBytes -= bytes;
+		} else {
+			transparentBlocks.erase(reinterpret_cast<uintptr_t>(storage));
+		}
+	}
+	if (pages == ExplicitHugePages) {
+		freeExplicit(storage, bytes);
+	} else {
+		freeTransparent(storage, bytes);
+	}
+}
+
+void alignedBufferSetHugePages(bool enabled)
+{
+	hugePagesEnabled = enabled;
+}
+
+bool alignedBufferGetHugePages()
+{
+	return hugePagesEnabled;
+}
+
+AlignedBufferHugePageStatistics alignedBufferHugePageStatistics()
+{
+	std::lock_guard<std::mutex> lock(statisticsMutex);
+	AlignedBufferHugePageStatistics statistics;
+	statistics.explicitBytes = explicitBytes;
+	statistics.advisedBytes = 0;
+	for (auto& block : transparentBlocks) {
+		statistics.advisedBytes += block.second;
+	}
+	statistics.transparentBytes = 0;
+	statistics.nHeapFallbacks = nHeapFallbacks;
+
+#if defined(__linux__)
+	// AnonHugePages of the mappings of the blocks
+	if (!transparentBlocks.empty()) {
+		if (FILE *smaps = std::fopen("/proc/self/smaps", "r")) {
+			char line[512];
+			bool counted = false;
+			while (std::fgets(line, sizeof(line), smaps)) {
+				unsigned long begin, end;
+				size_t kiloBytes;
+				if (std::sscanf(line, "%lx-%lx ", &begin, &end) == 2) {
+					auto block = transparentBlocks.lower_bound(begin);
+					counted = block != transparentBlocks.end()
+						&& block->first < end;
+				} else if (counted && std::sscanf(line,
+						"AnonHugePages: %zu kB", &kiloBytes) == 1) {
+					statistics.transparentBytes += kiloBytes * 1024;
+				}
+			}
+			std::fclose(smaps);
+		}
+	}
+#endif
+
+	return statistics;
+}
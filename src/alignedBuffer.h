@@ -0,0 +1,116 @@
+
+#ifndef ALIGNED_BUFFER_H_
+#define ALIGNED_BUFFER_H_
+
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+// Contiguous float buffer aligned to 64 bytes (a cache line and an
+// AVX-512 register). Used for the packed weights of the models and for
+// the activation tensors. resize() keeps the storage while it is large
+// enough; the contents are not preserved when it grows.
+// With alignedBufferSetHugePages(true), buffers of hugePageMinimumBytes
+// and more are backed by 2 MB pages (rounded up to whole pages).
+class AlignedBuffer
+{
+public:
+	enum { alignment = 64 };
+	enum { hugePageMinimumBytes = 512 * 1024 };
+
+	// pages of the storage
+	enum Pages {
+		HeapPages,
+		ExplicitHugePages,		// hugetlbfs, Windows large pages, superpages
+		TransparentHugePages,	// madvise(MADV_HUGEPAGE), up to the kernel
+	};
+
+	AlignedBuffer() : storage(nullptr), storageBytes(0), pages(HeapPages),
+		ptr(nullptr), count(0), capacity(0) {}
+	~AlignedBuffer() { release(); }
+
+	void resize(size_t n)
+	{
+		if (n > capacity) {
+			release();
+			storageBytes = n * sizeof(float) + alignment;
+			storage = allocate(storageBytes, pages);
+			uintptr_t address = reinterpret_cast<uintptr_t>(storage);
+			ptr = reinterpret_cast<float *>(
+				address + (alignment - address % alignment) % alignment);
+			capacity = n;
+		}
+		count = n;
+	}
+
+	// grow the storage to n floats without changing size()
+	void reserve(size_t n)
+	{
+		size_t oldCount = count;
+		if (n > capacity) {
+			resize(n);
+		}
+		count = oldCount;
+	}
+
+	void assign(size_t n, float value)
+	{
+		resize(n);
+		std::fill(ptr, ptr + n, value);
+	}
+
+	void clear() { count = 0; }
+
+	float *data() { return ptr; }
+	const float *data() const { return ptr; }
+	size_t size() const { return count; }
+	size_t getCapacity() const { return capacity; }
+	bool empty() const { return count == 0; }
+	Pages getPages() const { return pages; }
+
+	float &operator[](size_t i) { return ptr[i]; }
+	const float &operator[](size_t i) const { return ptr[i]; }
+
+private:
+	void *storage;
+	size_t storageBytes;
+	Pages pages;
+	float *ptr;
+	size_t count;
+	size_t capacity;
+
+	// operator new, or huge pages for large buffers (alignedBuffer.cpp)
+	static void *allocate(size_t bytes, Pages &pages);
+	static void deallocate(void *storage, size_t bytes, Pages pages);
+
+	void release()
+	{
+		if (storage) {
+			deallocate(storage, storageBytes, pages);
+		}
+		storage = nullptr;
+		ptr = nullptr;
+		capacity = 0;
+	}
+
+	AlignedBuffer(const AlignedBuffer &);
+	AlignedBuffer &operator=(const AlignedBuffer &);
+};
+
+// huge pages for the large buffers allocated from now on.
+// set before the models are loaded.
+void alignedBufferSetHugePages(bool enabled);
+bool alignedBufferGetHugePages();
+
+// huge pages of the buffers which are alive
+struct AlignedBufferHugePageStatistics {
+	size_t explicitBytes;		// on explicit huge pages
+	size_t advisedBytes;		// advised for transparent huge pages
+	size_t transparentBytes;	// of those, on huge pages at the moment
+								// (Linux /proc/self/smaps, after first touch)
+	uint64_t nHeapFallbacks;	// large buffers which got no huge pages, ever
+};
+AlignedBufferHugePageStatistics alignedBufferHugePageStatistics();
+
+#endif
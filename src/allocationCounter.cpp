@@ -0,0 +1,63 @@
+#include "allocationCounter.hpp"
+
+#if defined(W2XC_COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// VS2013 doesn't know noexcept
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define W2XC_NOEXCEPT throw()
+#else
+#define W2XC_NOEXCEPT noexcept
+#endif
+
+static std::atomic<uint64_t> allocationCount(0);
+
+// array and nothrow versions of the standard library end up here
+void *operator new(std::size_t size) {
+	allocationCount++;
+	void *ptr = std::malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) W2XC_NOEXCEPT {
+	std::free(ptr);
+}
+
+// sized version of C++14, replaced along with the unsized one
+void operator delete(void *ptr, std::size_t) W2XC_NOEXCEPT {
+	std::free(ptr);
+}
+
+namespace w2xc {
+
+bool isAllocationCounted() {
+	return true;
+}
+
+uint64_t getAllocationCount() {
+	return allocationCount;
+}
+
+}
+
+#else
+
+namespace w2xc {
+
+bool isAllocationCounted() {
+	return false;
+}
+
+uint64_t getAllocationCount() {
+	return 0;
+}
+
+}
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * allocationCounter.hpp
+ *   number of heap allocations of the process
+ *
+ *   Built with W2XC_COUNT_ALLOCATIONS, the global operator new is replaced
+ *   by a counting one, the benchmark uses the count to check that the
+ *   steady state does not allocate. Other builds keep the library's
+ *   operator new and count nothing.
+ */
+
+#ifndef ALLOCATION_COUNTER_HPP_
+#define ALLOCATION_COUNTER_HPP_
+
+#include <cstdint>
+
+namespace w2xc {
+
+// whether the build counts allocations (W2XC_COUNT_ALLOCATIONS)
+bool isAllocationCounted();
+
+// number of operator new calls since the start of the process,
+// 0 if not counted
+uint64_t getAllocationCount();
+
+}
+
+#endif /* ALLOCATION_COUNTER_HPP_ */
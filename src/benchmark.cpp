@@ -0,0 +1,305 @@
+#include "benchmark.hpp"
+#include "executionPlan.hpp"
+#include "allocationCounter.hpp"
+#include "cpuTopology.hpp"
+#include "alignedBuffer.h"
+#include "filterKernels.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+namespace w2xc {
+
+static double filterSeconds(Model &model, std::vector<cv::Mat> &inputPlanes,
+		std::vector<cv::Mat> &outputPlanes) {
+	auto start = std::chrono::steady_clock::now();
+	model.filter(inputPlanes, outputPlanes);
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+// the int8 kernel variants the processor supports on a 128 -> 128 layer
+// of random weights : they have to write the same bytes and floats
+static void compareINT8Variants() {
+
+	const int nPlanes = 128;
+	cv::Size size(32, 32);
+	size_t nValues = (size_t)nPlanes * size.area();
+
+	std::vector<cv::Mat> weights(nPlanes * nPlanes);
+	for (auto& weight : weights) {
+		weight.create(3, 3, CV_32FC1);
+		cv::randu(weight, -0.1, 0.1);
+	}
+	cv::Mat randomBiases(1, nPlanes, CV_32FC1);
+	cv::randu(randomBiases, -0.1, 0.1);
+	std::vector<double> biases(nPlanes);
+	for (int op = 0; op < nPlanes; op++) {
+		biases[op] = randomBiases.at<float>(0, op);
+	}
+	cv::Mat randomInput(1, (int)nValues, CV_32FC1);
+	cv::randu(randomInput, 0.0, 127.0);
+	std::vector<unsigned char> input(nValues);
+	for (size_t i = 0; i < nValues; i++) {
+		input[i] = static_cast<unsigned char>(randomInput.at<float>(0, (int)i));
+	}
+	FilterINT8Quantization inputQuantization = { 1.0f / 127.0f, 0, 127 };
+	FilterINT8Quantization outputQuantization = { 4.0f / 127.0f, 0, 127 };
+
+	const char *names[] = { "avx512vnni", "avx512", "avx2", "sse", "neon",
+			"scalar" };
+	std::string selected = filterKernels().name;
+	AlignedBuffer packedWeights, requantization;
+	std::vector<unsigned char> quantized(nValues), referenceQuantized;
+	std::vector<float> floats(nValues), referenceFloats;
+	size_t nQuantizedMismatches = 0, nFloatMismatches = 0;
+
+	std::cout << "  int8 kernels :";
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (!filterKernelsSelect(names[i])) {
+			continue;
+		}
+		filterINT8PackWeights(weights, biases, nPlanes, nPlanes,
+				inputQuantization, packedWeights, requantization);
+		filterINT8Process(input.data(), nPlanes, size, packedWeights.data(),
+				requantization.data(), quantized.data(), &outputQuantization,
+				nPlanes / 8, 0, size.height);
+		filterINT8Process(input.data(), nPlanes, size, packedWeights.data(),
+				requantization.data(), floats.data(), nullptr,
+				nPlanes / 8, 0, size.height);
+		std::cout << " " << names[i];
+
+		if (referenceQuantized.empty()) {
+			referenceQuantized = quantized;
+			referenceFloats = floats;
+			continue;
+		}
+		for (size_t v = 0; v < nValues; v++) {
+			nQuantizedMismatches += (quantized[v] != referenceQuantized[v]);
+			nFloatMismatches += (floats[v] != referenceFloats[v]);
+		}
+	}
+	filterKernelsSelect(selected);
+
+	std::cout << ", " << nQuantizedMismatches << " quantized and "
+			<< nFloatMismatches << " float outputs differ" << std::endl;
+}
+
+bool benchmarkModels(std::vector<std::unique_ptr<Model> > &models,
+		int planeSize) {
+
+	modelUtility &utility = modelUtility::getInstance();
+	FilterEngine engine = utility.getFilterEngine();
+	if (engine == FilterEngine::GL) {
+		std::cerr << "Error : benchmark : \n"
+				"benchmark is for the cpu engines." << std::endl;
+		return false;
+	}
+
+	cv::Size size(planeSize, planeSize);
+	std::vector<cv::Mat> inputPlanes(1, cv::Mat(size, CV_32FC1));
+	cv::randu(inputPlanes[0], 0.0, 1.0);
+
+	ThreadPool &threadPool = utility.getThreadPool();
+	std::cout << "benchmark : " << planeSize << "x" << planeSize << ", "
+			<< threadPool.getNumberOfThreads() << " threads";
+	if (threadPool.isPinned()) {
+		std::cout << " pinned on " << threadPool.getNumberOfNodes()
+				<< " NUMA node(s)";
+	}
+	std::cout << std::endl;
+
+	double totalSeconds = 0.0, totalReferenceSeconds = 0.0;
+	double maxDeviation = 0.0;
+
+	for (int index = 0; index < (int)models.size(); index++) {
+		Model &model = *models[index];
+		std::vector<cv::Mat> outputPlanes, referencePlanes;
+
+		utility.setFilterEngine(FilterEngine::Reference);
+		double referenceSeconds = filterSeconds(model, inputPlanes,
+				referencePlanes);
+		utility.setFilterEngine(engine);
+		double seconds = filterSeconds(model, inputPlanes, outputPlanes);
+
+		// deviation from the reference over every output plane
+		double layerMax = 0.0, layerSum = 0.0;
+		for (int op = 0; op < (int)outputPlanes.size(); op++) {
+			cv::Mat diff;
+			cv::absdiff(outputPlanes[op], referencePlanes[op], diff);
+			layerMax = std::max(layerMax, cv::norm(diff, cv::NORM_INF));
+			layerSum += cv::norm(diff, cv::NORM_L1);
+		}
+		double layerMean = layerSum / (size.area() * outputPlanes.size());
+
+		std::cout << "  layer " << index + 1 << " ("
+				<< model.getNInputPlanes() << "->" << model.getNOutputPlanes()
+				<< ") : " << seconds * 1000.0 << " ms (reference "
+				<< referenceSeconds * 1000.0 << " ms), max diff " << layerMax
+				<< ", mean diff " << layerMean << std::endl;
+
+		totalSeconds += seconds;
+		totalReferenceSeconds += referenceSeconds;
+		maxDeviation = std::max(maxDeviation, layerMax);
+
+		// the reference output feeds the next layer, so that the
+		// deviation of each layer is measured on its own
+		inputPlanes = std::move(referencePlanes);
+	}
+
+	std::cout << "  total : " << totalSeconds * 1000.0 << " ms (reference "
+			<< totalReferenceSeconds * 1000.0 << " ms), max diff "
+			<< maxDeviation << std::endl;
+
+	// steady state : the whole chain on an execution plan, the way
+	// convertWithModels runs a block. the first run sizes the scratch
+	// buffers, the second one should not allocate at all.
+	cv::Mat plane(size, CV_32FC1), outputPlane(size, CV_32FC1);
+	cv::randu(plane, 0.0, 1.0);
+	ExecutionPlan plan(models, size);
+	plan.run(plane, outputPlane, false);
+
+	uint64_t allocationCount = getAllocationCount();
+	auto start = std::chrono::steady_clock::now();
+	plan.run(plane, outputPlane, false);
+	double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	allocationCount = getAllocationCount() - allocationCount;
+
+	std::cout << "  steady state : " << seconds * 1000.0 << " ms";
+	if (isAllocationCounted()) {
+		std::cout << ", " << allocationCount << " heap allocations";
+	}
+	std::cout << std::endl;
+
+	// whether the large buffers actually got huge pages
+	if (alignedBufferGetHugePages()) {
+		AlignedBufferHugePageStatistics pages =
+				alignedBufferHugePageStatistics();
+		const double megaBytes = 1024.0 * 1024.0;
+		std::cout << "  huge pages : explicit "
+				<< pages.explicitBytes / megaBytes << " MB, transparent "
+				<< pages.transparentBytes / megaBytes << " MB of "
+				<< pages.advisedBytes / megaBytes << " MB advised, "
+				<< pages.nHeapFallbacks << " buffers on normal pages"
+				<< std::endl;
+	}
+
+	// tile batching : the quarters of the plane one after the other and
+	// in batches of the size convertWithModels would take
+	if (utility.getTileBatchingEnabled()) {
+		cv::Size quarterSize(size.width / 2, size.height / 2);
+		std::vector<cv::Mat> quarters, tileOutputPlanes, batchOutputPlanes;
+		for (int q = 0; q < 4; q++) {
+			quarters.push_back(plane(cv::Rect((q % 2) * quarterSize.width,
+					(q / 2) * quarterSize.height, quarterSize.width,
+					quarterSize.height)));
+		}
+		int batchSize = ExecutionPlan::chooseBatchSize(models, quarterSize, 4);
+		ExecutionPlan tilePlan(models, quarterSize);
+		ExecutionPlan batchPlan(models, quarterSize, batchSize);
+		tileOutputPlanes.resize(4);
+		for (int q = 0; q < 4; q++) {
+			tilePlan.run(quarters[q], tileOutputPlanes[q], false);
+		}
+		std::vector<cv::Mat> batch;
+		double maxDiff = 0.0;
+		for (int q = 0; q < 4; q += batchSize) {
+			batch.assign(quarters.begin() + q,
+					quarters.begin() + std::min(q + batchSize, 4));
+			batchPlan.run(batch, batchOutputPlanes, false);
+			for (size_t b = 0; b < batch.size(); b++) {
+				maxDiff = std::max(maxDiff, cv::norm(batchOutputPlanes[b],
+						tileOutputPlanes[q + b], cv::NORM_INF));
+			}
+		}
+
+		start = std::chrono::steady_clock::now();
+		for (int q = 0; q < 4; q++) {
+			tilePlan.run(quarters[q], tileOutputPlanes[q], false);
+		}
+		double tileSeconds = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int q = 0; q < 4; q += batchSize) {
+			batch.assign(quarters.begin() + q,
+					quarters.begin() + std::min(q + batchSize, 4));
+			batchPlan.run(batch, batchOutputPlanes, false);
+		}
+		double batchSeconds = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "  4 tiles of " << quarterSize.width << "x"
+				<< quarterSize.height << " : " << tileSeconds * 1000.0
+				<< " ms one by one, " << batchSeconds * 1000.0
+				<< " ms in batches of " << batchSize << " (max diff "
+				<< maxDiff << ")" << std::endl;
+	}
+
+	// scaling over the NUMA nodes : the same number of threads per node
+	// on 1 .. N nodes (at most the nodes of the setting), every plan first
+	// touches its activations
+	int nNodes = CPUTopology::get().getNumberOfNodes();
+	int maxNodes = utility.getThreadPinningNodes();
+	if (maxNodes > 0) {
+		nNodes = std::min(nNodes, maxNodes);
+	}
+	if (utility.getThreadPinningEnabled() && nNodes > 1) {
+		int nJob = utility.getNumberOfJobs();
+		int nThreadsPerNode = std::max(nJob / nNodes, 1);
+		cv::Mat nodesOutputPlane(size, CV_32FC1);
+		for (int nUsedNodes = 1; nUsedNodes <= nNodes; nUsedNodes++) {
+			utility.setNumberOfJobs(nThreadsPerNode * nUsedNodes);
+			utility.setThreadPinning(true, nUsedNodes);
+			ExecutionPlan nodesPlan(models, size);
+			nodesPlan.run(plane, nodesOutputPlane, false);
+
+			start = std::chrono::steady_clock::now();
+			nodesPlan.run(plane, nodesOutputPlane, false);
+			double nodesSeconds = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+			std::cout << "  " << nUsedNodes << " node(s), "
+					<< nThreadsPerNode * nUsedNodes << " threads : "
+					<< nodesSeconds * 1000.0 << " ms" << std::endl;
+		}
+		utility.setNumberOfJobs(nJob);
+		utility.setThreadPinning(true, maxNodes);
+	}
+
+	// half precision activations : deviation of the chain output from the
+	// chain on float activations
+	if (utility.getHalfActivationsEnabled()) {
+		cv::Mat floatOutputPlane(size, CV_32FC1), diff;
+		utility.setHalfActivationsEnabled(false);
+		ExecutionPlan(models, size).run(plane, floatOutputPlane, false);
+		utility.setHalfActivationsEnabled(true);
+
+		cv::absdiff(outputPlane, floatOutputPlane, diff);
+		std::cout << "  fp16 activations : max diff "
+				<< cv::norm(diff, cv::NORM_INF) << ", mean diff "
+				<< cv::norm(diff, cv::NORM_L1) / size.area()
+				<< " against fp32" << std::endl;
+	}
+
+	// int8 engine : deviation of the chain output from the chain of the
+	// float cpu engine
+	if (engine == FilterEngine::INT8) {
+		cv::Mat floatOutputPlane(size, CV_32FC1), diff;
+		utility.setFilterEngine(FilterEngine::CPU);
+		ExecutionPlan(models, size).run(plane, floatOutputPlane, false);
+		utility.setFilterEngine(engine);
+
+		cv::absdiff(outputPlane, floatOutputPlane, diff);
+		std::cout << "  int8 : max diff "
+				<< cv::norm(diff, cv::NORM_INF) << ", mean diff "
+				<< cv::norm(diff, cv::NORM_L1) / size.area()
+				<< " against fp32" << std::endl;
+
+		compareINT8Variants();
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,28 @@
+/*
+ * benchmark.hpp
+ *   benchmark of the cpu filter engines
+ *
+ *   Every layer of a model chain is run on a random plane with the
+ *   selected engine and with the cv::filter2D reference, and the time
+ *   and the deviation from the reference are reported per layer.
+ */
+
+#ifndef BENCHMARK_HPP_
+#define BENCHMARK_HPP_
+
+#include "modelHandler.hpp"
+#include <memory>
+#include <vector>
+
+namespace w2xc {
+
+/**
+ * run models on planeSize x planeSize planes with the current engine
+ * and the reference engine, print time and deviation of every layer.
+ */
+bool benchmarkModels(std::vector<std::unique_ptr<Model> > &models,
+		int planeSize);
+
+}
+
+#endif /* BENCHMARK_HPP_ */
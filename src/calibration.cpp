@@ -0,0 +1,181 @@
+#include "calibration.hpp"
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace w2xc {
+
+std::string calibrationFileName(const std::string &modelFileName) {
+	std::string fileName = modelFileName;
+	std::string::size_type dot = fileName.rfind(".bin");
+	if (dot != std::string::npos && dot + 4 == fileName.size()) {
+		fileName.erase(dot);
+	}
+	return fileName + ".int8.json";
+}
+
+// affine quantization covering [minValue, maxValue] and 0.
+// one channel inputs may use the full byte (see filterINT8.h).
+static FilterINT8Quantization quantizationOfRange(double minValue,
+		double maxValue, int nInputPlanes) {
+	FilterINT8Quantization quantization;
+	quantization.maxValue = (nInputPlanes == 1) ? 255 : 127;
+	minValue = std::min(minValue, 0.0);
+	maxValue = std::max(maxValue, 0.0);
+	double scale = (maxValue - minValue) / quantization.maxValue;
+	if (scale <= 0.0) {
+		scale = 1.0 / quantization.maxValue;
+	}
+	int zeroPoint = static_cast<int>(std::floor(-minValue / scale + 0.5));
+	quantization.scale = static_cast<float>(scale);
+	quantization.zeroPoint = std::min(std::max(zeroPoint, 0),
+			quantization.maxValue);
+	return quantization;
+}
+
+bool calibrateModels(std::vector<std::unique_ptr<Model> > &models,
+		const std::vector<cv::Mat> &samplePlanes, const std::string &fileName) {
+
+	int nModel = static_cast<int>(models.size());
+	std::vector<double> minValues(nModel,
+			std::numeric_limits<double>::max());
+	std::vector<double> maxValues(nModel,
+			-std::numeric_limits<double>::max());
+	cv::Size blockSize = modelUtility::getInstance().getBlockSize();
+
+	std::vector<cv::Mat> inputPlanes, outputPlanes;
+	for (auto& samplePlane : samplePlanes) {
+		// the padding of convertWithModels
+		cv::Mat paddedPlane;
+		cv::copyMakeBorder(samplePlane, paddedPlane, nModel, nModel, nModel,
+				nModel, cv::BORDER_REPLICATE);
+		cv::Size size = paddedPlane.size();
+
+		// the ranges don't depend on the overlap of the blocks
+		for (int y = 0; y < size.height; y += blockSize.height) {
+			for (int x = 0; x < size.width; x += blockSize.width) {
+				cv::Rect block(x, y, std::min(blockSize.width, size.width - x),
+						std::min(blockSize.height, size.height - y));
+				inputPlanes.assign(1, paddedPlane(block).clone());
+
+				for (int index = 0; index < nModel; index++) {
+					for (auto& inputPlane : inputPlanes) {
+						double minValue, maxValue;
+						cv::minMaxLoc(inputPlane, &minValue, &maxValue);
+						minValues[index] = std::min(minValues[index], minValue);
+						maxValues[index] = std::max(maxValues[index], maxValue);
+					}
+					if (!models[index]->filter(inputPlanes, outputPlanes)) {
+						return false;
+					}
+					std::swap(inputPlanes, outputPlanes);
+				}
+			}
+		}
+	}
+
+	picojson::array layers;
+	for (int index = 0; index < nModel; index++) {
+		FilterINT8Quantization quantization = quantizationOfRange(
+				minValues[index], maxValues[index],
+				models[index]->getNInputPlanes());
+		picojson::object layer;
+		layer["min"] = picojson::value(minValues[index]);
+		layer["max"] = picojson::value(maxValues[index]);
+		layer["scale"] = picojson::value(static_cast<double>(quantization.scale));
+		layer["zero_point"] = picojson::value(
+				static_cast<double>(quantization.zeroPoint));
+		layer["max_value"] = picojson::value(
+				static_cast<double>(quantization.maxValue));
+		layers.push_back(picojson::value(layer));
+	}
+	picojson::object root;
+	root["layers"] = picojson::value(layers);
+
+	std::ofstream jsonFile(fileName);
+	if (!jsonFile.is_open()) {
+		std::cerr << "Error : couldn't open " << fileName << std::endl;
+		return false;
+	}
+	jsonFile << picojson::value(root).serialize(true);
+
+	return true;
+}
+
+bool loadCalibration(const std::string &fileName,
+		std::vector<std::unique_ptr<Model> > &models) {
+
+	std::ifstream jsonFile;
+
+	jsonFile.open(fileName);
+	if (!jsonFile.is_open()) {
+		std::cerr << "Error : couldn't open " << fileName << "\n"
+				"run --calibrate with sample images first." << std::endl;
+		return false;
+	}
+
+	picojson::value jsonValue;
+	jsonFile >> jsonValue;
+	std::string errMsg = picojson::get_last_error();
+	if (!errMsg.empty()) {
+		std::cerr << "Error : PicoJSON Error : " << errMsg << std::endl;
+		return false;
+	}
+
+	if (!jsonValue.is<picojson::object>()
+			|| !jsonValue.get<picojson::object>()["layers"].is<picojson::array>()) {
+		std::cerr << "Error : " << fileName << " has no layers" << std::endl;
+		return false;
+	}
+	picojson::array &layers =
+			jsonValue.get<picojson::object>()["layers"].get<picojson::array>();
+	if (layers.size() != models.size()) {
+		std::cerr << "Error : " << fileName << " : number of layers mismatch."
+				<< std::endl;
+		std::cerr << layers.size() << "," << models.size() << std::endl;
+		return false;
+	}
+
+	std::vector<FilterINT8Quantization> quantizations;
+	for (int index = 0; index < (int)layers.size(); index++) {
+		if (!layers[index].is<picojson::object>()
+				|| !layers[index].get<picojson::object>()["scale"].is<double>()
+				|| !layers[index].get<picojson::object>()["zero_point"].is<double>()
+				|| !layers[index].get<picojson::object>()["max_value"].is<double>()) {
+			std::cerr << "Error : " << fileName << " : layer " << index + 1
+					<< " has no scale, zero_point or max_value" << std::endl;
+			return false;
+		}
+		picojson::object &layer = layers[index].get<picojson::object>();
+		FilterINT8Quantization quantization;
+		quantization.scale = static_cast<float>(layer["scale"].get<double>());
+		quantization.zeroPoint =
+				static_cast<int>(layer["zero_point"].get<double>());
+		quantization.maxValue =
+				static_cast<int>(layer["max_value"].get<double>());
+
+		// 255 would saturate the pairs of products of several channels
+		int maxValue = (models[index]->getNInputPlanes() == 1) ? 255 : 127;
+		if (!(quantization.scale > 0.0f) || quantization.maxValue < 1
+				|| quantization.maxValue > maxValue
+				|| quantization.zeroPoint < 0
+				|| quantization.zeroPoint > quantization.maxValue) {
+			std::cerr << "Error : " << fileName << " : invalid quantization "
+					"of layer " << index + 1 << std::endl;
+			return false;
+		}
+		quantizations.push_back(quantization);
+	}
+
+	// the output of a layer is the input of the next one
+	for (int index = 0; index < (int)models.size(); index++) {
+		models[index]->setQuantization(quantizations[index],
+				(index + 1 < (int)models.size()) ?
+				&quantizations[index + 1] : nullptr);
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,44 @@
+/*
+ * calibration.hpp
+ *   activation scales of the int8 engine
+ *
+ *   The models are run in float over sample planes and the range of the
+ *   input of every layer is recorded. Each range becomes an affine
+ *   quantization (scale, zero point) of unsigned 8 bit values, written to
+ *   a JSON file next to the model file (noise1_model.bin ->
+ *   noise1_model.int8.json). The weight scales are per output plane and
+ *   come from the weights themselves when they are packed.
+ */
+
+#ifndef CALIBRATION_HPP_
+#define CALIBRATION_HPP_
+
+#include "modelHandler.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace w2xc {
+
+/**
+ * name of the calibration file of a model file
+ */
+std::string calibrationFileName(const std::string &modelFileName);
+
+/**
+ * run models on samplePlanes (single channel, CV_32FC1) with the current
+ * float engine and write the quantization of every layer input to fileName.
+ * planes larger than the block size are processed in blocks.
+ */
+bool calibrateModels(std::vector<std::unique_ptr<Model> > &models,
+		const std::vector<cv::Mat> &samplePlanes, const std::string &fileName);
+
+/**
+ * set the quantization of models from fileName.
+ */
+bool loadCalibration(const std::string &fileName,
+		std::vector<std::unique_ptr<Model> > &models);
+
+}
+
+#endif /* CALIBRATION_HPP_ */
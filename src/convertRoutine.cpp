@@ -1,16 +1,30 @@
-
 #include <exception>
+#include <algorithm>
 #include "convertRoutine.hpp"
-#include "filterGL.h"
+#include "executionPlan.hpp"
 
 namespace w2xc {
 
 // converting process inside program
-static bool convertWithModelsBasic(cv::Mat &inputPlane, cv::Mat &outputPlane,
-		std::vector<std::unique_ptr<Model> > &models);
 static bool convertWithModelsBlockSplit(cv::Mat &inputPlane,
 		cv::Mat &outputPlane, std::vector<std::unique_ptr<Model> > &models);
 
+// the plan of the last call. the calls that follow with the same models
+// and tile size (the 2x iterations, the next images) reuse it instead of
+// packing and allocating again. only one plan is kept : its arena is
+// freed before the plan of another model chain is built.
+static std::unique_ptr<ExecutionPlan> cachedPlan;
+
+static ExecutionPlan &getPlan(std::vector<std::unique_ptr<Model> > &models,
+		cv::Size tileSize, int batchSize = 1) {
+
+	if (!cachedPlan || !cachedPlan->isFor(models, tileSize, batchSize)) {
+		cachedPlan.reset();
+		cachedPlan.reset(new ExecutionPlan(models, tileSize, batchSize));
+	}
+	return *cachedPlan;
+}
+
 bool convertWithModels(cv::Mat &inputPlane, cv::Mat &outputPlane,
 		std::vector<std::unique_ptr<Model> > &models, bool blockSplitting) {
 
@@ -18,7 +32,9 @@ bool convertWithModels(cv::Mat &inputPlane, cv::Mat &outputPlane,
 	bool requireSplitting = (inputPlane.size().width * inputPlane.size().height)
 			> blockSize.width * blockSize.height;
 //	requireSplitting = true;
-	if (blockSplitting && requireSplitting) {
+	// the line buffer executor needs O(width) memory only, no splitting.
+	bool lineBuffer = ExecutionPlan::usesLineBuffer(models);
+	if (blockSplitting && requireSplitting && !lineBuffer) {
 		return convertWithModelsBlockSplit(inputPlane, outputPlane, models);
 	} else {
 		//insert padding to inputPlane
@@ -28,7 +44,13 @@ bool convertWithModels(cv::Mat &inputPlane, cv::Mat &outputPlane,
 		cv::copyMakeBorder(inputPlane, tempMat, nModel, nModel, nModel, nModel,
 				cv::BORDER_REPLICATE);
 
-		bool ret = convertWithModelsBasic(tempMat, outputPlane, models);
+		ExecutionPlan &plan = getPlan(models, tempMat.size());
+		if (lineBuffer) {
+			std::cout << "line buffers " << plan.getLineBufferBytes() / 1024
+					<< " KiB ..." << std::endl;
+		}
+
+		bool ret = plan.run(tempMat, outputPlane);
 		if (ret == false) {
 			return false;
 		}
@@ -46,64 +68,6 @@ bool convertWithModels(cv::Mat &inputPlane, cv::Mat &outputPlane,
 
 }
 
-static bool convertWithModelsBasic(cv::Mat &inputPlane, cv::Mat &outputPlane,
-		std::vector<std::unique_ptr<Model> > &models) {
-
-	cv::Size size = inputPlane.size();
-
-	try {
-		// initialize GL filter core
-		filterGLInit(size.width, size.height);
-
-		// setup shader per model
-		for (int index = 0; index < (int)models.size(); index++) {
-			if (!models[index]->loadGLShader()) {
-				std::exit(-1);
-			}
-		}
-
-		// set the input image data
-		cv::Mat tempPlane = cv::Mat::zeros(size, CV_32FC1);
-		inputPlane.copyTo(tempPlane);
-		filterGLSetInputData(tempPlane);
-
-		for (int index = 0; index <= (int)models.size(); index++) {
-			
-			//std::cout << "Iteration #" << (index + 1) << "..." << std::endl;
-			
-			std::cout << "\r[";
-			int progress = 0;
-			for (; progress < index; progress++)               std::cout << "=";
-			for (; progress < (int)models.size(); progress++)  std::cout << " ";
-			std::cout << "]";
-			std::cout.flush();
-
-			if (index >= (int)models.size()) {
-				break;
-			}
-			
-			// core processing
-			if (!models[index]->filterGL(index)) {
-				std::exit(-1);
-			}
-		}
-		// get the output image data
-		filterGLGetOutputData(tempPlane);
-		tempPlane.copyTo(outputPlane);
-		
-		std::cout << " ok" << std::endl;
-		
-		// finalize GL filter core
-		filterGLRelease();
-	} catch (std::exception& e) {
-		std::cout << e.what() << std::endl;
-		return false;
-	}
-
-	return true;
-
-}
-
 static bool convertWithModelsBlockSplit(cv::Mat &inputPlane,
 		cv::Mat &outputPlane, std::vector<std::unique_ptr<Model> > &models) {
 
@@ -131,14 +95,29 @@ static bool convertWithModelsBlockSplit(cv::Mat &inputPlane,
 	std::cout << "split blocks " << splitRows << "x" << splitColumns << " ..."
 			  << std::endl;
 
+	// one plan for all blocks, none is larger than blockSize.
+	// with tile batching the blocks run in batches of the plan, row by row
+	cv::Size planSize(std::min(blockSize.width, tempMat.size().width),
+			std::min(blockSize.height, tempMat.size().height));
+	int batchSize = ExecutionPlan::chooseBatchSize(models, planSize,
+			splitRows * splitColumns);
+	ExecutionPlan &plan = getPlan(models, planSize, batchSize);
+	if (plan.getBatchSize() > 1) {
+		std::cout << "batches of " << plan.getBatchSize() << " blocks ..."
+				<< std::endl;
+	}
+
 	// start to convert
 	cv::Mat processRow;
-	cv::Mat processBlock;
-	cv::Mat processBlockOutput;
+	std::vector<cv::Mat> processBlocks;
+	std::vector<cv::Mat> processBlockOutputs;
+	std::vector<std::pair<unsigned int, unsigned int> > batchBlocks;
 	cv::Mat writeMatTo;
 	cv::Mat writeMatFrom;
 	outputPlane = cv::Mat::zeros(outputSize, CV_32FC1);
-	for (unsigned int r = 0; r < splitRows; r++) {
+	for (unsigned int i = 0; i < splitRows * splitColumns; i++) {
+		unsigned int r = i / splitColumns;
+		unsigned int c = i % splitColumns;
 		if (r == splitRows - 1) {
 			processRow = tempMat.rowRange(r * (blockSize.height - 2 * nModel),
 					tempMat.size().height);
@@ -146,39 +125,51 @@ static bool convertWithModelsBlockSplit(cv::Mat &inputPlane,
 			processRow = tempMat.rowRange(r * (blockSize.height - 2 * nModel),
 					r * (blockSize.height - 2 * nModel) + blockSize.height);
 		}
-		for (unsigned int c = 0; c < splitColumns; c++) {
-			if (c == splitColumns - 1) {
-				processBlock = processRow.colRange(
-						c * (blockSize.width - 2 * nModel),
-						tempMat.size().width);
-			} else {
-				processBlock = processRow.colRange(
-						c * (blockSize.width - 2 * nModel),
-						c * (blockSize.width - 2 * nModel) + blockSize.width);
-			}
-
-			std::cout << "process block (" << (c + 1) << "," << (r + 1) << ") ..."
-					<< std::endl;
-			if (!convertWithModelsBasic(processBlock, processBlockOutput,
-					models)) {
-				std::cerr << "w2xc::convertWithModelsBasic()\n"
-						"in w2xc::convertWithModelsBlockSplit() : \n"
-						"something error has occured. stop." << std::endl;
-				return false;
-			}
+		if (c == splitColumns - 1) {
+			processBlocks.push_back(processRow.colRange(
+					c * (blockSize.width - 2 * nModel),
+					tempMat.size().width));
+		} else {
+			processBlocks.push_back(processRow.colRange(
+					c * (blockSize.width - 2 * nModel),
+					c * (blockSize.width - 2 * nModel) + blockSize.width));
+		}
+		batchBlocks.push_back(std::make_pair(r, c));
 
+		if ((int)processBlocks.size() < plan.getBatchSize()
+				&& i + 1 < splitRows * splitColumns) {
+			continue;
+		}
+
+		std::cout << "process block (" << (batchBlocks.front().second + 1)
+				<< "," << (batchBlocks.front().first + 1) << ")";
+		if (batchBlocks.size() > 1) {
+			std::cout << " - (" << (c + 1) << "," << (r + 1) << ")";
+		}
+		std::cout << " ..." << std::endl;
+		if (!plan.run(processBlocks, processBlockOutputs)) {
+			std::cerr << "w2xc::ExecutionPlan::run()\n"
+					"in w2xc::convertWithModelsBlockSplit() : \n"
+					"something error has occured. stop." << std::endl;
+			return false;
+		}
+
+		for (size_t b = 0; b < batchBlocks.size(); b++) {
+			unsigned int blockRow = batchBlocks[b].first;
+			unsigned int blockColumn = batchBlocks[b].second;
+			cv::Mat &processBlockOutput = processBlockOutputs[b];
 			writeMatFrom = processBlockOutput(
 					cv::Range(nModel,
 							processBlockOutput.size().height - nModel),
 					cv::Range(nModel,
 							processBlockOutput.size().width - nModel));
 			writeMatTo = outputPlane(
-					cv::Range(r * (blockSize.height - 2 * nModel),
-							r * (blockSize.height - 2 * nModel)
+					cv::Range(blockRow * (blockSize.height - 2 * nModel),
+							blockRow * (blockSize.height - 2 * nModel)
 									+ processBlockOutput.size().height
 									- 2 * nModel),
-					cv::Range(c * (blockSize.height - 2 * nModel),
-							c * (blockSize.height - 2 * nModel)
+					cv::Range(blockColumn * (blockSize.height - 2 * nModel),
+							blockColumn * (blockSize.height - 2 * nModel)
 									+ processBlockOutput.size().width
 									- 2 * nModel));
 			assert(
@@ -186,8 +177,10 @@ static bool convertWithModelsBlockSplit(cv::Mat &inputPlane,
 							&& writeMatTo.size().width
 									== writeMatFrom.size().width);
 			writeMatFrom.copyTo(writeMatTo);
+		}
 
-		} // end process 1 column
+		processBlocks.clear();
+		batchBlocks.clear();
 
 	} // end process all blocks
 
@@ -0,0 +1,424 @@
+#include "cpuTopology.hpp"
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <utility>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+	#define NOMINMAX
+	#endif
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <fstream>
+	#include <string>
+	#include <cstdlib>
+	#include <cstdio>
+	#include <dirent.h>
+	#include <pthread.h>
+	#include <sched.h>
+#elif defined(__APPLE__)
+	#include <cstdint>
+	#include <sys/types.h>
+	#include <sys/sysctl.h>
+#endif
+
+namespace w2xc {
+
+#if defined(__linux__)
+
+static bool readFile(const std::string &path, std::string &text) {
+	std::ifstream file(path.c_str());
+	return static_cast<bool>(std::getline(file, text));
+}
+
+static int readInt(const std::string &path, int defaultValue) {
+	std::string text;
+	if (!readFile(path, text) || text.empty()) {
+		return defaultValue;
+	}
+	return std::atoi(text.c_str());
+}
+
+// "0-3,8,10-11" of sysfs
+static std::vector<int> parseList(const std::string &text) {
+	std::vector<int> values;
+	size_t position = 0;
+	while (position < text.size()) {
+		size_t comma = text.find(',', position);
+		if (comma == std::string::npos) {
+			comma = text.size();
+		}
+		std::string range = text.substr(position, comma - position);
+		size_t dash = range.find('-');
+		if (!range.empty()) {
+			int first = std::atoi(range.c_str());
+			int last = (dash == std::string::npos) ?
+					first : std::atoi(range.c_str() + dash + 1);
+			for (int i = first; i <= last; i++) {
+				values.push_back(i);
+			}
+		}
+		position = comma + 1;
+	}
+	return values;
+}
+
+static void detectProcessors(std::vector<LogicalProcessor> &processors,
+		size_t &l2CacheBytes) {
+
+	const std::string cpuPath = "/sys/devices/system/cpu/";
+
+	// the processors of the affinity of the process (cgroups, taskset)
+	std::vector<int> ids;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &set)) {
+				ids.push_back(i);
+			}
+		}
+	} else {
+		std::string text;
+		if (readFile(cpuPath + "online", text)) {
+			ids = parseList(text);
+		}
+	}
+
+	// NUMA node of the processors, nodes renumbered in order
+	std::map<int, int> nodeOfCpu;
+	if (DIR *directory = opendir("/sys/devices/system/node")) {
+		std::vector<int> nodeNumbers;
+		while (dirent *entry = readdir(directory)) {
+			int number;
+			if (std::sscanf(entry->d_name, "node%d", &number) == 1) {
+				nodeNumbers.push_back(number);
+			}
+		}
+		closedir(directory);
+		std::sort(nodeNumbers.begin(), nodeNumbers.end());
+		for (size_t n = 0; n < nodeNumbers.size(); n++) {
+			std::string text;
+			char path[64];
+			std::snprintf(path, sizeof(path),
+					"/sys/devices/system/node/node%d/cpulist", nodeNumbers[n]);
+			if (readFile(path, text)) {
+				std::vector<int> cpus = parseList(text);
+				for (int cpu : cpus) {
+					nodeOfCpu[cpu] = static_cast<int>(n);
+				}
+			}
+		}
+	}
+
+	// Intel hybrid processors list their efficient cores as cpu_atom,
+	// ARM big.LITTLE has a lower cpu_capacity on the little cores
+	std::vector<int> atomCpus;
+	std::string atomText;
+	if (readFile("/sys/devices/cpu_atom/cpus", atomText)) {
+		atomCpus = parseList(atomText);
+	}
+	std::map<int, int> capacityOfCpu;
+	int maxCapacity = 0;
+
+	std::map<std::pair<int, int>, int> coreIndices;
+	for (int id : ids) {
+		std::string topologyPath = cpuPath + "cpu" + std::to_string(id)
+				+ "/topology/";
+		LogicalProcessor processor;
+		processor.id = id;
+		processor.group = 0;
+		processor.package = std::max(
+				readInt(topologyPath + "physical_package_id", 0), 0);
+		processor.node = nodeOfCpu.count(id) ? nodeOfCpu[id] : 0;
+		std::pair<int, int> core(processor.package,
+				readInt(topologyPath + "core_id", id));
+		if (!coreIndices.count(core)) {
+			int index = static_cast<int>(coreIndices.size());
+			coreIndices[core] = index;
+		}
+		processor.core = coreIndices[core];
+		processor.efficient = std::find(atomCpus.begin(), atomCpus.end(), id)
+				!= atomCpus.end();
+		processors.push_back(processor);
+
+		int capacity = readInt(cpuPath + "cpu" + std::to_string(id)
+				+ "/cpu_capacity", 0);
+		capacityOfCpu[id] = capacity;
+		maxCapacity = std::max(maxCapacity, capacity);
+	}
+	if (atomCpus.empty()) {
+		for (auto& processor : processors) {
+			processor.efficient = capacityOfCpu[processor.id] < maxCapacity;
+		}
+	}
+
+	// caches of the first processor, size as "2048K"
+	if (!ids.empty()) {
+		for (int index = 0; ; index++) {
+			std::string cachePath = cpuPath + "cpu" + std::to_string(ids[0])
+					+ "/cache/index" + std::to_string(index) + "/";
+			std::string type, size;
+			if (!readFile(cachePath + "type", type)) {
+				break;
+			}
+			if (readInt(cachePath + "level", 0) == 2 && type != "Instruction"
+					&& readFile(cachePath + "size", size)) {
+				size_t bytes = std::strtoul(size.c_str(), nullptr, 10);
+				if (size.find('K') != std::string::npos) {
+					bytes *= 1024;
+				} else if (size.find('M') != std::string::npos) {
+					bytes *= 1024 * 1024;
+				}
+				l2CacheBytes = bytes;
+			}
+		}
+	}
+}
+
+#elif defined(_WIN32)
+
+static void detectProcessors(std::vector<LogicalProcessor> &processors,
+		size_t &l2CacheBytes) {
+
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+	std::vector<char> buffer(length);
+	if (length == 0 || !GetLogicalProcessorInformationEx(RelationAll,
+			reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(
+			buffer.data()), &length)) {
+		return;
+	}
+
+	// (group, number) -> package, node
+	std::map<std::pair<int, int>, int> packageOf, nodeOf;
+	std::map<int, int> nodeIndices;
+	std::vector<int> efficiencyClasses;
+	int maxEfficiencyClass = 0;
+	int nPackages = 0;
+
+	for (DWORD offset = 0; offset < length; ) {
+		auto info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(
+				buffer.data() + offset);
+		offset += info->Size;
+
+		if (info->Relationship == RelationProcessorCore) {
+			// EfficiencyClass follows Flags (Windows 10 SDK), higher is
+			// faster. older SDKs call it Reserved[0].
+			int efficiencyClass =
+					reinterpret_cast<const BYTE *>(&info->Processor.Flags)[1];
+			int core = static_cast<int>(efficiencyClasses.size());
+			efficiencyClasses.push_back(efficiencyClass);
+			maxEfficiencyClass = std::max(maxEfficiencyClass, efficiencyClass);
+			for (WORD g = 0; g < info->Processor.GroupCount; g++) {
+				const GROUP_AFFINITY &mask = info->Processor.GroupMask[g];
+				for (int bit = 0; bit < (int)sizeof(KAFFINITY) * 8; bit++) {
+					if (mask.Mask & (static_cast<KAFFINITY>(1) << bit)) {
+						LogicalProcessor processor;
+						processor.id = bit;
+						processor.group = mask.Group;
+						processor.package = 0;
+						processor.node = 0;
+						processor.core = core;
+						processor.efficient = false;
+						processors.push_back(processor);
+					}
+				}
+			}
+		} else if (info->Relationship == RelationProcessorPackage) {
+			for (WORD g = 0; g < info->Processor.GroupCount; g++) {
+				const GROUP_AFFINITY &mask = info->Processor.GroupMask[g];
+				for (int bit = 0; bit < (int)sizeof(KAFFINITY) * 8; bit++) {
+					if (mask.Mask & (static_cast<KAFFINITY>(1) << bit)) {
+						packageOf[std::make_pair((int)mask.Group, bit)] =
+								nPackages;
+					}
+				}
+			}
+			nPackages++;
+		} else if (info->Relationship == RelationNumaNode) {
+			int number = static_cast<int>(info->NumaNode.NodeNumber);
+			if (!nodeIndices.count(number)) {
+				int index = static_cast<int>(nodeIndices.size());
+				nodeIndices[number] = index;
+			}
+			const GROUP_AFFINITY &mask = info->NumaNode.GroupMask;
+			for (int bit = 0; bit < (int)sizeof(KAFFINITY) * 8; bit++) {
+				if (mask.Mask & (static_cast<KAFFINITY>(1) << bit)) {
+					nodeOf[std::make_pair((int)mask.Group, bit)] =
+							nodeIndices[number];
+				}
+			}
+		}
+	}
+
+	for (auto& processor : processors) {
+		std::pair<int, int> key(processor.group, processor.id);
+		processor.package = packageOf.count(key) ? packageOf[key] : 0;
+		processor.node = nodeOf.count(key) ? nodeOf[key] : 0;
+		processor.efficient =
+				efficiencyClasses[processor.core] < maxEfficiencyClass;
+	}
+}
+
+#else
+
+static void detectProcessors(std::vector<LogicalProcessor> &processors,
+		size_t &l2CacheBytes) {
+	int n = static_cast<int>(std::thread::hardware_concurrency());
+	for (int i = 0; i < n; i++) {
+		LogicalProcessor processor;
+		processor.id = i;
+		processor.group = 0;
+		processor.package = 0;
+		processor.node = 0;
+		processor.core = i;
+		processor.efficient = false;
+		processors.push_back(processor);
+	}
+#if defined(__APPLE__)
+	uint64_t bytes = 0;
+	size_t length = sizeof(bytes);
+	if (sysctlbyname("hw.l2cachesize", &bytes, &length, nullptr, 0) == 0
+			&& bytes > 0) {
+		l2CacheBytes = static_cast<size_t>(bytes);
+	}
+#endif
+}
+
+#endif
+
+CPUTopology::CPUTopology() : nNodes(1), nPackages(1), hybrid(false),
+		l2CacheBytes(256 * 1024) {
+
+	detectProcessors(processors, l2CacheBytes);
+
+	for (auto& processor : processors) {
+		nNodes = std::max(nNodes, processor.node + 1);
+		nPackages = std::max(nPackages, processor.package + 1);
+		hybrid = hybrid || processor.efficient;
+	}
+}
+
+const CPUTopology& CPUTopology::get() {
+	static CPUTopology topology;
+	return topology;
+}
+
+const std::vector<LogicalProcessor>& CPUTopology::getProcessors() const {
+	return processors;
+}
+
+int CPUTopology::getNumberOfNodes() const {
+	return nNodes;
+}
+
+int CPUTopology::getNumberOfPackages() const {
+	return nPackages;
+}
+
+bool CPUTopology::isHybrid() const {
+	return hybrid;
+}
+
+size_t CPUTopology::getL2CacheBytes() const {
+	return l2CacheBytes;
+}
+
+std::vector<LogicalProcessor> CPUTopology::placement(int nThreads,
+		int maxNodes) const {
+
+	int nUsedNodes = (maxNodes > 0) ? std::min(maxNodes, nNodes) : nNodes;
+
+	// processors of every node in the order of use :
+	// (SMT rank of the core, efficient) keys
+	std::vector<std::vector<std::pair<int, int> > > keys(nUsedNodes);
+	std::map<int, int> nThreadsOfCore;
+	for (int i = 0; i < (int)processors.size(); i++) {
+		const LogicalProcessor &processor = processors[i];
+		int rank = nThreadsOfCore[processor.core]++;
+		if (processor.node < nUsedNodes) {
+			int key = rank * 2 + (processor.efficient ? 1 : 0);
+			keys[processor.node].push_back(std::make_pair(key, i));
+		}
+	}
+
+	int nProcessors = 0;
+	for (auto& node : keys) {
+		std::stable_sort(node.begin(), node.end(),
+				[](const std::pair<int, int> &a, const std::pair<int, int> &b) {
+			return a.first < b.first;
+		});
+		nProcessors += static_cast<int>(node.size());
+	}
+
+	std::vector<LogicalProcessor> result;
+	if (nProcessors == 0) {
+		return result;
+	}
+
+	// contiguous runs of threads, the first thread on the first node
+	int nPrecedingProcessors = 0;
+	for (auto& node : keys) {
+		int begin = static_cast<int>(result.size());
+		nPrecedingProcessors += static_cast<int>(node.size());
+		int end = static_cast<int>((static_cast<long long>(nThreads)
+				* nPrecedingProcessors + nProcessors - 1) / nProcessors);
+		for (int t = begin; t < end; t++) {
+			result.push_back(processors[node[(t - begin) % node.size()].second]);
+		}
+	}
+
+	return result;
+}
+
+bool CPUTopology::pinCurrentThread(const LogicalProcessor &processor,
+		ThreadAffinity *previous) {
+#if defined(__linux__)
+	static_assert(sizeof(cpu_set_t) <= sizeof(ThreadAffinity().data),
+			"ThreadAffinity too small for cpu_set_t");
+	if (previous) {
+		previous->saved = pthread_getaffinity_np(pthread_self(),
+				sizeof(cpu_set_t),
+				reinterpret_cast<cpu_set_t *>(previous->data)) == 0;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(processor.id, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	static_assert(sizeof(GROUP_AFFINITY) <= sizeof(ThreadAffinity().data),
+			"ThreadAffinity too small for GROUP_AFFINITY");
+	GROUP_AFFINITY affinity = GROUP_AFFINITY();
+	affinity.Mask = static_cast<KAFFINITY>(1) << processor.id;
+	affinity.Group = static_cast<WORD>(processor.group);
+	GROUP_AFFINITY *saved = previous ?
+			reinterpret_cast<GROUP_AFFINITY *>(previous->data) : nullptr;
+	bool pinned = SetThreadGroupAffinity(GetCurrentThread(), &affinity,
+			saved) != 0;
+	if (previous) {
+		previous->saved = pinned;
+	}
+	return pinned;
+#else
+	(void)processor;
+	(void)previous;
+	return false;
+#endif
+}
+
+void CPUTopology::restoreCurrentThread(const ThreadAffinity &previous) {
+	if (!previous.saved) {
+		return;
+	}
+#if defined(__linux__)
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+			reinterpret_cast<const cpu_set_t *>(previous.data));
+#elif defined(_WIN32)
+	SetThreadGroupAffinity(GetCurrentThread(),
+			reinterpret_cast<const GROUP_AFFINITY *>(previous.data), nullptr);
+#endif
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+ * cpuTopology.hpp
+ *   logical processors of the machine and thread placement on them
+ *
+ *   The processors the process may run on, with their socket, NUMA node,
+ *   physical core and core type (performance / efficient cores of hybrid
+ *   processors), and the size of the level 2 cache. Read from sysfs on
+ *   Linux and from GetLogicalProcessorInformationEx on Windows. macOS has
+ *   no affinity API : one node, nothing is pinned.
+ */
+
+#ifndef CPU_TOPOLOGY_HPP_
+#define CPU_TOPOLOGY_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace w2xc {
+
+struct LogicalProcessor {
+	int id;			// cpu number (Linux), number in the group (Windows)
+	int group;		// processor group (Windows), 0 otherwise
+	int package;	// socket
+	int node;		// NUMA node, numbered from 0 in order of appearance
+	int core;		// physical core, unique over the machine
+	bool efficient;	// efficient core of a hybrid processor
+};
+
+// affinity of a thread saved by pinCurrentThread, without allocating
+struct ThreadAffinity {
+	unsigned long long data[16];	// cpu_set_t (Linux), GROUP_AFFINITY (Windows)
+	bool saved;
+
+	ThreadAffinity() : saved(false) {}
+};
+
+class CPUTopology {
+
+private:
+	std::vector<LogicalProcessor> processors;
+	int nNodes;
+	int nPackages;
+	bool hybrid;
+	size_t l2CacheBytes;
+
+	CPUTopology();
+
+public:
+	// detected on first use
+	static const CPUTopology& get();
+
+	const std::vector<LogicalProcessor>& getProcessors() const;
+	int getNumberOfNodes() const;
+	int getNumberOfPackages() const;
+	bool isHybrid() const;
+
+	// level 2 cache of a core (data or unified), 256 KiB if unknown
+	size_t getL2CacheBytes() const;
+
+	// processors for nThreads threads on the first maxNodes nodes
+	// (0 : all). the threads are spread over the nodes in contiguous
+	// runs of indices, in proportion to the processors of each node.
+	// on a node, the first hardware threads of the performance cores come
+	// first, then the efficient cores, then the SMT siblings, which share
+	// the vector units of a core.
+	// processors are reused when there are more threads.
+	std::vector<LogicalProcessor> placement(int nThreads,
+			int maxNodes = 0) const;
+
+	// restrict the calling thread to processor, false if not supported.
+	// previous (if given) receives the affinity the thread had before
+	static bool pinCurrentThread(const LogicalProcessor &processor,
+			ThreadAffinity *previous = nullptr);
+	// put back the affinity saved by pinCurrentThread
+	static void restoreCurrentThread(const ThreadAffinity &previous);
+};
+
+}
+
+#endif /* CPU_TOPOLOGY_HPP_ */
@@ -0,0 +1,353 @@
+#include <exception>
+#include <algorithm>
+#include "executionPlan.hpp"
+#include "filterGL.h"
+#include "cpuTopology.hpp"
+
+namespace w2xc {
+
+static void printProgress(int index, int nModel) {
+
+	std::cout << "\r[";
+	int progress = 0;
+	for (; progress < index; progress++)   std::cout << "=";
+	for (; progress < nModel; progress++)  std::cout << " ";
+	std::cout << "]";
+	std::cout.flush();
+
+}
+
+ExecutionPlan::ExecutionPlan(std::vector<std::unique_ptr<Model> > &models,
+		cv::Size tileSize, int batchSize) :
+		models(models), tileSize(tileSize), batchSize(std::max(batchSize, 1)),
+		engine(modelUtility::getInstance().getFilterEngine()),
+		halfActivations(modelUtility::getInstance().getHalfActivationsEnabled()),
+		executor(Executor::Arena), channelBlock(1),
+		precision(ActivationTensor::Float32), glSession(0) {
+
+	for (auto& model : models) {
+		modelSerials.push_back(model->getSerial());
+	}
+
+	if (engine == FilterEngine::GL) {
+		executor = Executor::GL;
+	} else if (usesLineBuffer(models)) {
+		executor = Executor::LineBuffer;
+	}
+	if (executor != Executor::Arena) {
+		this->batchSize = 1;
+	}
+
+	// the kernels of every layer, before the first tile
+	for (auto& model : models) {
+		model->prepareWeights(engine);
+	}
+
+	switch (executor) {
+	case Executor::GL:
+		if (!filterGLInit(tileSize.width, tileSize.height)) {
+			std::exit(-1);
+		}
+		for (auto& model : models) {
+			if (!model->loadGLShader()) {
+				std::exit(-1);
+			}
+		}
+		glPlane.create(tileSize, CV_32FC1);
+		glSession = filterGLSession();
+		break;
+
+	case Executor::LineBuffer:
+		lineBuffer.reset(new LineBufferExecutor(models, tileSize.width));
+		break;
+
+	case Executor::Arena: {
+		// the cpu engine runs on the channel interleaved layout,
+		// the other engines on the planar layout.
+		// with half precision activations the tensors take half the memory.
+		// the int8 engine quantizes the input with the scale of the first
+		// model, every model writes the quantization of the next one and
+		// the last one writes floats.
+		channelBlock = (engine == FilterEngine::CPU
+				|| engine == FilterEngine::INT8) ?
+				ActivationTensor::blockedChannels : 1;
+		precision = halfActivations ?
+				ActivationTensor::Float16 : ActivationTensor::Float32;
+		if (engine == FilterEngine::INT8) {
+			precision = ActivationTensor::Int8;
+		}
+		int maxChannels = 1;
+		for (auto& model : models) {
+			maxChannels = std::max(maxChannels, model->getNOutputPlanes());
+		}
+		arenas.reset(new ActivationArena[this->batchSize]);
+		for (int t = 0; t < this->batchSize; t++) {
+			ActivationArena &arena = arenas[t];
+			arena.reserve(maxChannels, tileSize, channelBlock, precision);
+			if (precision == ActivationTensor::Int8) {
+				// the float output of the last model
+				arena.reserve(ActivationTensor::blockedChannels, tileSize,
+						channelBlock);
+			}
+			// the pages on the nodes of the threads which write them
+			ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+			if (threadPool.isPinned()) {
+				arena.firstTouch(threadPool);
+			}
+		}
+		inputs.reserve(this->batchSize);
+		outputs.reserve(this->batchSize);
+		break;
+	}
+	}
+
+}
+
+ExecutionPlan::~ExecutionPlan() {
+	// the GL session stays for the next plan
+}
+
+bool ExecutionPlan::usesLineBuffer(
+		std::vector<std::unique_ptr<Model> > &models) {
+	// it filters float rows, the int8 engine runs on whole tensors
+	FilterEngine engine = modelUtility::getInstance().getFilterEngine();
+	return modelUtility::getInstance().getLineBufferEnabled()
+			&& engine != FilterEngine::GL && engine != FilterEngine::INT8
+			&& LineBufferExecutor::isApplicable(models);
+}
+
+int ExecutionPlan::chooseBatchSize(
+		std::vector<std::unique_ptr<Model> > &models, cv::Size tileSize,
+		int nTiles) {
+
+	FilterEngine engine = modelUtility::getInstance().getFilterEngine();
+	if (!modelUtility::getInstance().getTileBatchingEnabled() || nTiles < 2
+			|| engine == FilterEngine::GL || usesLineBuffer(models)) {
+		return 1;
+	}
+
+	// a work of the cpu and int8 engines reads the weights of two output
+	// blocks, the planar engines read the weights of the whole layer
+	bool blocked = (engine == FilterEngine::CPU
+			|| engine == FilterEngine::INT8);
+	size_t weightBytes = (engine == FilterEngine::INT8) ? 1 : sizeof(float);
+	size_t elementBytes = sizeof(float);
+	if (engine == FilterEngine::INT8) {
+		elementBytes = 1;
+	} else if (modelUtility::getInstance().getHalfActivationsEnabled()) {
+		elementBytes = 2;
+	}
+	size_t maxWorkWeights = 0;
+	int maxChannels = 1;
+	for (auto& model : models) {
+		int nOutputs = model->getNOutputPlanes();
+		if (blocked) {
+			nOutputs = std::min(nOutputs,
+					2 * ActivationTensor::blockedChannels);
+		}
+		size_t workWeights = static_cast<size_t>(model->getNInputPlanes())
+				* nOutputs * model->getKernelSize() * model->getKernelSize()
+				* weightBytes;
+		maxWorkWeights = std::max(maxWorkWeights, workWeights);
+		maxChannels = std::max(maxChannels, model->getNOutputPlanes());
+	}
+	if (maxWorkWeights > CPUTopology::get().getL2CacheBytes() / 2) {
+		return 1;
+	}
+
+	// the two tensors of the arena of a tile
+	int blockChannels = ActivationTensor::blockedChannels;
+	size_t channels = (maxChannels + blockChannels - 1) / blockChannels
+			* blockChannels;
+	size_t tileBytes = 2 * channels * tileSize.area() * elementBytes;
+	size_t memoryBytes = modelUtility::getInstance().getTileBatchMemory();
+	int batchSize = static_cast<int>(std::min<size_t>(nTiles,
+			memoryBytes / std::max<size_t>(tileBytes, 1)));
+	return std::max(batchSize, 1);
+}
+
+cv::Size ExecutionPlan::getTileSize() {
+	return tileSize;
+}
+
+int ExecutionPlan::getBatchSize() {
+	return batchSize;
+}
+
+bool ExecutionPlan::isFor(std::vector<std::unique_ptr<Model> > &models,
+		cv::Size tileSize, int batchSize) {
+
+	if (&models != &this->models || models.size() != modelSerials.size()
+			|| tileSize != this->tileSize) {
+		return false;
+	}
+	for (size_t i = 0; i < models.size(); i++) {
+		if (models[i]->getSerial() != modelSerials[i]) {
+			return false;
+		}
+	}
+
+	// the settings the constructor has taken
+	modelUtility &utility = modelUtility::getInstance();
+	if (utility.getFilterEngine() != engine
+			|| utility.getHalfActivationsEnabled() != halfActivations
+			|| usesLineBuffer(models) != (executor == Executor::LineBuffer)) {
+		return false;
+	}
+	// filterGLRelease() deletes the textures and programs with the context
+	if (executor == Executor::GL && filterGLSession() != glSession) {
+		return false;
+	}
+	int requestedBatchSize = (executor == Executor::Arena) ?
+			std::max(batchSize, 1) : 1;
+	return requestedBatchSize == this->batchSize;
+}
+
+bool ExecutionPlan::fits(cv::Size size) {
+	if (executor == Executor::LineBuffer) {
+		return size.width == tileSize.width;
+	}
+	return size.width <= tileSize.width && size.height <= tileSize.height;
+}
+
+size_t ExecutionPlan::getLineBufferBytes() {
+	return lineBuffer ? lineBuffer->getBufferBytes() : 0;
+}
+
+bool ExecutionPlan::run(const cv::Mat &inputPlane, cv::Mat &outputPlane,
+		bool showProgress) {
+
+	if (!fits(inputPlane.size())) {
+		std::cerr << "Error : ExecutionPlan-run : \n"
+				"input of " << inputPlane.cols << "x" << inputPlane.rows
+				<< " for a plan of " << tileSize.width << "x"
+				<< tileSize.height << "." << std::endl;
+		return false;
+	}
+
+	switch (executor) {
+	case Executor::GL:
+		return runGL(inputPlane, outputPlane, showProgress);
+	case Executor::LineBuffer:
+		return lineBuffer->run(inputPlane, outputPlane);
+	default:
+		return runOnArena(&inputPlane, &outputPlane, 1, showProgress);
+	}
+
+}
+
+bool ExecutionPlan::run(const std::vector<cv::Mat> &inputPlanes,
+		std::vector<cv::Mat> &outputPlanes, bool showProgress) {
+
+	int nTiles = static_cast<int>(inputPlanes.size());
+	if (nTiles < 1 || nTiles > batchSize) {
+		std::cerr << "Error : ExecutionPlan-run : \n"
+				<< nTiles << " inputs for a plan of batches of "
+				<< batchSize << "." << std::endl;
+		return false;
+	}
+	for (auto& inputPlane : inputPlanes) {
+		if (!fits(inputPlane.size())) {
+			std::cerr << "Error : ExecutionPlan-run : \n"
+					"input of " << inputPlane.cols << "x" << inputPlane.rows
+					<< " for a plan of " << tileSize.width << "x"
+					<< tileSize.height << "." << std::endl;
+			return false;
+		}
+	}
+
+	outputPlanes.resize(nTiles);
+	if (executor == Executor::Arena) {
+		return runOnArena(inputPlanes.data(), outputPlanes.data(), nTiles,
+				showProgress);
+	}
+	return run(inputPlanes[0], outputPlanes[0], showProgress);
+
+}
+
+bool ExecutionPlan::runGL(const cv::Mat &inputPlane, cv::Mat &outputPlane,
+		bool showProgress) {
+
+	try {
+		// the textures are uploaded from continuous memory
+		cv::Mat tempPlane(inputPlane.size(), CV_32FC1, glPlane.data);
+		inputPlane.copyTo(tempPlane);
+		filterGLSetInputData(tempPlane);
+
+		for (int index = 0; index <= (int)models.size(); index++) {
+
+			if (showProgress) {
+				printProgress(index, (int)models.size());
+			}
+
+			if (index >= (int)models.size()) {
+				break;
+			}
+
+			// core processing
+			if (!models[index]->filterGL(index)) {
+				std::exit(-1);
+			}
+		}
+		// get the output image data
+		outputPlane.create(inputPlane.size(), CV_32FC1);
+		filterGLGetOutputData(outputPlane);
+
+		if (showProgress) {
+			std::cout << " ok" << std::endl;
+		}
+	} catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+		return false;
+	}
+
+	return true;
+
+}
+
+bool ExecutionPlan::runOnArena(const cv::Mat *inputPlanes,
+		cv::Mat *outputPlanes, int nTiles, bool showProgress) {
+
+	// the two tensors of the arena of every tile are swapped after
+	// every model
+	inputs.clear();
+	outputs.clear();
+	for (int t = 0; t < nTiles; t++) {
+		inputs.push_back(&arenas[t][0]);
+		outputs.push_back(&arenas[t][1]);
+		if (precision == ActivationTensor::Int8) {
+			inputs[t]->setQuantization(models[0]->getInputQuantization());
+		}
+		inputs[t]->fromPlane(inputPlanes[t], channelBlock, precision);
+	}
+
+	for (int index = 0; index <= (int)models.size(); index++) {
+
+		if (showProgress) {
+			printProgress(index, (int)models.size());
+		}
+
+		if (index >= (int)models.size()) {
+			break;
+		}
+
+		// core processing, the layer on every tile of the batch
+		if (!models[index]->filter(inputs.data(), outputs.data(), nTiles)) {
+			std::exit(-1);
+		}
+		std::swap(inputs, outputs);
+	}
+
+	for (int t = 0; t < nTiles; t++) {
+		inputs[t]->toPlane(0, outputPlanes[t]);
+	}
+
+	if (showProgress) {
+		std::cout << " ok" << std::endl;
+	}
+
+	return true;
+
+}
+
+}
@@ -0,0 +1,117 @@
+/*
+ * executionPlan.hpp
+ *   model chain prepared once for a tile geometry
+ *
+ *   Everything that depends on the models and the tile size only is done
+ *   when the plan is built : the weights are packed for the engine (which
+ *   also selects the kernel of each layer), the GL session gets textures
+ *   of the tile size and the programs of the models, the activation
+ *   tensors or the line buffers are allocated. run() is compute only and
+ *   is reused for every tile and every image that fits in the geometry.
+ *   A plan on the arena can hold a batch of tiles, which run() takes layer
+ *   by layer : every layer filters all the tiles before the next layer
+ *   starts, its weights are read once per batch instead of once per tile.
+ *   The engine and the settings of modelUtility are taken when the plan is
+ *   built. GL plans share the session of filterGL (context, programs,
+ *   textures), which outlives them.
+ */
+
+#ifndef EXECUTION_PLAN_HPP_
+#define EXECUTION_PLAN_HPP_
+
+#include "modelHandler.hpp"
+#include "lineBufferExecutor.hpp"
+#include <memory>
+#include <vector>
+
+namespace w2xc {
+
+class ExecutionPlan {
+
+private:
+	enum class Executor {
+		GL,			// shaders on the textures of filterGL
+		Arena,		// cpu engines, layer after layer on two tensors
+		LineBuffer,	// cpu engines, rows streamed through all layers
+	};
+
+	std::vector<std::unique_ptr<Model> > &models;
+	std::vector<uint64_t> modelSerials;
+	cv::Size tileSize;
+	int batchSize;
+	FilterEngine engine;
+	bool halfActivations;
+	Executor executor;
+
+	// cpu engines on the arena, one arena per tile of a batch
+	std::unique_ptr<ActivationArena[]> arenas;
+	std::vector<ActivationTensor *> inputs;
+	std::vector<ActivationTensor *> outputs;
+	int channelBlock;
+	ActivationTensor::Precision precision;
+
+	std::unique_ptr<LineBufferExecutor> lineBuffer;
+
+	// continuous copy of the input for the texture upload
+	cv::Mat glPlane;
+	unsigned int glSession;	// filterGLSession() of the textures and programs
+
+	ExecutionPlan(const ExecutionPlan &);
+	ExecutionPlan &operator=(const ExecutionPlan &);
+
+	bool runGL(const cv::Mat &inputPlane, cv::Mat &outputPlane,
+			bool showProgress);
+	bool runOnArena(const cv::Mat *inputPlanes, cv::Mat *outputPlanes,
+			int nTiles, bool showProgress);
+
+public:
+	// batchSize tiles per run() on the arena, 1 with the other executors.
+	// exits if there is no GL context or a GL shader can't be loaded
+	ExecutionPlan(std::vector<std::unique_ptr<Model> > &models,
+			cv::Size tileSize, int batchSize = 1);
+	~ExecutionPlan();
+
+	// batch size for nTiles tiles of tileSize under the current settings :
+	// 1 unless tile batching is enabled and the plan runs on the arena.
+	// as many tiles as the activations fit in the memory of the setting,
+	// if the weights a thread reads for a layer fit in half of the level 2
+	// cache. larger weights don't stay in the cache over the tiles.
+	static int chooseBatchSize(std::vector<std::unique_ptr<Model> > &models,
+			cv::Size tileSize, int nTiles);
+
+	// true if the current settings stream the rows of models through the
+	// line buffers, which need no block splitting
+	static bool usesLineBuffer(std::vector<std::unique_ptr<Model> > &models);
+
+	cv::Size getTileSize();
+	int getBatchSize();
+
+	// true if the plan is the one the constructor would build for these
+	// arguments under the current settings : the same Model objects
+	// (models may have been replaced at the same address), tile size,
+	// batch size, engine and activation layout, GL session
+	bool isFor(std::vector<std::unique_ptr<Model> > &models,
+			cv::Size tileSize, int batchSize);
+
+	// inputs run() accepts : at most the tile size,
+	// the exact width with the line buffers
+	bool fits(cv::Size size);
+
+	// bytes of the ring buffers, 0 unless the plan streams rows
+	size_t getLineBufferBytes();
+
+	// inputPlane (CV_32FC1, padded by the caller) of a size that fits,
+	// outputPlane gets its size.
+	// nothing is allocated once outputPlane has the size.
+	bool run(const cv::Mat &inputPlane, cv::Mat &outputPlane,
+			bool showProgress = true);
+
+	// the same on at most getBatchSize() inputs, outputPlanes gets one
+	// plane per input
+	bool run(const std::vector<cv::Mat> &inputPlanes,
+			std::vector<cv::Mat> &outputPlanes, bool showProgress = true);
+};
+
+}
+
+#endif /* EXECUTION_PLAN_HPP_ */
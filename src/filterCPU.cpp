@@ -0,0 +1,45 @@
+#include "filterCPU.h"
+#include "filterKernels.h"
+
+bool filterCPUProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *weights, float bias, cv::Mat &outputPlane,
+	int beginningRow, int nRows)
+{
+	return filterKernels().cpuProcess(inputPlanes, weights, bias, outputPlane,
+		beginningRow, nRows);
+}
+
+void filterCPUProcessRow(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, float bias, float *outputRow)
+{
+	filterKernels().cpuProcessRow(rows, nInputPlanes, width, weights, bias,
+		outputRow);
+}
+
+int filterCPUOutputBlock()
+{
+	return filterKernels().cpuOutputBlock();
+}
+
+void filterCPUPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes, AlignedBuffer &packedWeights)
+{
+	filterKernels().cpuPackWeights(weightMatrices, nInputPlanes,
+		nOutputPlanes, packedWeights);
+}
+
+bool filterCPUProcessBlock(std::vector<cv::Mat> &inputPlanes,
+	const float *weights, const float *biases, cv::Mat *outputPlanes,
+	int beginningRow, int nRows)
+{
+	return filterKernels().cpuProcessBlock(inputPlanes, weights, biases,
+		outputPlanes, beginningRow, nRows);
+}
+
+void filterCPUProcessRowBlock(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, const float *biases,
+	float * const *outputRows)
+{
+	filterKernels().cpuProcessRowBlock(rows, nInputPlanes, width, weights,
+		biases, outputRows);
+}
@@ -0,0 +1,49 @@
+
+#ifndef FILTER_CPU_H_
+#define FILTER_CPU_H_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
+
+// Fused 3x3 convolution + bias + leaky ReLU for one output plane.
+// weights holds the 3x3 kernels of every input plane (nInputPlanes * 9 floats,
+// row major), all input planes are accumulated in registers and each output
+// pixel is written once. Borders are replicated like cv::BORDER_REPLICATE.
+// Only the rows [beginningRow, beginningRow + nRows) of outputPlane are written.
+bool filterCPUProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *weights, float bias, cv::Mat &outputPlane,
+	int beginningRow, int nRows);
+
+// one output row of the same convolution from caller supplied input rows.
+// rows[ip * 3 + ky] points to the row (y - 1 + ky) of input plane ip
+// (already clamped by the caller), every row is width floats.
+void filterCPUProcessRow(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, float bias, float *outputRow);
+
+// Register blocked variant for a block of output planes : the accumulators
+// of filterCPUOutputBlock() output planes x a strip of pixels stay in
+// registers while the input planes are swept once, so each input row is
+// read once per block instead of once per output plane.
+
+// number of output planes of a block
+int filterCPUOutputBlock();
+
+// weights of the whole blocks in (output block, ip, 3x3, output plane) order.
+// the remaining nOutputPlanes % filterCPUOutputBlock() planes are not packed,
+// they are filtered one by one.
+void filterCPUPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes, AlignedBuffer &packedWeights);
+
+// rows [beginningRow, beginningRow + nRows) of the planes outputPlanes[0, block).
+// weights points to the packed data of the block, biases to its biases.
+bool filterCPUProcessBlock(std::vector<cv::Mat> &inputPlanes,
+	const float *weights, const float *biases, cv::Mat *outputPlanes,
+	int beginningRow, int nRows);
+
+// one output row of each plane of the block from caller supplied input rows
+void filterCPUProcessRowBlock(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, const float *biases,
+	float * const *outputRows);
+
+#endif
@@ -0,0 +1,306 @@
+// kernel bodies of filterCPU.h, compiled once per instruction set inside
+// FILTER_KERNELS_NAMESPACE by filterKernels<ISA>.cpp (see filterKernels.h)
+
+#include "filterCPUSIMD.h"
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+namespace {
+
+// output planes of the register block and vector registers per plane.
+// on x86 the broadcast weights are memory operands of the fma, so 16
+// accumulators of one vector each fit AVX2 too and measured fastest
+// (128 -> 128 planes, 64x64 : 4x AVX2, 6x AVX-512 over one plane at a time)
+#if defined(FILTER_CPU_AVX512) || defined(FILTER_CPU_AVX2)
+	enum { OB = 16, OBRegs = 1 };
+#elif defined(FILTER_CPU_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+	enum { OB = 8, OBRegs = 2 };
+#elif defined(FILTER_CPU_SSE)
+	enum { OB = 8, OBRegs = 1 };
+#else
+	enum { OB = 4, OBRegs = 2 };
+#endif
+
+// rows[ip * 3 + ky] points to the row (y - 1 + ky) of input plane ip
+
+// the row pointers of the input planes around a row. they are on the
+// stack up to maxLocalPlanes input planes (every shipped model), so
+// the planar path doesn't allocate once per call
+class InputRows
+{
+public:
+	explicit InputRows(std::vector<cv::Mat> &inputPlanes) :
+		inputPlanes(inputPlanes), rows(local)
+	{
+		if (inputPlanes.size() > maxLocalPlanes) {
+			heap.resize(inputPlanes.size() * 3);
+			rows = &heap[0];
+		}
+	}
+
+	const float * const *around(int y)
+	{
+		int height = inputPlanes[0].rows;
+		int yu = std::max(y - 1, 0);
+		int yd = std::min(y + 1, height - 1);
+		for (size_t ip = 0; ip < inputPlanes.size(); ip++) {
+			rows[ip * 3 + 0] = inputPlanes[ip].ptr<float>(yu);
+			rows[ip * 3 + 1] = inputPlanes[ip].ptr<float>(y);
+			rows[ip * 3 + 2] = inputPlanes[ip].ptr<float>(yd);
+		}
+		return rows;
+	}
+
+private:
+	enum { maxLocalPlanes = 256 };
+
+	std::vector<cv::Mat> &inputPlanes;
+	const float *local[maxLocalPlanes * 3];
+	std::vector<const float *> heap;
+	const float **rows;
+};
+
+// one output pixel with replicated left/right border
+static float convolvePixel(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, float bias, int x)
+{
+	int xl = std::max(x - 1, 0);
+	int xr = std::min(x + 1, width - 1);
+	float s = bias;
+
+	for (int ip = 0; ip < nInputPlanes; ip++) {
+		const float *w = weights + ip * 9;
+		for (int ky = 0; ky < 3; ky++) {
+			const float *src = rows[ip * 3 + ky];
+			s += src[xl] * w[ky * 3 + 0] +
+			     src[x ] * w[ky * 3 + 1] +
+			     src[xr] * w[ky * 3 + 2];
+		}
+	}
+	return VecScalar::leakyReLU(s);
+}
+
+// nRegs * V::width output pixels starting at x (requires 1 <= x, x + strip < width)
+template <class V, int nRegs>
+static void convolveStrip(const float * const *rows, int nInputPlanes,
+	const float *weights, float bias, int x, float *dst)
+{
+	typename V::Reg acc[nRegs];
+	for (int i = 0; i < nRegs; i++) {
+		acc[i] = V::set1(bias);
+	}
+
+	for (int ip = 0; ip < nInputPlanes; ip++) {
+		const float *w = weights + ip * 9;
+		for (int ky = 0; ky < 3; ky++) {
+			const float *src = rows[ip * 3 + ky] + x;
+			typename V::Reg w0 = V::set1(w[ky * 3 + 0]);
+			typename V::Reg w1 = V::set1(w[ky * 3 + 1]);
+			typename V::Reg w2 = V::set1(w[ky * 3 + 2]);
+			for (int i = 0; i < nRegs; i++) {
+				const float *p = src + i * V::width;
+				acc[i] = V::fmadd(V::load(p - 1), w0, acc[i]);
+				acc[i] = V::fmadd(V::load(p    ), w1, acc[i]);
+				acc[i] = V::fmadd(V::load(p + 1), w2, acc[i]);
+			}
+		}
+	}
+
+	for (int i = 0; i < nRegs; i++) {
+		V::store(dst + x + i * V::width, V::leakyReLU(acc[i]));
+	}
+}
+
+template <class V>
+static void convolveRow(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, float bias, float *dst)
+{
+	const int stripRegs = 2;
+
+	dst[0] = convolvePixel(rows, nInputPlanes, width, weights, bias, 0);
+
+	int x = 1;
+	for (; x + V::width * stripRegs < width; x += V::width * stripRegs) {
+		convolveStrip<V, stripRegs>(rows, nInputPlanes, weights, bias, x, dst);
+	}
+	for (; x + V::width < width; x += V::width) {
+		convolveStrip<V, 1>(rows, nInputPlanes, weights, bias, x, dst);
+	}
+	for (; x < width; x++) {
+		dst[x] = convolvePixel(rows, nInputPlanes, width, weights, bias, x);
+	}
+}
+
+// OB output pixels of the register block with replicated left/right border.
+// weights are packed in (ip, 3x3, OB) order.
+static void convolvePixelBlock(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, const float *biases, int x,
+	float * const *dst)
+{
+	int xs[3] = { std::max(x - 1, 0), x, std::min(x + 1, width - 1) };
+	float s[OB];
+	for (int o = 0; o < OB; o++) {
+		s[o] = biases[o];
+	}
+
+	for (int ip = 0; ip < nInputPlanes; ip++) {
+		for (int t = 0; t < 9; t++) {
+			float v = rows[ip * 3 + t / 3][xs[t % 3]];
+			const float *w = weights + (ip * 9 + t) * OB;
+			for (int o = 0; o < OB; o++) {
+				s[o] += v * w[o];
+			}
+		}
+	}
+
+	for (int o = 0; o < OB; o++) {
+		dst[o][x] = VecScalar::leakyReLU(s[o]);
+	}
+}
+
+// nRegs * V::width pixels of the OB output planes starting at x
+// (requires 1 <= x, x + strip < width). every input vector is loaded once
+// and multiplied with the broadcast weights of all OB output planes.
+template <class V, int nRegs>
+static void convolveStripBlock(const float * const *rows, int nInputPlanes,
+	const float *weights, const float *biases, int x, float * const *dst)
+{
+	typename V::Reg acc[OB][nRegs];
+	FILTER_CPU_UNROLL(16)
+	for (int o = 0; o < OB; o++) {
+		FILTER_CPU_UNROLL(4)
+		for (int i = 0; i < nRegs; i++) {
+			acc[o][i] = V::set1(biases[o]);
+		}
+	}
+
+	for (int ip = 0; ip < nInputPlanes; ip++) {
+		FILTER_CPU_UNROLL(3)
+		for (int ky = 0; ky < 3; ky++) {
+			const float *src = rows[ip * 3 + ky] + x - 1;
+			const float *w = weights + (ip * 9 + ky * 3) * OB;
+			FILTER_CPU_UNROLL(3)
+			for (int kx = 0; kx < 3; kx++) {
+				typename V::Reg in[nRegs];
+				FILTER_CPU_UNROLL(4)
+				for (int i = 0; i < nRegs; i++) {
+					in[i] = V::load(src + kx + i * V::width);
+				}
+				FILTER_CPU_UNROLL(16)
+				for (int o = 0; o < OB; o++) {
+					typename V::Reg wv = V::set1(w[kx * OB + o]);
+					FILTER_CPU_UNROLL(4)
+					for (int i = 0; i < nRegs; i++) {
+						acc[o][i] = V::fmadd(in[i], wv, acc[o][i]);
+					}
+				}
+			}
+		}
+	}
+
+	FILTER_CPU_UNROLL(16)
+	for (int o = 0; o < OB; o++) {
+		FILTER_CPU_UNROLL(4)
+		for (int i = 0; i < nRegs; i++) {
+			V::store(dst[o] + x + i * V::width, V::leakyReLU(acc[o][i]));
+		}
+	}
+}
+
+template <class V>
+static void convolveRowBlock(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, const float *biases, float * const *dst)
+{
+	convolvePixelBlock(rows, nInputPlanes, width, weights, biases, 0, dst);
+
+	int x = 1;
+	for (; x + V::width * OBRegs < width; x += V::width * OBRegs) {
+		convolveStripBlock<V, OBRegs>(rows, nInputPlanes, weights, biases,
+			x, dst);
+	}
+	for (; x + V::width < width; x += V::width) {
+		convolveStripBlock<V, 1>(rows, nInputPlanes, weights, biases, x, dst);
+	}
+	for (; x < width; x++) {
+		convolvePixelBlock(rows, nInputPlanes, width, weights, biases, x, dst);
+	}
+}
+
+}
+
+bool filterCPUProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *weights, float bias, cv::Mat &outputPlane,
+	int beginningRow, int nRows)
+{
+	int nInputPlanes = (int)inputPlanes.size();
+	cv::Size size = inputPlanes[0].size();
+
+	InputRows rows(inputPlanes);
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		convolveRow<VecNative>(rows.around(y), nInputPlanes, size.width,
+			weights, bias, outputPlane.ptr<float>(y));
+	}
+
+	return true;
+}
+
+void filterCPUProcessRow(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, float bias, float *outputRow)
+{
+	convolveRow<VecNative>(rows, nInputPlanes, width, weights, bias, outputRow);
+}
+
+int filterCPUOutputBlock()
+{
+	return OB;
+}
+
+void filterCPUPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes, AlignedBuffer &packedWeights)
+{
+	int nBlocks = nOutputPlanes / OB;
+	packedWeights.resize(nBlocks * nInputPlanes * 9 * OB);
+
+	for (int op = 0; op < nBlocks * OB; op++) {
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			for (int t = 0; t < 9; t++) {
+				size_t index = ((op / OB) * nInputPlanes * 9 + ip * 9 + t) * OB
+					+ op % OB;
+				packedWeights[index] = weightMatrix.at<float>(t / 3, t % 3);
+			}
+		}
+	}
+}
+
+bool filterCPUProcessBlock(std::vector<cv::Mat> &inputPlanes,
+	const float *weights, const float *biases, cv::Mat *outputPlanes,
+	int beginningRow, int nRows)
+{
+	int nInputPlanes = (int)inputPlanes.size();
+	cv::Size size = inputPlanes[0].size();
+
+	InputRows rows(inputPlanes);
+	float *dst[OB];
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		for (int o = 0; o < OB; o++) {
+			dst[o] = outputPlanes[o].ptr<float>(y);
+		}
+		convolveRowBlock<VecNative>(rows.around(y), nInputPlanes, size.width,
+			weights, biases, dst);
+	}
+
+	return true;
+}
+
+void filterCPUProcessRowBlock(const float * const *rows, int nInputPlanes,
+	int width, const float *weights, const float *biases,
+	float * const *outputRows)
+{
+	convolveRowBlock<VecNative>(rows, nInputPlanes, width, weights, biases,
+		outputRows);
+}
+
+}
@@ -0,0 +1,67 @@
+#include "filterCPUBlocked.h"
+#include "filterKernels.h"
+
+int filterCPUBlockedChannels()
+{
+	return filterKernels().cpuBlockedChannels();
+}
+
+void filterCPUBlockedPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &packedWeights, AlignedBuffer &packedBiases)
+{
+	filterKernels().cpuBlockedPackWeights(weightMatrices, biases,
+		nInputPlanes, nOutputPlanes, packedWeights, packedBiases);
+}
+
+bool filterCPUBlockedProcess(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputBlocks, int beginningRow, int nRows)
+{
+	return filterKernels().cpuBlockedProcess(input, nInputPlanes, size,
+		weights, bias, output, nOutputBlocks, beginningRow, nRows);
+}
+
+bool filterCPUBlockedProcessNarrow(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputPlanes, int beginningRow, int nRows)
+{
+	return filterKernels().cpuBlockedProcessNarrow(input, nInputPlanes, size,
+		weights, bias, output, nOutputPlanes, beginningRow, nRows);
+}
+
+FilterCPUBlockedKernel filterCPUBlockedSelectKernel(int nInputPlanes,
+	int nOutputPlanes)
+{
+	return filterKernels().cpuBlockedSelectKernel(nInputPlanes, nOutputPlanes);
+}
+
+void filterCPUBlockedHalfToFloat(const unsigned short *src, float *dst,
+	size_t n)
+{
+	filterKernels().cpuBlockedHalfToFloat(src, dst, n);
+}
+
+void filterCPUBlockedFloatToHalf(const float *src, unsigned short *dst,
+	size_t n)
+{
+	filterKernels().cpuBlockedFloatToHalf(src, dst, n);
+}
+
+size_t filterCPUBlockedHalfScratchSize(int nInputPlanes, int nOutputBlocks,
+	int width)
+{
+	return filterKernels().cpuBlockedHalfScratchSize(nInputPlanes,
+		nOutputBlocks, width);
+}
+
+bool filterCPUBlockedProcessHalf(FilterCPUBlockedKernel kernel,
+	const unsigned short *input, int nInputPlanes, cv::Size size,
+	const float *weights, const float *bias, unsigned short *output,
+	int nOutputs, int nOutputBlocks, int beginningRow, int nRows,
+	float *scratch)
+{
+	return filterKernels().cpuBlockedProcessHalf(kernel, input, nInputPlanes,
+		size, weights, bias, output, nOutputs, nOutputBlocks, beginningRow,
+		nRows, scratch);
+}
@@ -0,0 +1,76 @@
+
+#ifndef FILTER_CPU_BLOCKED_H_
+#define FILTER_CPU_BLOCKED_H_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
+
+// Fused 3x3 convolution + bias + leaky ReLU on channel interleaved
+// activations (NCHW8c : blocks of 8 channels stored per pixel).
+// The 8 output channels of a block are one (or two) SIMD vectors, every
+// input value is broadcast once per tap and multiplied with the weight
+// vector of the 8 output channels. Borders are replicated.
+
+// number of interleaved channels of a block
+int filterCPUBlockedChannels();
+
+// weights in (output block, ip, 3x3, 8) order and biases in
+// (output block, 8) order, zero padded up to whole output blocks.
+// layers with less than 8 output planes are packed for the narrow
+// kernel instead : weights in (op, input block, 3x3, 8) order.
+void filterCPUBlockedPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &packedWeights, AlignedBuffer &packedBiases);
+
+// rows [beginningRow, beginningRow + nRows) of nOutputBlocks consecutive
+// output blocks. input points to block 0 of the input (blocks are
+// height * width * 8 floats apart), weights and bias to the packed data
+// of the first output block, output to the first output block.
+bool filterCPUBlockedProcess(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputBlocks, int beginningRow, int nRows);
+
+// same for layers with less than 8 output planes : the 8 input channels
+// of a block are the SIMD lanes and are summed up horizontally.
+// the padding channels of the output block are not written.
+bool filterCPUBlockedProcessNarrow(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputPlanes, int beginningRow, int nRows);
+
+// either of the two kernels above, nOutputs is nOutputBlocks or nOutputPlanes
+typedef bool (*FilterCPUBlockedKernel)(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputs, int beginningRow, int nRows);
+
+// kernel of a nInputPlanes -> nOutputPlanes layer. layers of the shipped
+// models (1-32-32-64-64-128-128-1) get instances compiled for their plane
+// counts where that pays off, other shapes the runtime shaped kernels.
+FilterCPUBlockedKernel filterCPUBlockedSelectKernel(int nInputPlanes,
+	int nOutputPlanes);
+
+// Half precision (IEEE 754 binary16) activations : the tensors are stored
+// as unsigned short in the same NCHW8c layout, the kernels convert them
+// to float on the fly and accumulate in float.
+
+// n values from half to float and from float to half (rounded to nearest even)
+void filterCPUBlockedHalfToFloat(const unsigned short *src, float *dst,
+	size_t n);
+void filterCPUBlockedFloatToHalf(const float *src, unsigned short *dst,
+	size_t n);
+
+// floats of the scratch of filterCPUBlockedProcessHalf
+size_t filterCPUBlockedHalfScratchSize(int nInputPlanes, int nOutputBlocks,
+	int width);
+
+// kernel (of filterCPUBlockedSelectKernel) on half precision tensors.
+// for every output row the three input rows are converted into scratch,
+// the kernel filters them and its output row is converted back.
+// nOutputs is passed to the kernel, nOutputBlocks blocks are written.
+bool filterCPUBlockedProcessHalf(FilterCPUBlockedKernel kernel,
+	const unsigned short *input, int nInputPlanes, cv::Size size,
+	const float *weights, const float *bias, unsigned short *output,
+	int nOutputs, int nOutputBlocks, int beginningRow, int nRows,
+	float *scratch);
+
+#endif
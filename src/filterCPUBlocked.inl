@@ -0,0 +1,407 @@
+// kernel bodies of filterCPUBlocked.h, compiled once per instruction set inside
+// FILTER_KERNELS_NAMESPACE by filterKernels<ISA>.cpp (see filterKernels.h)
+
+#include "filterCPUSIMD.h"
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+namespace {
+
+const int CB = 8;	// interleaved channels of a block
+
+// NIN > 0 : the number of input planes is the compile-time constant NIN
+// (instances of filterCPUBlockedSelectKernel), the loops over the input
+// blocks and channels have constant trip counts.
+// NIN == 0 : the runtime shaped kernel, nInputPlanes is used.
+
+// channels of the input block starting at plane ib
+template <int NIN>
+static int channelsOfBlock(int nInputPlanes, int ib)
+{
+	if (NIN > 0 && NIN < CB) {
+		return NIN;
+	}
+	return std::min(CB, nInputPlanes - ib);
+}
+
+// P pixels x (nBlocks * CB) output channels of a row.
+// xs[0 .. P + 2) are the (clamped) columns x0 - 1 .. x0 + P,
+// rows[ky] points to the input row (y - 1 + ky) of block 0.
+// weights and dst of the output blocks are weightStride and
+// dstStride floats apart.
+template <class V, int P, int nBlocks, int NIN>
+static void convolvePixels(const float * const *rows, size_t blockStride,
+	int nInputPlanes, const int *xs, const float *weights, size_t weightStride,
+	const float *bias, float *dst, size_t dstStride)
+{
+	enum { nVec = CB / V::width * nBlocks };
+	typename V::Reg acc[P][nVec];
+
+	FILTER_CPU_UNROLL(16)
+	for (int v = 0; v < nVec; v++) {
+		typename V::Reg b = V::load(bias + v * V::width);
+		FILTER_CPU_UNROLL(16)
+		for (int p = 0; p < P; p++) {
+			acc[p][v] = b;
+		}
+	}
+
+	int offsets[P + 2];
+	FILTER_CPU_UNROLL(16)
+	for (int j = 0; j < P + 2; j++) {
+		offsets[j] = xs[j] * CB;
+	}
+
+	const int nIn = (NIN > 0) ? NIN : nInputPlanes;
+	for (int ib = 0; ib < nIn; ib += CB) {
+		const int nc = channelsOfBlock<NIN>(nIn, ib);
+		const float *block = weights + ib * 9 * CB;
+		FILTER_CPU_UNROLL(2)
+		for (int c = 0; c < nc; c++) {
+			size_t offset = (ib / CB) * blockStride + c;
+			FILTER_CPU_UNROLL(3)
+			for (int ky = 0; ky < 3; ky++) {
+				const float *src = rows[ky] + offset;
+				FILTER_CPU_UNROLL(3)
+				for (int kx = 0; kx < 3; kx++) {
+					const float *w = block + (c * 9 + ky * 3 + kx) * CB;
+					typename V::Reg wv[nVec];
+					FILTER_CPU_UNROLL(16)
+					for (int v = 0; v < nVec; v++) {
+						wv[v] = V::load(w + (v * V::width / CB) * weightStride
+							+ v * V::width % CB);
+					}
+					FILTER_CPU_UNROLL(16)
+					for (int p = 0; p < P; p++) {
+						typename V::Reg s = V::set1(src[offsets[p + kx]]);
+						FILTER_CPU_UNROLL(16)
+						for (int v = 0; v < nVec; v++) {
+							acc[p][v] = V::fmadd(s, wv[v], acc[p][v]);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	FILTER_CPU_UNROLL(16)
+	for (int p = 0; p < P; p++) {
+		FILTER_CPU_UNROLL(16)
+		for (int v = 0; v < nVec; v++) {
+			V::store(dst + (v * V::width / CB) * dstStride + p * CB
+				+ v * V::width % CB, V::leakyReLU(acc[p][v]));
+		}
+	}
+}
+
+template <class V, int nBlocks, int NIN>
+static void convolveBlockedRow(const float * const *rows, size_t blockStride,
+	int nInputPlanes, int width, const float *weights, size_t weightStride,
+	const float *bias, float *dst, size_t dstStride)
+{
+	// strips of P pixels keep about 12 accumulator registers busy,
+	// each broadcast input value is used for nBlocks * CB output channels
+	enum { P = (V::width * 12) / (CB * nBlocks) > 0 ?
+		(V::width * 12) / (CB * nBlocks) : 1 };
+	int xs[P + 2];
+
+	int x = 0;
+	for (; x < width; ) {
+		int n = (x >= 1 && x + P + 1 <= width) ? P : 1;
+		for (int j = 0; j < n + 2; j++) {
+			xs[j] = std::min(std::max(x - 1 + j, 0), width - 1);
+		}
+		if (n == P) {
+			convolvePixels<V, P, nBlocks, NIN>(rows, blockStride, nInputPlanes,
+				xs, weights, weightStride, bias, dst + x * CB, dstStride);
+		} else {
+			convolvePixels<V, 1, nBlocks, NIN>(rows, blockStride, nInputPlanes,
+				xs, weights, weightStride, bias, dst + x * CB, dstStride);
+		}
+		x += n;
+	}
+}
+
+// P pixels of one output plane, the CB input channels of a block are
+// multiplied in one go and summed horizontally at the end
+template <class V, int P, int NIB>
+static void reducePixels(const float * const *rows, size_t blockStride,
+	int nInputBlocks, const int *xs, const float *weights, float bias,
+	float *dst)
+{
+	enum { nVec = CB / V::width };
+	typename V::Reg acc[P][nVec];
+
+	FILTER_CPU_UNROLL(16)
+	for (int p = 0; p < P; p++) {
+		FILTER_CPU_UNROLL(16)
+		for (int v = 0; v < nVec; v++) {
+			acc[p][v] = V::set1(0.0f);
+		}
+	}
+
+	const int nIB = (NIB > 0) ? NIB : nInputBlocks;
+	for (int ib = 0; ib < nIB; ib++) {
+		for (int ky = 0; ky < 3; ky++) {
+			const float *src = rows[ky] + ib * blockStride;
+			for (int kx = 0; kx < 3; kx++) {
+				const float *w = weights + ((ib * 9) + ky * 3 + kx) * CB;
+				FILTER_CPU_UNROLL(16)
+				for (int v = 0; v < nVec; v++) {
+					typename V::Reg wv = V::load(w + v * V::width);
+					FILTER_CPU_UNROLL(16)
+					for (int p = 0; p < P; p++) {
+						acc[p][v] = V::fmadd(
+							V::load(src + xs[p + kx] * CB + v * V::width),
+							wv, acc[p][v]);
+					}
+				}
+			}
+		}
+	}
+
+	FILTER_CPU_UNROLL(16)
+	for (int p = 0; p < P; p++) {
+		float lanes[CB];
+		FILTER_CPU_UNROLL(16)
+		for (int v = 0; v < nVec; v++) {
+			V::store(lanes + v * V::width, acc[p][v]);
+		}
+		float sum = bias;
+		for (int c = 0; c < CB; c++) {
+			sum += lanes[c];
+		}
+		dst[p * CB] = VecScalar::leakyReLU(sum);
+	}
+}
+
+template <class V, int NIB>
+static void reduceRow(const float * const *rows, size_t blockStride,
+	int nInputBlocks, int width, const float *weights, float bias, float *dst)
+{
+	enum { P = 4 };
+	int xs[P + 2];
+
+	int x = 0;
+	for (; x < width; ) {
+		int n = (x >= 1 && x + P + 1 <= width) ? P : 1;
+		for (int j = 0; j < n + 2; j++) {
+			xs[j] = std::min(std::max(x - 1 + j, 0), width - 1);
+		}
+		if (n == P) {
+			reducePixels<V, P, NIB>(rows, blockStride, nInputBlocks, xs,
+				weights, bias, dst + x * CB);
+		} else {
+			reducePixels<V, 1, NIB>(rows, blockStride, nInputBlocks, xs,
+				weights, bias, dst + x * CB);
+		}
+		x += n;
+	}
+}
+
+
+template <int NIN>
+static bool processBlocks(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputBlocks, int beginningRow, int nRows)
+{
+	size_t rowStride = static_cast<size_t>(size.width) * CB;
+	size_t blockStride = rowStride * size.height;
+	const int nIn = (NIN > 0) ? NIN : nInputPlanes;
+	size_t weightStride = static_cast<size_t>(nIn) * 9 * CB;
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		const float *rows[3];
+		for (int ky = 0; ky < 3; ky++) {
+			int yy = std::min(std::max(y - 1 + ky, 0), size.height - 1);
+			rows[ky] = input + yy * rowStride;
+		}
+
+		// output blocks in pairs, the odd one alone
+		int block = 0;
+		for (; block + 2 <= nOutputBlocks; block += 2) {
+			convolveBlockedRow<VecBlocked, 2, NIN>(rows, blockStride, nIn,
+				size.width, weights + block * weightStride, weightStride,
+				bias + block * CB, output + block * blockStride + y * rowStride,
+				blockStride);
+		}
+		if (block < nOutputBlocks) {
+			convolveBlockedRow<VecBlocked, 1, NIN>(rows, blockStride, nIn,
+				size.width, weights + block * weightStride, weightStride,
+				bias + block * CB, output + block * blockStride + y * rowStride,
+				blockStride);
+		}
+	}
+
+	return true;
+}
+
+template <int NIN, int NOUT>
+static bool processNarrow(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputPlanes, int beginningRow, int nRows)
+{
+	size_t rowStride = static_cast<size_t>(size.width) * CB;
+	size_t blockStride = rowStride * size.height;
+	const int nInputBlocks = ((NIN > 0 ? NIN : nInputPlanes) + CB - 1) / CB;
+	const int nOut = (NOUT > 0) ? NOUT : nOutputPlanes;
+	size_t weightStride = static_cast<size_t>(nInputBlocks) * 9 * CB;
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		const float *rows[3];
+		for (int ky = 0; ky < 3; ky++) {
+			int yy = std::min(std::max(y - 1 + ky, 0), size.height - 1);
+			rows[ky] = input + yy * rowStride;
+		}
+		for (int op = 0; op < nOut; op++) {
+			reduceRow<VecBlocked, (NIN + CB - 1) / CB>(rows, blockStride,
+				nInputBlocks, size.width, weights + op * weightStride, bias[op],
+				output + y * rowStride + op);
+		}
+	}
+
+	return true;
+}
+
+}
+
+int filterCPUBlockedChannels()
+{
+	return CB;
+}
+
+void filterCPUBlockedPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &packedWeights, AlignedBuffer &packedBiases)
+{
+	int nBlocks = (nOutputPlanes + CB - 1) / CB;
+	int nInputBlocks = (nInputPlanes + CB - 1) / CB;
+	bool narrow = (nOutputPlanes < CB);
+
+	if (narrow) {
+		packedWeights.assign(nOutputPlanes * nInputBlocks * 9 * CB, 0.0f);
+	} else {
+		packedWeights.assign(nBlocks * nInputPlanes * 9 * CB, 0.0f);
+	}
+	packedBiases.assign(nBlocks * CB, 0.0f);
+
+	for (int op = 0; op < nOutputPlanes; op++) {
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			for (int t = 0; t < 9; t++) {
+				size_t index = narrow ?
+					((op * nInputBlocks + ip / CB) * 9 + t) * CB + ip % CB :
+					((op / CB) * nInputPlanes * 9 + ip * 9 + t) * CB + op % CB;
+				packedWeights[index] = weightMatrix.at<float>(t / 3, t % 3);
+			}
+		}
+		packedBiases[op] = static_cast<float>(biases[op]);
+	}
+}
+
+bool filterCPUBlockedProcess(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputBlocks, int beginningRow, int nRows)
+{
+	return processBlocks<0>(input, nInputPlanes, size, weights, bias, output,
+		nOutputBlocks, beginningRow, nRows);
+}
+
+bool filterCPUBlockedProcessNarrow(const float *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *bias, float *output,
+	int nOutputPlanes, int beginningRow, int nRows)
+{
+	return processNarrow<0, 0>(input, nInputPlanes, size, weights, bias,
+		output, nOutputPlanes, beginningRow, nRows);
+}
+
+FilterCPUBlockedKernel filterCPUBlockedSelectKernel(int nInputPlanes,
+	int nOutputPlanes)
+{
+	// layers of the shipped models (1-32-32-64-64-128-128-1).
+	// the first layer loses the loops over 7 padding channels and the last
+	// one the loop over the output planes. the layers in between run as fast
+	// with the runtime shaped kernel (whole blocks, same unrolling) and
+	// their fixed-count instances spill on the 16 registers of AVX2.
+	struct ShapeKernel
+	{
+		int nInputPlanes;
+		int nOutputPlanes;
+		FilterCPUBlockedKernel kernel;
+	};
+	static const ShapeKernel shapeKernels[] = {
+		{ 1, 32, &processBlocks<1> },
+		{ 128, 1, &processNarrow<128, 1> },
+	};
+
+	for (size_t i = 0; i < sizeof(shapeKernels) / sizeof(shapeKernels[0]); i++) {
+		if (shapeKernels[i].nInputPlanes == nInputPlanes
+				&& shapeKernels[i].nOutputPlanes == nOutputPlanes) {
+			return shapeKernels[i].kernel;
+		}
+	}
+
+	return (nOutputPlanes < CB) ? &filterCPUBlockedProcessNarrow
+		: &filterCPUBlockedProcess;
+}
+
+void filterCPUBlockedHalfToFloat(const unsigned short *src, float *dst,
+	size_t n)
+{
+	convertHalfToFloat(src, dst, n);
+}
+
+void filterCPUBlockedFloatToHalf(const float *src, unsigned short *dst,
+	size_t n)
+{
+	convertFloatToHalf(src, dst, n);
+}
+
+size_t filterCPUBlockedHalfScratchSize(int nInputPlanes, int nOutputBlocks,
+	int width)
+{
+	int nInputBlocks = (nInputPlanes + CB - 1) / CB;
+	return static_cast<size_t>(nInputBlocks + nOutputBlocks) * 3 * width * CB;
+}
+
+bool filterCPUBlockedProcessHalf(FilterCPUBlockedKernel kernel,
+	const unsigned short *input, int nInputPlanes, cv::Size size,
+	const float *weights, const float *bias, unsigned short *output,
+	int nOutputs, int nOutputBlocks, int beginningRow, int nRows,
+	float *scratch)
+{
+	size_t rowStride = static_cast<size_t>(size.width) * CB;
+	size_t blockStride = rowStride * size.height;
+	int nInputBlocks = (nInputPlanes + CB - 1) / CB;
+
+	// the rows y - 1, y, y + 1 are a tensor of height 3 for the kernel,
+	// which writes row 1 of an output tensor of height 3
+	cv::Size rowsSize(size.width, 3);
+	float *inputRows = scratch;
+	float *outputRows = scratch + nInputBlocks * 3 * rowStride;
+
+	// the narrow kernel does not write the padding channels
+	std::fill(outputRows, outputRows + nOutputBlocks * 3 * rowStride, 0.0f);
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		for (int ib = 0; ib < nInputBlocks; ib++) {
+			for (int ky = 0; ky < 3; ky++) {
+				int yy = std::min(std::max(y - 1 + ky, 0), size.height - 1);
+				convertHalfToFloat(input + ib * blockStride + yy * rowStride,
+					inputRows + (ib * 3 + ky) * rowStride, rowStride);
+			}
+		}
+
+		kernel(inputRows, nInputPlanes, rowsSize, weights, bias, outputRows,
+			nOutputs, 1, 1);
+
+		for (int ob = 0; ob < nOutputBlocks; ob++) {
+			convertFloatToHalf(outputRows + (ob * 3 + 1) * rowStride,
+				output + ob * blockStride + y * rowStride, rowStride);
+		}
+	}
+
+	return true;
+}
+
+}
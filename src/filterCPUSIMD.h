@@ -0,0 +1,299 @@
+
+
+#ifndef FILTER_CPU_SIMD_H_
+#define FILTER_CPU_SIMD_H_
+
+// Vector operation sets shared by the CPU convolution kernels.
+// filterKernels<ISA>.cpp defines FILTER_CPU_<ISA> before the kernel bodies,
+// VecNative is the widest set of that variant and VecBlocked the widest
+// one not wider than the 8 interleaved channels of a block.
+// Everything lives in FILTER_KERNELS_NAMESPACE : every variant has its own
+// copy of the inline functions, compiled for its instruction set.
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(FILTER_CPU_AVX512) || defined(FILTER_CPU_AVX2)
+	#include <immintrin.h>
+#elif defined(FILTER_CPU_SSE)
+	#include <emmintrin.h>
+#elif defined(FILTER_CPU_NEON)
+	#if defined(_M_ARM64)
+		#include <arm64_neon.h>
+	#else
+		#include <arm_neon.h>
+	#endif
+#endif
+
+// unrolling of the small constant loops of the kernels. the register
+// blocks (arrays of accumulators) only stay in registers when the loops
+// over them are unrolled completely, which -O2 does not always do.
+#if defined(__clang__)
+	#define FILTER_CPU_UNROLL(n) _Pragma(FILTER_CPU_STRINGIFY(clang loop unroll_count(n)))
+#elif defined(__GNUC__) && __GNUC__ >= 8
+	#define FILTER_CPU_UNROLL(n) _Pragma(FILTER_CPU_STRINGIFY(GCC unroll n))
+#else
+	#define FILTER_CPU_UNROLL(n)
+#endif
+#define FILTER_CPU_STRINGIFY(x) #x
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+struct VecScalar
+{
+	typedef float Reg;
+	enum { width = 1 };
+
+	static Reg load(const float *p) { return *p; }
+	static void store(float *p, Reg v) { *p = v; }
+	static Reg set1(float v) { return v; }
+	static Reg add(Reg a, Reg b) { return a + b; }
+	static Reg fmadd(Reg a, Reg b, Reg c) { return a * b + c; }
+	static Reg leakyReLU(Reg v) {
+		return std::max(v, 0.0f) + std::min(v, 0.0f) * 0.1f;
+	}
+};
+
+#if defined(FILTER_CPU_AVX512)
+struct VecAVX512
+{
+	typedef __m512 Reg;
+	enum { width = 16 };
+
+	static Reg load(const float *p) { return _mm512_loadu_ps(p); }
+	static void store(float *p, Reg v) { _mm512_storeu_ps(p, v); }
+	static Reg set1(float v) { return _mm512_set1_ps(v); }
+	static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+	static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+	static Reg leakyReLU(Reg v) {
+		Reg zero = _mm512_setzero_ps();
+		return _mm512_fmadd_ps(_mm512_min_ps(v, zero), _mm512_set1_ps(0.1f),
+			_mm512_max_ps(v, zero));
+	}
+};
+#endif
+
+#if defined(FILTER_CPU_AVX2)
+struct VecAVX2
+{
+	typedef __m256 Reg;
+	enum { width = 8 };
+
+	static Reg load(const float *p) { return _mm256_loadu_ps(p); }
+	static void store(float *p, Reg v) { _mm256_storeu_ps(p, v); }
+	static Reg set1(float v) { return _mm256_set1_ps(v); }
+	static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+	static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+	static Reg leakyReLU(Reg v) {
+		Reg zero = _mm256_setzero_ps();
+		return _mm256_fmadd_ps(_mm256_min_ps(v, zero), _mm256_set1_ps(0.1f),
+			_mm256_max_ps(v, zero));
+	}
+};
+#endif
+
+#if defined(FILTER_CPU_SSE)
+struct VecSSE
+{
+	typedef __m128 Reg;
+	enum { width = 4 };
+
+	static Reg load(const float *p) { return _mm_loadu_ps(p); }
+	static void store(float *p, Reg v) { _mm_storeu_ps(p, v); }
+	static Reg set1(float v) { return _mm_set1_ps(v); }
+	static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+	static Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+	static Reg leakyReLU(Reg v) {
+		Reg zero = _mm_setzero_ps();
+		return _mm_add_ps(_mm_mul_ps(_mm_min_ps(v, zero), _mm_set1_ps(0.1f)),
+			_mm_max_ps(v, zero));
+	}
+};
+#endif
+
+#if defined(FILTER_CPU_NEON)
+struct VecNEON
+{
+	typedef float32x4_t Reg;
+	enum { width = 4 };
+
+	static Reg load(const float *p) { return vld1q_f32(p); }
+	static void store(float *p, Reg v) { vst1q_f32(p, v); }
+	static Reg set1(float v) { return vdupq_n_f32(v); }
+	static Reg add(Reg a, Reg b) { return vaddq_f32(a, b); }
+#if defined(__aarch64__) || defined(_M_ARM64)
+	static Reg fmadd(Reg a, Reg b, Reg c) { return vfmaq_f32(c, a, b); }
+#else
+	static Reg fmadd(Reg a, Reg b, Reg c) { return vmlaq_f32(c, a, b); }
+#endif
+	static Reg leakyReLU(Reg v) {
+		Reg zero = vdupq_n_f32(0.0f);
+		return vmlaq_n_f32(vmaxq_f32(v, zero), vminq_f32(v, zero), 0.1f);
+	}
+};
+#endif
+
+#if defined(FILTER_CPU_AVX512)
+typedef VecAVX512 VecNative;
+typedef VecAVX2 VecBlocked;
+#elif defined(FILTER_CPU_AVX2)
+typedef VecAVX2 VecNative;
+typedef VecAVX2 VecBlocked;
+#elif defined(FILTER_CPU_SSE)
+typedef VecSSE VecNative;
+typedef VecSSE VecBlocked;
+#elif defined(FILTER_CPU_NEON)
+typedef VecNEON VecNative;
+typedef VecNEON VecBlocked;
+#else
+typedef VecScalar VecNative;
+typedef VecScalar VecBlocked;
+#endif
+
+// IEEE 754 half precision (binary16) <-> float, rounded to nearest even.
+// F16C instructions come with the AVX2 variants (the processor check of
+// filterKernels.cpp requires them), SSE2 and the scalar code convert the
+// bits with integer operations.
+static inline float halfToFloat(unsigned short h)
+{
+	unsigned int u = (h & 0x7fffu) << 13;
+	unsigned int exponent = u & (0x7c00u << 13);
+	float f;
+	u += (127 - 15) << 23;
+	if (exponent == (0x7c00u << 13)) {
+		u += (128 - 16) << 23;			// inf, nan
+		std::memcpy(&f, &u, sizeof(f));
+	} else if (exponent == 0) {
+		u += 1 << 23;					// zero, subnormal
+		std::memcpy(&f, &u, sizeof(f));
+		f -= 6.103515625e-05f;			// 2^-14
+	} else {
+		std::memcpy(&f, &u, sizeof(f));
+	}
+	if (h & 0x8000u) {
+		f = -f;
+	}
+	return f;
+}
+
+static inline unsigned short floatToHalf(float f)
+{
+	unsigned int u;
+	std::memcpy(&u, &f, sizeof(u));
+	unsigned int sign = (u >> 16) & 0x8000u;
+	u &= 0x7fffffffu;
+
+	if (u >= (127u + 16) << 23) {
+		// overflow to inf, nan stays nan
+		return static_cast<unsigned short>(sign
+			| (u > (255u << 23) ? 0x7e00u : 0x7c00u));
+	}
+	if (u < (127u - 14) << 23) {
+		// subnormal or zero : the addition of 0.5 rounds at bit 2^-24
+		float a;
+		std::memcpy(&a, &u, sizeof(a));
+		a += 0.5f;
+		std::memcpy(&u, &a, sizeof(u));
+		return static_cast<unsigned short>(sign | (u - 0x3f000000u));
+	}
+	u += ((15u - 127) << 23) + 0xfffu + ((u >> 13) & 1);
+	return static_cast<unsigned short>(sign | (u >> 13));
+}
+
+#if defined(FILTER_CPU_SSE)
+// the same conversions on 4 values, the halves in the low 16 bits of the lanes
+static inline __m128 halfToFloatSSE(__m128i h)
+{
+	// the exponent is rebiased by a multiplication with 2^112, which also
+	// normalizes the subnormals
+	__m128i expMantissa = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+	__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expMantissa), 16);
+	__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMantissa, 13)),
+		_mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	__m128i infNaN = _mm_and_si128(_mm_cmpgt_epi32(expMantissa,
+		_mm_set1_epi32(0x7bff)), _mm_set1_epi32(255 << 23));
+	return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNaN)));
+}
+
+static inline __m128i floatToHalfSSE(__m128 f)
+{
+	__m128i u = _mm_castps_si128(f);
+	__m128i sign = _mm_and_si128(u, _mm_set1_epi32(0x80000000));
+	u = _mm_xor_si128(u, sign);
+
+	__m128i odd = _mm_and_si128(_mm_srli_epi32(u, 13), _mm_set1_epi32(1));
+	__m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(u,
+		_mm_set1_epi32(-(112 << 23) + 0xfff)), odd), 13);
+	__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(
+		_mm_castsi128_ps(u), _mm_set1_ps(0.5f))), _mm_set1_epi32(0x3f000000));
+	__m128i infNaN = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(
+		_mm_cmpgt_epi32(u, _mm_set1_epi32(255 << 23)), _mm_set1_epi32(0x200)));
+
+	__m128i isSubnormal = _mm_cmplt_epi32(u, _mm_set1_epi32(113 << 23));
+	__m128i isInfNaN = _mm_cmpgt_epi32(u, _mm_set1_epi32((143 << 23) - 1));
+	__m128i h = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal),
+		_mm_andnot_si128(isSubnormal, normal));
+	h = _mm_or_si128(_mm_and_si128(isInfNaN, infNaN),
+		_mm_andnot_si128(isInfNaN, h));
+	return _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+}
+#endif
+
+static inline void convertHalfToFloat(const unsigned short *src, float *dst,
+	size_t n)
+{
+	size_t i = 0;
+#if defined(FILTER_CPU_AVX2)
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))));
+	}
+#elif defined(FILTER_CPU_SSE)
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		_mm_storeu_ps(dst + i, halfToFloatSSE(_mm_unpacklo_epi16(h, zero)));
+		_mm_storeu_ps(dst + i + 4, halfToFloatSSE(_mm_unpackhi_epi16(h, zero)));
+	}
+#elif defined(FILTER_CPU_NEON) && defined(__aarch64__)
+	for (; i + 4 <= n; i += 4) {
+		vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = halfToFloat(src[i]);
+	}
+}
+
+static inline void convertFloatToHalf(const float *src, unsigned short *dst,
+	size_t n)
+{
+	size_t i = 0;
+#if defined(FILTER_CPU_AVX2)
+	for (; i + 8 <= n; i += 8) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm256_cvtps_ph(
+			_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+	}
+#elif defined(FILTER_CPU_SSE)
+	for (; i + 8 <= n; i += 8) {
+		// sign extended 16 bit values are packed without saturation
+		__m128i lo = floatToHalfSSE(_mm_loadu_ps(src + i));
+		__m128i hi = floatToHalfSSE(_mm_loadu_ps(src + i + 4));
+		lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+		hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+			_mm_packs_epi32(lo, hi));
+	}
+#elif defined(FILTER_CPU_NEON) && defined(__aarch64__)
+	for (; i + 4 <= n; i += 4) {
+		vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = floatToHalf(src[i]);
+	}
+}
+
+}
+
+#endif
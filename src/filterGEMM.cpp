@@ -0,0 +1,29 @@
+#include "filterGEMM.h"
+#include "filterKernels.h"
+
+int filterGEMMBlockPixels()
+{
+	return filterKernels().gemmBlockPixels();
+}
+
+size_t filterGEMMScratchSize(int nInputPlanes, int kernelSize)
+{
+	return filterKernels().gemmScratchSize(nInputPlanes, kernelSize);
+}
+
+void filterGEMMPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes, int kernelSize,
+	AlignedBuffer &packedWeights)
+{
+	filterKernels().gemmPackWeights(weightMatrices, nInputPlanes,
+		nOutputPlanes, kernelSize, packedWeights);
+}
+
+bool filterGEMMProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *packedWeights, const float *biases, int kernelSize,
+	std::vector<cv::Mat> &outputPlanes,
+	int beginningPixel, int nPixels, float *scratch)
+{
+	return filterKernels().gemmProcess(inputPlanes, packedWeights, biases,
+		kernelSize, outputPlanes, beginningPixel, nPixels, scratch);
+}
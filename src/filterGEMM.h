@@ -0,0 +1,37 @@
+
+#ifndef FILTER_GEMM_H_
+#define FILTER_GEMM_H_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
+
+// GEMM formulation of a convolution layer
+//   C (nOutputPlanes x pixels) = A (nOutputPlanes x K) * B (K x pixels)
+//   K = nInputPlanes * kernelSize * kernelSize
+// A is the weight matrices, B is the im2col expansion of the input planes.
+// B is packed panel by panel straight from the input planes, the full
+// im2col matrix is never materialized.
+
+// number of pixels handled by one filterGEMMProcess call at most
+int filterGEMMBlockPixels();
+
+// floats of scratch memory filterGEMMProcess needs
+size_t filterGEMMScratchSize(int nInputPlanes, int kernelSize);
+
+// pack weightMatrices (nOutputPlanes * nInputPlanes matrices of
+// kernelSize x kernelSize) into the row panels of A used by the micro-kernel
+void filterGEMMPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes, int kernelSize,
+	AlignedBuffer &packedWeights);
+
+// convolution + bias + leaky ReLU of the pixels
+// [beginningPixel, beginningPixel + nPixels) (row major over the plane).
+// nPixels must not exceed filterGEMMBlockPixels(), outputPlanes must be
+// continuous. scratch holds filterGEMMScratchSize() floats.
+bool filterGEMMProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *packedWeights, const float *biases, int kernelSize,
+	std::vector<cv::Mat> &outputPlanes,
+	int beginningPixel, int nPixels, float *scratch);
+
+#endif
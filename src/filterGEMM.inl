@@ -0,0 +1,218 @@
+// kernel bodies of filterGEMM.h, compiled once per instruction set inside
+// FILTER_KERNELS_NAMESPACE by filterKernels<ISA>.cpp (see filterKernels.h)
+
+#include "filterCPUSIMD.h"
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+namespace {
+
+// register block of the micro-kernel : MR output planes x NR pixels
+#if defined(FILTER_CPU_AVX512)
+const int MR = 8;
+#elif defined(FILTER_CPU_AVX2)
+const int MR = 6;
+#elif defined(FILTER_CPU_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+const int MR = 8;
+#else
+const int MR = 4;
+#endif
+const int NR = VecNative::width * 2;
+
+// cache blocking : a KC x NC panel of B stays in L2 while
+// every MR x KC panel of A is swept over it from L1
+const int KC = 256;
+const int NC = 256;
+
+// pack rows [k0, k0 + kc) of the im2col matrix B for the given pixels
+// into NR wide column panels (panel, k, NR), zero padded at the tail
+static void packInput(std::vector<cv::Mat> &inputPlanes, int kernelSize,
+	int k0, int kc, int beginningPixel, int nPixels, float *packed)
+{
+	cv::Size size = inputPlanes[0].size();
+	int radius = kernelSize / 2;
+	int kernelArea = kernelSize * kernelSize;
+
+	for (int j0 = 0; j0 < nPixels; j0 += NR) {
+		float *dst = packed + (j0 / NR) * kc * NR;
+		int n = std::min(NR, nPixels - j0);
+
+		int px[NR], py[NR];
+		for (int j = 0; j < n; j++) {
+			int p = beginningPixel + j0 + j;
+			py[j] = p / size.width;
+			px[j] = p % size.width;
+		}
+		bool sameRow = (py[0] == py[n - 1]);
+
+		for (int k = k0; k < k0 + kc; k++, dst += NR) {
+			const cv::Mat &plane = inputPlanes[k / kernelArea];
+			int dy = (k % kernelArea) / kernelSize - radius;
+			int dx = (k % kernelArea) % kernelSize - radius;
+
+			if (sameRow && px[0] + dx >= 0 && px[n - 1] + dx < size.width) {
+				int y = std::min(std::max(py[0] + dy, 0), size.height - 1);
+				const float *src = plane.ptr<float>(y) + px[0] + dx;
+				for (int j = 0; j < n; j++) {
+					dst[j] = src[j];
+				}
+			} else {
+				for (int j = 0; j < n; j++) {
+					int y = std::min(std::max(py[j] + dy, 0), size.height - 1);
+					int x = std::min(std::max(px[j] + dx, 0), size.width - 1);
+					dst[j] = plane.ptr<float>(y)[x];
+				}
+			}
+			for (int j = n; j < NR; j++) {
+				dst[j] = 0.0f;
+			}
+		}
+	}
+}
+
+// c[0..MR)[0..NR) (+)= a (kc x MR) * b (kc x NR)
+// bias != nullptr : last K block, add bias and apply leaky ReLU
+template <class V>
+static void microKernel(int kc, const float *a, const float *b,
+	float * const *c, bool accumulate, const float *bias)
+{
+	typename V::Reg acc[MR][2];
+
+	for (int i = 0; i < MR; i++) {
+		if (accumulate) {
+			acc[i][0] = V::load(c[i]);
+			acc[i][1] = V::load(c[i] + V::width);
+		} else {
+			acc[i][0] = V::set1(0.0f);
+			acc[i][1] = V::set1(0.0f);
+		}
+	}
+
+	for (int k = 0; k < kc; k++) {
+		typename V::Reg b0 = V::load(b);
+		typename V::Reg b1 = V::load(b + V::width);
+		for (int i = 0; i < MR; i++) {
+			typename V::Reg ai = V::set1(a[i]);
+			acc[i][0] = V::fmadd(ai, b0, acc[i][0]);
+			acc[i][1] = V::fmadd(ai, b1, acc[i][1]);
+		}
+		a += MR;
+		b += NR;
+	}
+
+	for (int i = 0; i < MR; i++) {
+		if (bias) {
+			typename V::Reg bi = V::set1(bias[i]);
+			acc[i][0] = V::leakyReLU(V::add(acc[i][0], bi));
+			acc[i][1] = V::leakyReLU(V::add(acc[i][1], bi));
+		}
+		V::store(c[i], acc[i][0]);
+		V::store(c[i] + V::width, acc[i][1]);
+	}
+}
+
+}
+
+int filterGEMMBlockPixels()
+{
+	return NC;
+}
+
+size_t filterGEMMScratchSize(int nInputPlanes, int kernelSize)
+{
+	return NC * std::min(nInputPlanes * kernelSize * kernelSize, KC);
+}
+
+void filterGEMMPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes, int kernelSize,
+	AlignedBuffer &packedWeights)
+{
+	int kernelArea = kernelSize * kernelSize;
+	int K = nInputPlanes * kernelArea;
+	int nPanels = (nOutputPlanes + MR - 1) / MR;
+
+	// layout : (panel, k, MR)
+	packedWeights.assign(nPanels * K * MR, 0.0f);
+	for (int op = 0; op < nOutputPlanes; op++) {
+		float *dst = packedWeights.data() + (op / MR) * K * MR + op % MR;
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			for (int t = 0; t < kernelArea; t++) {
+				dst[(ip * kernelArea + t) * MR] =
+					weightMatrix.at<float>(t / kernelSize, t % kernelSize);
+			}
+		}
+	}
+}
+
+bool filterGEMMProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *packedWeights, const float *biases, int kernelSize,
+	std::vector<cv::Mat> &outputPlanes,
+	int beginningPixel, int nPixels, float *scratch)
+{
+	int nInputPlanes = (int)inputPlanes.size();
+	int nOutputPlanes = (int)outputPlanes.size();
+	int K = nInputPlanes * kernelSize * kernelSize;
+	int nPanels = (nOutputPlanes + MR - 1) / MR;
+
+	if (nPixels > NC) {
+		return false;
+	}
+
+	for (int k0 = 0; k0 < K; k0 += KC) {
+		int kc = std::min(KC, K - k0);
+		bool accumulate = (k0 > 0);
+		bool lastBlock = (k0 + kc >= K);
+
+		packInput(inputPlanes, kernelSize, k0, kc, beginningPixel, nPixels,
+			scratch);
+
+		for (int panel = 0; panel < nPanels; panel++) {
+			const float *a = packedWeights + (panel * K + k0) * MR;
+			int m0 = panel * MR;
+			int mr = std::min(MR, nOutputPlanes - m0);
+
+			float bias[MR];
+			for (int i = 0; i < MR; i++) {
+				bias[i] = (i < mr) ? biases[m0 + i] : 0.0f;
+			}
+
+			for (int j0 = 0; j0 < nPixels; j0 += NR) {
+				const float *b = scratch + (j0 / NR) * kc * NR;
+				int nr = std::min(NR, nPixels - j0);
+				float *c[MR];
+
+				if (mr == MR && nr == NR) {
+					for (int i = 0; i < MR; i++) {
+						c[i] = outputPlanes[m0 + i].ptr<float>() + beginningPixel + j0;
+					}
+					microKernel<VecNative>(kc, a, b, c, accumulate,
+						lastBlock ? bias : nullptr);
+					continue;
+				}
+
+				// partial tile goes through a local buffer
+				float tile[MR][NR];
+				for (int i = 0; i < MR; i++) {
+					c[i] = tile[i];
+					for (int j = 0; j < NR; j++) {
+						tile[i][j] = (accumulate && i < mr && j < nr) ?
+							outputPlanes[m0 + i].ptr<float>()[beginningPixel + j0 + j] : 0.0f;
+					}
+				}
+				microKernel<VecNative>(kc, a, b, c, accumulate,
+					lastBlock ? bias : nullptr);
+				for (int i = 0; i < mr; i++) {
+					float *dst = outputPlanes[m0 + i].ptr<float>() + beginningPixel + j0;
+					for (int j = 0; j < nr; j++) {
+						dst[j] = tile[i][j];
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+}
@@ -1,6 +1,8 @@
-﻿
-#include <stdio.h>
+﻿#include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include <exception>
+#include <iostream>
 #include "filterGL.h"
 
 struct FilterVertex
@@ -9,72 +11,248 @@ struct FilterVertex
 	float tu, tv;
 };
 
-static GLFWwindow* window = nullptr;
+// the session : created by the first filterGLInit, kept until
+// filterGLRelease. the textures only grow.
+static unsigned int session = 0;
+static bool sessionActive = false;
 static GLuint frameBuffer = 0;
 static GLuint textureBuffers[2] = {0};
+static GLuint vertexArray = 0;
+static GLuint vertexBuffer = 0;
+static GLuint outputPixelBuffer = 0;
+static int attachedTexels = 0;
+static cv::Size textureSize;
 static cv::Size planeSize;
+static cv::Size vertexPlaneSize;
 
-void filterGLInit(uint32_t width, uint32_t height)
+static bool createSession()
 {
-	glfwInit();
-
-#if __APPLE__
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-#endif
-	glfwWindowHint(GLFW_VISIBLE, 0);
-	window = glfwCreateWindow(1, 1, "waifu2x-glsl", nullptr, nullptr);
-	assert(window);
-
-	glfwMakeContextCurrent(window);
-	glGenTextures(2, textureBuffers);
-	
-	//std::cout << glGetString(GL_VERSION) << std::endl;
-	//std::cout << glGetString(GL_VENDOR) << std::endl;
-	//std::cout << glGetString(GL_EXTENSIONS) << std::endl;
-	
-#ifdef __glew_h__
-	GLenum glewResult = glewInit();
-	assert(glewResult == 0);
-	glGetError();
-#endif
-	
+	if (!glContextCreate()) {
+		return false;
+	}
+
+	static bool printed = false;
+	if (!printed) {
+		std::cout << "gl context : " << glContextName() << ", "
+			<< glGetString(GL_RENDERER) << std::endl;
+		printed = true;
+	}
+
+	glGenFramebuffers(1, &frameBuffer);
+	CHECK_GL_ERROR("glGenFramebuffers");
+
+	// the quad of every draw, texture coordinates set for the plane size
+	glGenVertexArrays(1, &vertexArray);
+	glBindVertexArray(vertexArray);
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(FilterVertex) * 4, nullptr, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(FILTER_GL_POSITION_LOCATION);
+	glVertexAttribPointer(FILTER_GL_POSITION_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(FilterVertex), (void*)0);
+	glEnableVertexAttribArray(FILTER_GL_TEXCOORD_LOCATION);
+	glVertexAttribPointer(FILTER_GL_TEXCOORD_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(FilterVertex), (void*)8);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	CHECK_GL_ERROR("glVertexAttribPointer");
+
+	glGenBuffers(1, &outputPixelBuffer);
 	glGenTextures(2, textureBuffers);
+	glDisable(GL_BLEND);
+
+	textureSize = cv::Size(0, 0);
+	vertexPlaneSize = cv::Size(0, 0);
+	attachedTexels = 0;
+	session++;
+	sessionActive = true;
+	return true;
+}
+
+bool filterGLInit(uint32_t width, uint32_t height)
+{
+	if (!sessionActive && !createSession()) {
+		return false;
+	}
+
+	if ((int)width <= textureSize.width && (int)height <= textureSize.height) {
+		return true;
+	}
+	textureSize.width = std::max(textureSize.width, (int)width);
+	textureSize.height = std::max(textureSize.height, (int)height);
+
 	for (int i = 0; i < 2; i++) {
 		glBindTexture(GL_TEXTURE_2D_ARRAY, textureBuffers[i]);
-		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, width, height, 128, 0, GL_RED, GL_FLOAT, nullptr);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, textureSize.width, textureSize.height,
+			filterGLTexelGroups(FILTER_GL_MAX_PLANES), 0, GL_RGBA, GL_FLOAT, nullptr);
 		CHECK_GL_ERROR("glTexImage3D");
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	}
 
-	glGenFramebuffers(1, &frameBuffer);
-	CHECK_GL_ERROR("glGenFramebuffers");
-	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, outputPixelBuffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, textureSize.area() * sizeof(float), 0, GL_STREAM_READ);
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 	CHECK_GL_ERROR("glBufferData");
+
+	vertexPlaneSize = cv::Size(0, 0);
+	return true;
 }
 
 void filterGLRelease()
 {
+	if (!sessionActive) {
+		return;
+	}
 	glDeleteFramebuffers(1, &frameBuffer);
 	frameBuffer = 0;
 	glDeleteTextures(2, textureBuffers);
 	memset(textureBuffers, 0, sizeof(textureBuffers));
+	glDeleteVertexArrays(1, &vertexArray);
+	vertexArray = 0;
+	glDeleteBuffers(1, &vertexBuffer);
+	vertexBuffer = 0;
+	glDeleteBuffers(1, &outputPixelBuffer);
+	outputPixelBuffer = 0;
+	textureSize = cv::Size(0, 0);
+
+	glContextDestroy();
+	sessionActive = false;
+}
+
+unsigned int filterGLSession()
+{
+	return sessionActive ? session : 0;
+}
+
+int filterGLTexelGroups(int nPlanes)
+{
+	return (nPlanes + FILTER_GL_TEXEL_CHANNELS - 1) / FILTER_GL_TEXEL_CHANNELS;
+}
+
+void filterGLPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &packedWeights, AlignedBuffer &packedBiases)
+{
+	const int C = FILTER_GL_TEXEL_CHANNELS;
+	int nInputGroups = filterGLTexelGroups(nInputPlanes);
+	int nOutputGroups = filterGLTexelGroups(nOutputPlanes);
+
+	packedWeights.assign(nOutputGroups * nInputGroups * 9 * C * C, 0.0f);
+	packedBiases.assign(nOutputGroups * C, 0.0f);
+
+	for (int op = 0; op < nOutputPlanes; op++) {
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			for (int t = 0; t < 9; t++) {
+				size_t index = ((((size_t)(op / C) * nInputGroups + ip / C) * 9 + t) * C
+					+ ip % C) * C + op % C;
+				packedWeights[index] = weightMatrix.at<float>(t / 3, t % 3);
+			}
+		}
+		packedBiases[op] = static_cast<float>(biases[op]);
+	}
+}
+
+// bytes of the weights of one output texel
+static size_t texelWeightsSize(int nInputPlanes)
+{
+	return (size_t)filterGLTexelGroups(nInputPlanes) * 9
+		* FILTER_GL_TEXEL_CHANNELS * FILTER_GL_TEXEL_CHANNELS * sizeof(float);
+}
+
+size_t filterGLWeightsBlockSize(int nInputPlanes)
+{
+	return FILTER_GL_TEXEL_CHANNELS * sizeof(float) + texelWeightsSize(nInputPlanes);
+}
+
+int filterGLMaxDrawTexels(int nInputPlanes, int nOutputPlanes)
+{
+	GLint maxDrawBuffers = 1, maxColorAttachments = 1, maxBlockSize = 0;
+	glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffers);
+	glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxColorAttachments);
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
 
-	glfwTerminate();
-	window = nullptr;
+	int nTexels = (int)((size_t)maxBlockSize / filterGLWeightsBlockSize(nInputPlanes));
+	nTexels = std::min(nTexels, (int)std::min(maxDrawBuffers, maxColorAttachments));
+	nTexels = std::min(nTexels, filterGLTexelGroups(nOutputPlanes));
+	return std::min(nTexels, FILTER_GL_MAX_DRAW_TEXELS);
+}
+
+void filterGLUploadWeights(Waifu2xShader& shader,
+	int nInputPlanes, int nOutputPlanes,
+	const float *weights, const float *biases)
+{
+	const size_t biasSize = FILTER_GL_TEXEL_CHANNELS * sizeof(float);
+	size_t weightsSize = texelWeightsSize(nInputPlanes);
+	int drawTexels = shader.outputTexels;
+	int nOutputGroups = filterGLTexelGroups(nOutputPlanes);
+	int nDraws = (nOutputGroups + drawTexels - 1) / drawTexels;
+
+	// the bias array then the weights array of the block (std140), the
+	// blocks of the draws at the offset alignment of glBindBufferRange
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	shader.drawSize = drawTexels * (biasSize + weightsSize);
+	shader.drawStride = (shader.drawSize + alignment - 1) / alignment * alignment;
+
+	std::vector<char> data(nDraws * shader.drawStride, 0);
+	for (int og = 0; og < nOutputGroups; og++) {
+		char *block = &data[(og / drawTexels) * shader.drawStride];
+		int texel = og % drawTexels;
+		memcpy(block + texel * biasSize,
+			biases + og * FILTER_GL_TEXEL_CHANNELS, biasSize);
+		memcpy(block + drawTexels * biasSize + texel * weightsSize,
+			(const char *)weights + og * weightsSize, weightsSize);
+	}
+
+	if (shader.weights == 0) {
+		glGenBuffers(1, &shader.weights);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, shader.weights);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	CHECK_GL_ERROR("glBufferData");
+}
+
+void filterGLReleaseShader(Waifu2xShader& shader)
+{
+	if (shader.session != 0 && shader.session == filterGLSession()) {
+		glDeleteProgram(shader.program);
+		glDeleteBuffers(1, &shader.weights);
+	}
+	shader.program = 0;
+	shader.weights = 0;
+	shader.session = 0;
 }
 
 void filterGLSetInputData(cv::Mat& inputPlane)
 {
 	planeSize = inputPlane.size();
 
+	// the plane is the lower left part of the textures
+	if (planeSize != vertexPlaneSize) {
+		float tu = (float)planeSize.width / textureSize.width;
+		float tv = (float)planeSize.height / textureSize.height;
+		const FilterVertex vertices[4] = {
+			{-1.0f,  1.0f, 0.0f, tv},
+			{-1.0f, -1.0f, 0.0f, 0.0f},
+			{ 1.0f,  1.0f, tu, tv},
+			{ 1.0f, -1.0f, tu, 0.0f},
+		};
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(FilterVertex) * 4, vertices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		vertexPlaneSize = planeSize;
+	}
+
+	// into the red channel of layer 0, green and blue read 0 and alpha 1,
+	// which meet zero weights
 	glBindTexture(GL_TEXTURE_2D_ARRAY, textureBuffers[0]);
 	void *pixels = inputPlane.data;
 	//size_t size = (size_t)(inputPlane.dataend - inputPlane.data);
-	
-	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, 
+
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
 		planeSize.width, planeSize.height, 1, GL_RED, GL_FLOAT, pixels);
 	CHECK_GL_ERROR("glTexSubImage3D");
 }
@@ -82,100 +260,71 @@ void filterGLSetInputData(cv::Mat& inputPlane)
 void filterGLGetOutputData(cv::Mat& outputPlane)
 {
 	cv::Size opSize = outputPlane.size();
-	
-	GLuint outputPixelBuffer = 0;
 
-	glGenBuffers(1, &outputPixelBuffer);
+	// the red channel of layer 0 is attached by the last draw
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, outputPixelBuffer);
-	glBufferData(GL_PIXEL_PACK_BUFFER, planeSize.width * planeSize.height * sizeof(float), 0, GL_DYNAMIC_DRAW);
-	CHECK_GL_ERROR("glBufferData");
-	
 	glReadPixels(0, 0, planeSize.width, planeSize.height, GL_RED, GL_FLOAT, 0);
 	CHECK_GL_ERROR("glReadPixels");
-	
+
 	void *resultAddr = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
 	CHECK_GL_ERROR("glMapBuffer");
-	
+
 	memcpy(outputPlane.data, resultAddr, opSize.width * opSize.height * sizeof(float));
 	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
 	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-	
-	glDeleteBuffers(1, &outputPixelBuffer);
 }
 
-bool filterGLProcess(Waifu2xShader& shader, 
-	int nInputPlanes, int nOutputPlanes,
-	std::vector<cv::Mat> &weightMatrices, 
-	std::vector<double> &biases, int modelIndex)
+bool filterGLProcess(Waifu2xShader& shader, int nOutputPlanes,
+	int modelIndex)
 {
 	// Swap I/O double buffers
 	GLuint inputTextures  = textureBuffers[(modelIndex + 0) % 2];
 	GLuint outputTextures = textureBuffers[(modelIndex + 1) % 2];
 
-	// Vertex Data
-	const FilterVertex vertices[4] = {
-		{-1.0f,  1.0f, 0.0f, 1.0f},
-		{-1.0f, -1.0f, 0.0f, 0.0f},
-		{ 1.0f,  1.0f, 1.0f, 1.0f},
-		{ 1.0f, -1.0f, 1.0f, 0.0f},
-	};
-	
-	GLuint vao = 0;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	
-	GLuint vbo = 0;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(FilterVertex) * 4, vertices, GL_STATIC_DRAW);
-  
-	glEnableVertexAttribArray(shader.a_position);
-	glVertexAttribPointer(shader.a_position, 2, GL_FLOAT, GL_FALSE, sizeof(FilterVertex), (void*)0);
-	glEnableVertexAttribArray(shader.a_texCoord);
-	glVertexAttribPointer(shader.a_texCoord, 2, GL_FLOAT, GL_FALSE, sizeof(FilterVertex), (void*)8);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	
 	glUseProgram(shader.program);
-	glBindVertexArray(vao);
-		
-	// Temporary matrix buffer
-	float vWeightMatrices[3 * 3 * 128];
-
-	for (int opIndex = 0; opIndex < nOutputPlanes; opIndex++) {
-		glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
-		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outputTextures, 0, opIndex);
-		glViewport(0, 0, planeSize.width, planeSize.height);
-		
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, inputTextures);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glUniform1i(shader.inputTextures, 0);
-		
-		glUniform1f(shader.bias, (float)biases[opIndex]);
-		
-		for (int ipIndex = 0; ipIndex < nInputPlanes; ipIndex++) {
-			memcpy(&vWeightMatrices[ipIndex * 3 * 3], 
-				weightMatrices[opIndex * nInputPlanes + ipIndex].data,
-				3 * 3 * sizeof(float));
+	glBindVertexArray(vertexArray);
+	glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+	glViewport(0, 0, planeSize.width, planeSize.height);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, inputTextures);
+	glUniform1i(shader.inputTextures, 0);
+
+	int drawTexels = shader.outputTexels;
+
+	// attachments of a previous layer beyond this one, the next layer
+	// samples them
+	for (int j = drawTexels; j < attachedTexels; j++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + j, 0, 0, 0);
+	}
+	attachedTexels = drawTexels;
+
+	int nOutputGroups = filterGLTexelGroups(nOutputPlanes);
+	for (int og = 0, draw = 0; og < nOutputGroups; og += drawTexels, draw++) {
+		int nTexels = std::min(drawTexels, nOutputGroups - og);
+
+		// the outputs of the shader past the last output texel go nowhere
+		GLenum drawBuffers[FILTER_GL_MAX_DRAW_TEXELS];
+		for (int j = 0; j < drawTexels; j++) {
+			if (j < nTexels) {
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + j, outputTextures, 0, og + j);
+				drawBuffers[j] = GL_COLOR_ATTACHMENT0 + j;
+			} else {
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + j, 0, 0, 0);
+				drawBuffers[j] = GL_NONE;
+			}
 		}
-		glUniform3fv(shader.weightMatrix, 3 * nInputPlanes, vWeightMatrices);
+		glDrawBuffers(drawTexels, drawBuffers);
+
+		// the Weights block of this draw
+		glBindBufferRange(GL_UNIFORM_BUFFER, FILTER_GL_WEIGHTS_BINDING, shader.weights,
+			draw * shader.drawStride, shader.drawSize);
 
-		glDisable(GL_BLEND);
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	}
 	CHECK_GL_ERROR("glDrawArrays");
 
 	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
-	glDeleteBuffers(1, &vao);
-
-	//glFlush();
-	glFinish();
 
 	return true;
 }
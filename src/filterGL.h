@@ -4,47 +4,108 @@
 
 #include <stdint.h>
 #include <assert.h>
+#include <stdexcept>
+#include <vector>
 
-#if defined(_WIN32)
-	#include <GL/glew.h>
-#elif defined(__APPLE__)
-	#include <OpenGL/gl3.h>
-#endif
-
-#include <GLFW/glfw3.h>
+#include "glContext.h"
 #include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
 
 #if NDEBUG
 #define	CHECK_GL_ERROR(target)	\
-	if (glGetError() != 0) {throw std::exception("OpenGL error: " target);}
+	if (glGetError() != 0) {throw std::runtime_error("OpenGL error: " target);}
 #else
 #define	CHECK_GL_ERROR(target)	\
 	assert(glGetError() == 0);
 #endif
 
+// attribute locations of the vertex shader, bound before linking
+#define FILTER_GL_POSITION_LOCATION	0
+#define FILTER_GL_TEXCOORD_LOCATION	1
+
+// binding point of the Weights uniform block
+#define FILTER_GL_WEIGHTS_BINDING	0
+
+// the planes are packed 4 channels per RGBA32F texel : plane p is the
+// component p % 4 of layer p / 4 of the texture arrays
+#define FILTER_GL_TEXEL_CHANNELS	4
+#define FILTER_GL_MAX_PLANES		128
+
+// most output texels (color attachments) of a draw
+#define FILTER_GL_MAX_DRAW_TEXELS	8
+
+// number of texels (texture layers) of nPlanes channels
+int filterGLTexelGroups(int nPlanes);
+
 // waifu2x shader
 struct Waifu2xShader
 {
 	GLuint program;
-	GLuint a_position;
-	GLuint a_texCoord;
-	
-	GLuint bias;
-	GLuint weightMatrix;
+	unsigned int session;	// filterGLSession() of program, 0 : none
+
+	int outputTexels;		// output texels of a draw, NUM_OUTPUT_TEXELS
+
+	// the Weights blocks of every draw of the layer, uploaded once.
+	// draw d binds drawSize bytes at d * drawStride
+	GLuint weights;
+	GLintptr drawStride;
+	GLsizeiptr drawSize;
+
 	GLuint inputTextures;
+
+	Waifu2xShader() : program(0), session(0), outputTexels(1),
+		weights(0), drawStride(0), drawSize(0) {}
 };
 
-void filterGLInit(uint32_t width, uint32_t height);
+// the GL session of the process : the first call creates the context
+// (glContext.h), the quad and the read back buffer, the textures grow to
+// the largest plane size asked for. all of them are kept for every tile,
+// pass and image until filterGLRelease().
+// false if there is no context
+bool filterGLInit(uint32_t width, uint32_t height);
 
+// deletes the session and the context
 void filterGLRelease();
 
+// number of the current session, 0 without one.
+// programs of an older session are gone with its context
+unsigned int filterGLSession();
+
 void filterGLSetInputData(cv::Mat& inputPlane);
 
 void filterGLGetOutputData(cv::Mat& outputPlane);
 
-bool filterGLProcess(Waifu2xShader& shader, 
+// weights in (output texel, input texel, 3x3, input channel, output
+// channel) order, the layout of the weights of the Weights uniform
+// block : the 4 x 4 matrix of a tap has the input channels as columns.
+// the channels past nInputPlanes and nOutputPlanes are zero, biases are
+// padded the same way.
+void filterGLPackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &packedWeights, AlignedBuffer &packedBiases);
+
+// bytes of the Weights block of one output texel : its bias and weights
+size_t filterGLWeightsBlockSize(int nInputPlanes);
+
+// output texels a draw can write : the color attachments and draw
+// buffers of the context, the blocks of the output texels have to fit
+// one uniform block. 0 if the block of one texel does not fit
+int filterGLMaxDrawTexels(int nInputPlanes, int nOutputPlanes);
+
+// uploads the Weights blocks of every draw of shader.outputTexels output
+// texels into shader.weights, from the data of filterGLPackWeights.
+// the output texels past the last one of the layer are zero.
+void filterGLUploadWeights(Waifu2xShader& shader,
 	int nInputPlanes, int nOutputPlanes,
-	std::vector<cv::Mat> &weightMatrices, 
-	std::vector<double> &biases, int modelIndex);
+	const float *weights, const float *biases);
+
+// deletes the program and the weights of shader if they belong to the
+// current session
+void filterGLReleaseShader(Waifu2xShader& shader);
+
+// one draw per shader.outputTexels output texels (4 output planes each),
+// the last one may write fewer of them
+bool filterGLProcess(Waifu2xShader& shader, int nOutputPlanes,
+	int modelIndex);
 
 #endif
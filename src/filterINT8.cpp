@@ -0,0 +1,21 @@
+#include "filterINT8.h"
+#include "filterKernels.h"
+
+void filterINT8PackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	const FilterINT8Quantization &inputQuantization,
+	AlignedBuffer &packedWeights, AlignedBuffer &requantization)
+{
+	filterKernels().int8PackWeights(weightMatrices, biases, nInputPlanes,
+		nOutputPlanes, inputQuantization, packedWeights, requantization);
+}
+
+bool filterINT8Process(const unsigned char *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *requantization,
+	void *output, const FilterINT8Quantization *outputQuantization,
+	int nOutputBlocks, int beginningRow, int nRows)
+{
+	return filterKernels().int8Process(input, nInputPlanes, size, weights,
+		requantization, output, outputQuantization, nOutputBlocks,
+		beginningRow, nRows);
+}
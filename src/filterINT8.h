@@ -0,0 +1,50 @@
+
+#ifndef FILTER_INT8_H_
+#define FILTER_INT8_H_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
+
+// Quantized 3x3 convolution + bias + leaky ReLU on channel interleaved
+// activations (NCHW8c) of unsigned 8 bit values.
+// Weights are signed 8 bit with one scale per output plane, activations
+// unsigned with one scale and zero point per tensor (from the calibration
+// file, see calibration.hpp). Groups of 4 input channels of a pixel are
+// multiplied with the weights of 8 output channels and summed up in
+// 32 bit integers (vpdpbusd with VNNI, vpmaddubsw + vpmaddwd with AVX2),
+// then rescaled to float for bias, leaky ReLU and the output quantization.
+// Borders are replicated.
+
+// affine quantization of a tensor : value = (q - zeroPoint) * scale,
+// q in [0, maxValue]. maxValue is 127 so that the pairs of products of
+// vpmaddubsw can't saturate 16 bits, 255 is allowed for tensors with one
+// channel (the other product of each pair is a zero padding channel).
+struct FilterINT8Quantization
+{
+	float scale;
+	int zeroPoint;
+	int maxValue;
+};
+
+// weights in (output block, input block, group of 4, 3x3, 8 x 4) order as
+// signed bytes (in the floats of packedWeights), requantization in
+// (output block, scale x 8, offset x 8) order : the output before the
+// activation is sum * scale + offset, which folds the weight scales, the
+// input scale and zero point and the bias.
+void filterINT8PackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	const FilterINT8Quantization &inputQuantization,
+	AlignedBuffer &packedWeights, AlignedBuffer &requantization);
+
+// rows [beginningRow, beginningRow + nRows) of nOutputBlocks consecutive
+// output blocks. input points to block 0 of the input, weights and
+// requantization to the packed data of the first output block.
+// output points to the first output block, of unsigned bytes quantized with
+// outputQuantization, or of floats if outputQuantization is nullptr.
+bool filterINT8Process(const unsigned char *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *requantization,
+	void *output, const FilterINT8Quantization *outputQuantization,
+	int nOutputBlocks, int beginningRow, int nRows);
+
+#endif
@@ -0,0 +1,426 @@
+// kernel bodies of filterINT8.h, compiled once per instruction set inside
+// FILTER_KERNELS_NAMESPACE by filterKernels<ISA>.cpp (see filterKernels.h)
+
+#include "filterCPUSIMD.h"
+
+// sum * scale + offset is rounded after the multiplication in every
+// variant, GCC would contract it into an FMA on the FMA targets
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+namespace {
+
+const int QB = 8;	// interleaved channels of a block
+const int QG = 4;	// input channels of a dot product
+
+// 8 lanes of 32 bit sums of 4 products (unsigned activation x signed weight)
+#if defined(FILTER_CPU_AVX2)
+struct DotAVX2
+{
+	typedef __m256i Reg;
+	typedef __m256i Activations;
+	typedef __m256i Weights;
+	enum { pixels = 4 };	// per call of convolveQuantizedPixels
+
+	static Reg zero() { return _mm256_setzero_si256(); }
+	// 4 activations of a pixel in every lane
+	static Activations broadcast(const unsigned char *p) {
+		int v;
+		std::memcpy(&v, p, sizeof(v));
+		return _mm256_set1_epi32(v);
+	}
+	static Weights load(const signed char *p) {
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	}
+	static Reg dot(Reg sum, Activations a, Weights w) {
+#if defined(FILTER_CPU_VNNI)
+		return _mm256_dpbusd_epi32(sum, a, w);
+#else
+		return _mm256_add_epi32(sum, _mm256_madd_epi16(
+			_mm256_maddubs_epi16(a, w), _mm256_set1_epi16(1)));
+#endif
+	}
+
+	// sum * scale + offset and leaky ReLU of the 8 output channels.
+	// multiplied and added apart, not fused : every variant rounds the
+	// same and quantizes to the same bytes
+	static __m256 activate(Reg sum, const float *requantization) {
+		__m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sum),
+			_mm256_loadu_ps(requantization)), _mm256_loadu_ps(requantization + QB));
+		return VecAVX2::leakyReLU(v);
+	}
+	static void storeFloat(float *dst, Reg sum, const float *requantization) {
+		_mm256_storeu_ps(dst, activate(sum, requantization));
+	}
+	static void storeQuantized(unsigned char *dst, Reg sum,
+		const float *requantization, float inverseScale, int zeroPoint,
+		int maxValue)
+	{
+		__m256 v = _mm256_add_ps(_mm256_mul_ps(activate(sum, requantization),
+			_mm256_set1_ps(inverseScale)),
+			_mm256_set1_ps(static_cast<float>(zeroPoint)));
+		__m256i q = _mm256_cvtps_epi32(v);
+		q = _mm256_min_epi32(_mm256_max_epi32(q, _mm256_setzero_si256()),
+			_mm256_set1_epi32(maxValue));
+		__m128i q16 = _mm_packs_epi32(_mm256_castsi256_si128(q),
+			_mm256_extracti128_si256(q, 1));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst),
+			_mm_packus_epi16(q16, q16));
+	}
+};
+typedef DotAVX2 DotNative;
+#elif defined(FILTER_CPU_SSE)
+// no vpmaddubsw in SSE2 : 16 bit products with pmaddwd, the sums of the
+// pairs (0, 1) and (2, 3) of each output channel are added at the end
+struct DotSSE2
+{
+	// lanes of v[j] : pairs of the output channels 2j and 2j + 1
+	struct Reg { __m128i v[4]; };
+	// the 4 activations twice, 16 bit
+	typedef __m128i Activations;
+	// the 4 weights of the output channels 2j and 2j + 1, 16 bit
+	struct Weights { __m128i v[4]; };
+	enum { pixels = 1 };	// 16 registers only
+
+	static Reg zero() {
+		Reg r;
+		for (int j = 0; j < 4; j++) {
+			r.v[j] = _mm_setzero_si128();
+		}
+		return r;
+	}
+	static Activations broadcast(const unsigned char *p) {
+		int v;
+		std::memcpy(&v, p, sizeof(v));
+		return _mm_unpacklo_epi8(_mm_set1_epi32(v), _mm_setzero_si128());
+	}
+	static Weights load(const signed char *p) {
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+		// sign extension
+		Weights w;
+		w.v[0] = _mm_srai_epi16(_mm_unpacklo_epi8(low, low), 8);
+		w.v[1] = _mm_srai_epi16(_mm_unpackhi_epi8(low, low), 8);
+		w.v[2] = _mm_srai_epi16(_mm_unpacklo_epi8(high, high), 8);
+		w.v[3] = _mm_srai_epi16(_mm_unpackhi_epi8(high, high), 8);
+		return w;
+	}
+	static Reg dot(Reg sum, Activations a, const Weights &w) {
+		for (int j = 0; j < 4; j++) {
+			sum.v[j] = _mm_add_epi32(sum.v[j], _mm_madd_epi16(a, w.v[j]));
+		}
+		return sum;
+	}
+
+	// sums of the output channels 4h .. 4h + 3
+	static __m128i reduce(const Reg &sum, int h) {
+		__m128 a = _mm_castsi128_ps(sum.v[h * 2]);
+		__m128 b = _mm_castsi128_ps(sum.v[h * 2 + 1]);
+		return _mm_add_epi32(
+			_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+	static __m128 activate(const Reg &sum, const float *requantization, int h) {
+		__m128 v = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(reduce(sum, h)),
+			_mm_loadu_ps(requantization + h * 4)),
+			_mm_loadu_ps(requantization + QB + h * 4));
+		return VecSSE::leakyReLU(v);
+	}
+	static void storeFloat(float *dst, const Reg &sum,
+		const float *requantization)
+	{
+		_mm_storeu_ps(dst, activate(sum, requantization, 0));
+		_mm_storeu_ps(dst + 4, activate(sum, requantization, 1));
+	}
+	static void storeQuantized(unsigned char *dst, const Reg &sum,
+		const float *requantization, float inverseScale, int zeroPoint,
+		int maxValue)
+	{
+		// no pminsd in SSE2, clamped before the conversion
+		__m128i q[2];
+		for (int h = 0; h < 2; h++) {
+			__m128 v = _mm_add_ps(_mm_mul_ps(activate(sum, requantization, h),
+				_mm_set1_ps(inverseScale)),
+				_mm_set1_ps(static_cast<float>(zeroPoint)));
+			v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()),
+				_mm_set1_ps(static_cast<float>(maxValue)));
+			q[h] = _mm_cvtps_epi32(v);
+		}
+		__m128i q16 = _mm_packs_epi32(q[0], q[1]);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst),
+			_mm_packus_epi16(q16, q16));
+	}
+};
+typedef DotSSE2 DotNative;
+#else
+// portable version of the other variants
+struct DotScalar
+{
+	struct Reg { int v[QB]; };
+	typedef Reg Activations;
+	typedef const signed char *Weights;
+	enum { pixels = 4 };
+
+	static Reg zero() {
+		Reg r;
+		for (int i = 0; i < QB; i++) {
+			r.v[i] = 0;
+		}
+		return r;
+	}
+	static Activations broadcast(const unsigned char *p) {
+		Reg r;
+		std::memcpy(&r.v[0], p, sizeof(int));
+		return r;
+	}
+	static Weights load(const signed char *p) { return p; }
+	static Reg dot(Reg sum, const Activations &a, Weights w) {
+		const unsigned char *u = reinterpret_cast<const unsigned char *>(&a.v[0]);
+		for (int i = 0; i < QB; i++) {
+			for (int k = 0; k < QG; k++) {
+				sum.v[i] += u[k] * w[i * QG + k];
+			}
+		}
+		return sum;
+	}
+
+	static float activate(const Reg &sum, const float *requantization, int i) {
+		float v = sum.v[i] * requantization[i] + requantization[QB + i];
+		return VecScalar::leakyReLU(v);
+	}
+	static void storeFloat(float *dst, const Reg &sum,
+		const float *requantization)
+	{
+		for (int i = 0; i < QB; i++) {
+			dst[i] = activate(sum, requantization, i);
+		}
+	}
+	static void storeQuantized(unsigned char *dst, const Reg &sum,
+		const float *requantization, float inverseScale, int zeroPoint,
+		int maxValue)
+	{
+		for (int i = 0; i < QB; i++) {
+			float v = activate(sum, requantization, i) * inverseScale + zeroPoint;
+			// to nearest even like cvtps2dq
+			int q = static_cast<int>(std::nearbyint(v));
+			dst[i] = static_cast<unsigned char>(std::min(std::max(q, 0), maxValue));
+		}
+	}
+};
+typedef DotScalar DotNative;
+#endif
+
+// P pixels x (nBlocks * 8) output channels of a row.
+// xs[0 .. P + 2) are the (clamped) columns x0 - 1 .. x0 + P,
+// rows[ky] points to the input row (y - 1 + ky) of block 0.
+template <class D, int P, int nBlocks>
+static void convolveQuantizedPixels(const unsigned char * const *rows,
+	size_t blockStride, int nInputBlocks, const int *xs,
+	const signed char *weights, size_t weightStride,
+	const float *requantization, void *output, size_t dstStride,
+	const FilterINT8Quantization *outputQuantization)
+{
+	typename D::Reg acc[P][nBlocks];
+	FILTER_CPU_UNROLL(16)
+	for (int p = 0; p < P; p++) {
+		FILTER_CPU_UNROLL(2)
+		for (int b = 0; b < nBlocks; b++) {
+			acc[p][b] = D::zero();
+		}
+	}
+
+	int offsets[P + 2];
+	FILTER_CPU_UNROLL(16)
+	for (int j = 0; j < P + 2; j++) {
+		offsets[j] = xs[j] * QB;
+	}
+
+	for (int ib = 0; ib < nInputBlocks; ib++) {
+		FILTER_CPU_UNROLL(2)
+		for (int g = 0; g < QB / QG; g++) {
+			const signed char *w = weights + (ib * 2 + g) * 9 * QB * QG;
+			FILTER_CPU_UNROLL(3)
+			for (int ky = 0; ky < 3; ky++) {
+				const unsigned char *src = rows[ky] + ib * blockStride + g * QG;
+				FILTER_CPU_UNROLL(3)
+				for (int kx = 0; kx < 3; kx++) {
+					const signed char *wt = w + (ky * 3 + kx) * QB * QG;
+					typename D::Weights wv[nBlocks];
+					FILTER_CPU_UNROLL(2)
+					for (int b = 0; b < nBlocks; b++) {
+						wv[b] = D::load(wt + b * weightStride);
+					}
+					FILTER_CPU_UNROLL(16)
+					for (int p = 0; p < P; p++) {
+						typename D::Activations a = D::broadcast(src + offsets[p + kx]);
+						FILTER_CPU_UNROLL(2)
+						for (int b = 0; b < nBlocks; b++) {
+							acc[p][b] = D::dot(acc[p][b], a, wv[b]);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	FILTER_CPU_UNROLL(2)
+	for (int b = 0; b < nBlocks; b++) {
+		const float *r = requantization + b * 2 * QB;
+		FILTER_CPU_UNROLL(16)
+		for (int p = 0; p < P; p++) {
+			size_t offset = b * dstStride + xs[p + 1] * QB;
+			if (outputQuantization) {
+				D::storeQuantized(static_cast<unsigned char *>(output) + offset,
+					acc[p][b], r, 1.0f / outputQuantization->scale,
+					outputQuantization->zeroPoint, outputQuantization->maxValue);
+			} else {
+				D::storeFloat(static_cast<float *>(output) + offset, acc[p][b], r);
+			}
+		}
+	}
+}
+
+// element offset of the bytes or floats of the output
+static void *outputRow(void *output,
+	const FilterINT8Quantization *outputQuantization, size_t offset)
+{
+	if (outputQuantization) {
+		return static_cast<unsigned char *>(output) + offset;
+	}
+	return static_cast<float *>(output) + offset;
+}
+
+// D::pixels pixels at a time, the borders one by one
+template <class D, int nBlocks>
+static void convolveQuantizedRow(const unsigned char * const *rows,
+	size_t blockStride, int nInputBlocks, int width,
+	const signed char *weights, size_t weightStride,
+	const float *requantization, void *output, size_t dstStride,
+	const FilterINT8Quantization *outputQuantization)
+{
+	enum { P = D::pixels };
+	int xs[P + 2];
+
+	int x = 0;
+	for (; x < width; ) {
+		int n = (x >= 1 && x + P + 1 <= width) ? P : 1;
+		for (int j = 0; j < n + 2; j++) {
+			xs[j] = std::min(std::max(x - 1 + j, 0), width - 1);
+		}
+		if (n == P) {
+			convolveQuantizedPixels<D, P, nBlocks>(rows, blockStride,
+				nInputBlocks, xs, weights, weightStride, requantization,
+				output, dstStride, outputQuantization);
+		} else {
+			convolveQuantizedPixels<D, 1, nBlocks>(rows, blockStride,
+				nInputBlocks, xs, weights, weightStride, requantization,
+				output, dstStride, outputQuantization);
+		}
+		x += n;
+	}
+}
+
+}
+
+void filterINT8PackWeights(const std::vector<cv::Mat> &weightMatrices,
+	const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+	const FilterINT8Quantization &inputQuantization,
+	AlignedBuffer &packedWeights, AlignedBuffer &requantization)
+{
+	int nBlocks = (nOutputPlanes + QB - 1) / QB;
+	int nInputBlocks = (nInputPlanes + QB - 1) / QB;
+	size_t blockBytes = static_cast<size_t>(nInputBlocks) * QB * 9 * QB;
+
+	// bytes in the floats of the buffer
+	packedWeights.assign((nBlocks * blockBytes + sizeof(float) - 1)
+		/ sizeof(float), 0.0f);
+	requantization.assign(nBlocks * 2 * QB, 0.0f);
+	signed char *packed = reinterpret_cast<signed char *>(packedWeights.data());
+
+	for (int op = 0; op < nOutputPlanes; op++) {
+		// symmetric per output plane
+		float maxWeight = 0.0f;
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			for (int t = 0; t < 9; t++) {
+				maxWeight = std::max(maxWeight,
+					std::fabs(weightMatrix.at<float>(t / 3, t % 3)));
+			}
+		}
+		float weightScale = (maxWeight > 0.0f) ? maxWeight / 127.0f : 1.0f;
+
+		int sum = 0;
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			int ib = ip / QB, g = ip % QB / QG;
+			for (int t = 0; t < 9; t++) {
+				int q = static_cast<int>(std::floor(
+					weightMatrix.at<float>(t / 3, t % 3) / weightScale + 0.5f));
+				q = std::min(std::max(q, -127), 127);
+				size_t index = (op / QB) * blockBytes
+					+ (((ib * 2 + g) * 9 + t) * QB + op % QB) * QG + ip % QG;
+				packed[index] = static_cast<signed char>(q);
+				sum += q;
+			}
+		}
+
+		float scale = inputQuantization.scale * weightScale;
+		float *r = requantization.data() + (op / QB) * 2 * QB;
+		r[op % QB] = scale;
+		r[QB + op % QB] = static_cast<float>(biases[op])
+			- scale * inputQuantization.zeroPoint * sum;
+	}
+}
+
+bool filterINT8Process(const unsigned char *input, int nInputPlanes,
+	cv::Size size, const float *weights, const float *requantization,
+	void *output, const FilterINT8Quantization *outputQuantization,
+	int nOutputBlocks, int beginningRow, int nRows)
+{
+	size_t rowStride = static_cast<size_t>(size.width) * QB;
+	size_t blockStride = rowStride * size.height;
+	int nInputBlocks = (nInputPlanes + QB - 1) / QB;
+	size_t weightStride = static_cast<size_t>(nInputBlocks) * QB * 9 * QB;
+	const signed char *packed = reinterpret_cast<const signed char *>(weights);
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		const unsigned char *rows[3];
+		for (int ky = 0; ky < 3; ky++) {
+			int yy = std::min(std::max(y - 1 + ky, 0), size.height - 1);
+			rows[ky] = input + yy * rowStride;
+		}
+
+		// output blocks in pairs, the odd one alone
+		int block = 0;
+		for (; block + 2 <= nOutputBlocks; block += 2) {
+			convolveQuantizedRow<DotNative, 2>(rows, blockStride, nInputBlocks,
+				size.width, packed + block * weightStride, weightStride,
+				requantization + block * 2 * QB,
+				outputRow(output, outputQuantization, block * blockStride
+					+ y * rowStride), blockStride, outputQuantization);
+		}
+		if (block < nOutputBlocks) {
+			convolveQuantizedRow<DotNative, 1>(rows, blockStride, nInputBlocks,
+				size.width, packed + block * weightStride, weightStride,
+				requantization + block * 2 * QB,
+				outputRow(output, outputQuantization, block * blockStride
+					+ y * rowStride), blockStride, outputQuantization);
+		}
+	}
+
+	return true;
+}
+
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
@@ -0,0 +1,523 @@
+#include "filterJIT.h"
+#include "filterKernels.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FILTER_JIT_X64
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+	#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+#endif
+
+namespace {
+
+const int CB = 8;	// interleaved channels of a block
+
+// arguments of the generated functions, read from memory by the code
+struct JITArgs
+{
+	const float *rows[3];	// input rows y - 1 .. y + 1 of block 0
+	float *dst;				// output row of the first output block
+	size_t blockStride;		// bytes from a block to the next (input and output)
+	size_t nStrips;			// number of strips of the function
+	const float *weights;	// packed weights of the first output block
+	const float *bias;
+	size_t columns[3];		// pixel functions : byte offsets of x - 1 .. x + 1
+	float slope;			// of the leaky ReLU
+};
+
+typedef void (*JITFunction)(const JITArgs *args);
+
+}
+
+struct FilterJITKernel
+{
+	int nInputPlanes;
+	int nOutputPlanes;
+
+	// code, then the constant pool (weights, biases)
+	unsigned char *memory;
+	size_t memorySize;
+	size_t codeSize;
+	const float *weights;
+	const float *biases;
+
+	// [nBlocks - 1] : strips of stripPixels contiguous pixels, and single
+	// pixels with the (clamped) columns of args.columns
+	JITFunction strip[2];
+	JITFunction pixel[2];
+	int stripPixels[2];
+
+	FilterJITKernel() : memory(nullptr), memorySize(0) {}
+	~FilterJITKernel();
+};
+
+#if defined(FILTER_JIT_X64)
+
+namespace {
+
+enum {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// the few x86-64 instructions of the kernels, 64 bit operands and
+// VEX encoded AVX2 / FMA, memory operands [base + index + disp]
+// (index < 0 : none)
+class Assembler
+{
+public:
+	std::vector<unsigned char> code;
+
+	size_t size() const { return code.size(); }
+
+	void push(int r) { rex(false, 0, -1, r); byte(0x50 + (r & 7)); }
+	void pop(int r) { rex(false, 0, -1, r); byte(0x58 + (r & 7)); }
+	void mov(int dst, int base, int disp) {
+		rex(true, dst, -1, base); byte(0x8B); memory(dst, base, -1, disp);
+	}
+	void movRR(int dst, int src) { registers(0x89, src, dst); }
+	void movRI(int dst, int imm) {
+		rex(true, 0, -1, dst); byte(0xC7); byte(0xC0 | (dst & 7)); dword(imm);
+	}
+	void addRR(int dst, int src) { registers(0x01, src, dst); }
+	void xorRR(int dst, int src) { registers(0x31, src, dst); }
+	void addRI(int dst, int imm) {
+		rex(true, 0, -1, dst); byte(0x81); byte(0xC0 | (dst & 7)); dword(imm);
+	}
+	void subRI(int dst, int imm) {
+		rex(true, 0, -1, dst); byte(0x81); byte(0xE8 | (dst & 7)); dword(imm);
+	}
+	void dec(int r) { rex(true, 0, -1, r); byte(0xFF); byte(0xC8 | (r & 7)); }
+	// jump back to target if not zero
+	void jnz(size_t target) {
+		byte(0x0F); byte(0x85);
+		dword(static_cast<int>(static_cast<long long>(target) - (size() + 4)));
+	}
+	void ret() { byte(0xC3); }
+
+	// 256 bit (l = 1) or 128 bit (l = 0) unaligned load / store
+	void vmovupsLoad(int y, int base, int index, int disp, int l = 1) {
+		vex(y, 0, index, base, 1, 0, l); byte(0x10); memory(y, base, index, disp);
+	}
+	void vmovupsStore(int y, int base, int index, int disp, int l = 1) {
+		vex(y, 0, index, base, 1, 0, l); byte(0x11); memory(y, base, index, disp);
+	}
+	void vbroadcastss(int y, int base, int index, int disp) {
+		vex(y, 0, index, base, 2, 1, 1); byte(0x18); memory(y, base, index, disp);
+	}
+	// d += a * b
+	void vfmadd231ps(int d, int a, int b) {
+		vex(d, a, -1, b, 2, 1, 1); byte(0xB8); byte(0xC0 | (d & 7) << 3 | (b & 7));
+	}
+	void vxorps(int d, int a, int b) { vexRegisters(0x57, d, a, b); }
+	void vminps(int d, int a, int b) { vexRegisters(0x5D, d, a, b); }
+	void vmaxps(int d, int a, int b) { vexRegisters(0x5F, d, a, b); }
+	void vzeroupper() { byte(0xC5); byte(0xF8); byte(0x77); }
+
+private:
+	void byte(int b) { code.push_back(static_cast<unsigned char>(b)); }
+	void dword(int d) {
+		for (int i = 0; i < 4; i++) {
+			byte((d >> (i * 8)) & 0xFF);
+		}
+	}
+
+	static int high(int r) { return (r < 0) ? 0 : (r >> 3) & 1; }
+
+	void rex(bool w, int reg, int index, int base) {
+		int prefix = 0x40 | (w ? 8 : 0) | high(reg) << 2 | high(index) << 1
+			| high(base);
+		if (prefix != 0x40) {
+			byte(prefix);
+		}
+	}
+	// op rm, reg on 64 bit registers
+	void registers(int opcode, int reg, int rm) {
+		rex(true, reg, -1, rm); byte(opcode); byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+	}
+	// 3 byte VEX, W0, map 1 : 0F, 2 : 0F38, pp 0 : none, 1 : 66
+	void vex(int reg, int vvvv, int index, int base, int map, int pp, int l) {
+		byte(0xC4);
+		byte((high(reg) ^ 1) << 7 | (high(index) ^ 1) << 6 | (high(base) ^ 1) << 5
+			| map);
+		byte((~vvvv & 15) << 3 | l << 2 | pp);
+	}
+	void vexRegisters(int opcode, int d, int a, int b) {
+		vex(d, a, -1, b, 1, 0, 1); byte(opcode); byte(0xC0 | (d & 7) << 3 | (b & 7));
+	}
+	void memory(int reg, int base, int index, int disp) {
+		int mod = (disp == 0 && (base & 7) != RBP) ? 0 :
+			(disp >= -128 && disp <= 127) ? 1 : 2;
+		if (index < 0 && (base & 7) != RSP) {
+			byte(mod << 6 | (reg & 7) << 3 | (base & 7));
+		} else {
+			byte(mod << 6 | (reg & 7) << 3 | 4);
+			byte((index < 0 ? 4 : (index & 7)) << 3 | (base & 7));
+		}
+		if (mod == 1) {
+			byte(disp & 0xFF);
+		} else if (mod == 2) {
+			dword(disp);
+		}
+	}
+};
+
+// registers of the generated functions
+const int rowRegisters[3] = { RBX, RSI, RDI };
+const int columnRegisters[3] = { R8, R9, R10 };
+const int savedRegisters[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+const int nSavedRegisters = sizeof(savedRegisters) / sizeof(savedRegisters[0]);
+// ymm0 .. ymm11 accumulators, ymm12, ymm13 weights, ymm14 input
+const int weightRegister = 12;
+const int inputRegister = 14;
+
+#if defined(_WIN32)
+const int savedXmmBytes = 10 * 16;	// xmm6 .. xmm15 are callee saved
+#endif
+
+// nc channels of an input block : the 3x3 weight vectors of every channel
+// are loaded once and used for the P pixels
+void emitInputBlock(Assembler &a, int nc, int nBlocks, int P,
+	bool columnIndexed, int weightStrideBytes)
+{
+	for (int c = 0; c < nc; c++) {
+		for (int t = 0; t < 9; t++) {
+			int ky = t / 3, kx = t % 3;
+			for (int b = 0; b < nBlocks; b++) {
+				a.vmovupsLoad(weightRegister + b, R11, -1,
+					b * weightStrideBytes + (c * 9 + t) * CB * 4);
+			}
+			for (int p = 0; p < P; p++) {
+				if (columnIndexed) {
+					a.vbroadcastss(inputRegister, rowRegisters[ky],
+						columnRegisters[kx], c * 4);
+				} else {
+					a.vbroadcastss(inputRegister, rowRegisters[ky], -1,
+						((p + kx) * CB + c) * 4);
+				}
+				for (int b = 0; b < nBlocks; b++) {
+					a.vfmadd231ps(p * nBlocks + b, inputRegister,
+						weightRegister + b);
+				}
+			}
+		}
+	}
+}
+
+// void f(const JITArgs *args) : args->nStrips strips of P pixels x
+// nBlocks output blocks. columnIndexed (P = 1) : the columns of the taps
+// are args->columns, otherwise the rows point to column x - 1.
+void emitFunction(Assembler &a, int nInputPlanes, int nBlocks, int P,
+	bool columnIndexed)
+{
+	int weightStrideBytes = nInputPlanes * 9 * CB * 4;
+
+	for (int i = 0; i < nSavedRegisters; i++) {
+		a.push(savedRegisters[i]);
+	}
+#if defined(_WIN32)
+	a.subRI(RSP, savedXmmBytes);
+	for (int i = 0; i < 10; i++) {
+		a.vmovupsStore(6 + i, RSP, -1, i * 16, 0);
+	}
+	a.movRR(RAX, RCX);
+#else
+	a.movRR(RAX, RDI);
+#endif
+	a.mov(RCX, RAX, offsetof(JITArgs, nStrips));
+	a.mov(R15, RAX, offsetof(JITArgs, blockStride));
+	a.xorRR(RBP, RBP);	// byte offset of the strip
+
+	size_t stripLoop = a.size();
+	for (int k = 0; k < 3; k++) {
+		a.mov(rowRegisters[k], RAX, offsetof(JITArgs, rows) + k * 8);
+		a.addRR(rowRegisters[k], RBP);
+		if (columnIndexed) {
+			a.mov(columnRegisters[k], RAX, offsetof(JITArgs, columns) + k * 8);
+		}
+	}
+	a.mov(R11, RAX, offsetof(JITArgs, weights));
+	a.mov(RDX, RAX, offsetof(JITArgs, bias));
+	for (int p = 0; p < P; p++) {
+		for (int b = 0; b < nBlocks; b++) {
+			a.vmovupsLoad(p * nBlocks + b, RDX, -1, b * CB * 4);
+		}
+	}
+
+	// whole input blocks in a loop of constant trip count, then the
+	// channels of a partial block
+	int nFullBlocks = nInputPlanes / CB;
+	int nRemainingChannels = nInputPlanes % CB;
+	if (nFullBlocks > 0) {
+		a.movRI(R14, nFullBlocks);
+		size_t blockLoop = a.size();
+		emitInputBlock(a, CB, nBlocks, P, columnIndexed, weightStrideBytes);
+		a.addRI(R11, CB * 9 * CB * 4);
+		for (int k = 0; k < 3; k++) {
+			a.addRR(rowRegisters[k], R15);
+		}
+		a.dec(R14);
+		a.jnz(blockLoop);
+	}
+	if (nRemainingChannels > 0) {
+		emitInputBlock(a, nRemainingChannels, nBlocks, P, columnIndexed,
+			weightStrideBytes);
+	}
+
+	// leaky ReLU : max(v, 0) + min(v, 0) * slope
+	a.vxorps(15, 15, 15);
+	a.vbroadcastss(12, RAX, -1, offsetof(JITArgs, slope));
+	for (int i = 0; i < P * nBlocks; i++) {
+		a.vminps(13, i, 15);
+		a.vmaxps(i, i, 15);
+		a.vfmadd231ps(i, 13, 12);
+	}
+	a.mov(RDX, RAX, offsetof(JITArgs, dst));
+	a.addRR(RDX, RBP);
+	for (int p = 0; p < P; p++) {
+		for (int b = 0; b < nBlocks; b++) {
+			a.vmovupsStore(p * nBlocks + b, RDX, b ? R15 : -1, p * CB * 4);
+		}
+	}
+
+	a.addRI(RBP, P * CB * 4);
+	a.dec(RCX);
+	a.jnz(stripLoop);
+
+	a.vzeroupper();
+#if defined(_WIN32)
+	for (int i = 0; i < 10; i++) {
+		a.vmovupsLoad(6 + i, RSP, -1, i * 16, 0);
+	}
+	a.addRI(RSP, savedXmmBytes);
+#endif
+	for (int i = nSavedRegisters - 1; i >= 0; i--) {
+		a.pop(savedRegisters[i]);
+	}
+	a.ret();
+}
+
+unsigned char *allocateWritable(size_t size)
+{
+#if defined(_WIN32)
+	return static_cast<unsigned char *>(VirtualAlloc(nullptr, size,
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (p == MAP_FAILED) ? nullptr : static_cast<unsigned char *>(p);
+#endif
+}
+
+// writable -> executable, never both
+bool makeExecutable(unsigned char *memory, size_t size)
+{
+#if defined(_WIN32)
+	DWORD oldProtection;
+	return VirtualProtect(memory, size, PAGE_EXECUTE_READ, &oldProtection) != 0;
+#else
+	return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+void release(unsigned char *memory, size_t size)
+{
+#if defined(_WIN32)
+	(void)size;
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
+
+// kernels of the process, kept until it exits
+std::mutex cacheMutex;
+std::vector<std::shared_ptr<FilterJITKernel> > cache;
+
+}
+
+FilterJITKernel::~FilterJITKernel()
+{
+	if (memory) {
+		release(memory, memorySize);
+	}
+}
+
+bool filterJITAvailable()
+{
+	std::string name = filterKernels().name;
+	return name == "avx2" || name.compare(0, 6, "avx512") == 0;
+}
+
+std::shared_ptr<FilterJITKernel> filterJITCompile(const float *packedWeights,
+	const float *packedBiases, int nInputPlanes, int nOutputPlanes)
+{
+	if (!filterJITAvailable() || nOutputPlanes < CB) {
+		return nullptr;
+	}
+
+	int nBlocks = (nOutputPlanes + CB - 1) / CB;
+	size_t nWeights = static_cast<size_t>(nBlocks) * nInputPlanes * 9 * CB;
+	size_t nBiases = static_cast<size_t>(nBlocks) * CB;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+
+	for (auto& cached : cache) {
+		if (cached->nInputPlanes == nInputPlanes
+				&& cached->nOutputPlanes == nOutputPlanes
+				&& std::memcmp(cached->weights, packedWeights,
+					nWeights * sizeof(float)) == 0
+				&& std::memcmp(cached->biases, packedBiases,
+					nBiases * sizeof(float)) == 0) {
+			return cached;
+		}
+	}
+
+	// about 12 accumulator registers, as convolveBlockedRow
+	Assembler a;
+	std::shared_ptr<FilterJITKernel> kernel(new FilterJITKernel());
+	size_t offsets[4];
+	for (int b = 0; b < 2; b++) {
+		kernel->stripPixels[b] = 12 / (b + 1);
+		offsets[b * 2] = a.size();
+		emitFunction(a, nInputPlanes, b + 1, kernel->stripPixels[b], false);
+		offsets[b * 2 + 1] = a.size();
+		emitFunction(a, nInputPlanes, b + 1, 1, true);
+	}
+
+	size_t poolOffset = (a.size() + 63) / 64 * 64;
+	size_t size = poolOffset + (nWeights + nBiases) * sizeof(float);
+	unsigned char *memory = allocateWritable(size);
+	if (!memory) {
+		return nullptr;
+	}
+	kernel->memory = memory;
+	kernel->memorySize = size;
+	kernel->codeSize = a.size();
+	kernel->nInputPlanes = nInputPlanes;
+	kernel->nOutputPlanes = nOutputPlanes;
+
+	std::memcpy(memory, a.code.data(), a.size());
+	float *pool = reinterpret_cast<float *>(memory + poolOffset);
+	std::copy(packedWeights, packedWeights + nWeights, pool);
+	std::copy(packedBiases, packedBiases + nBiases, pool + nWeights);
+	kernel->weights = pool;
+	kernel->biases = pool + nWeights;
+	if (!makeExecutable(memory, size)) {
+		return nullptr;
+	}
+
+	for (int b = 0; b < 2; b++) {
+		kernel->strip[b] = reinterpret_cast<JITFunction>(memory + offsets[b * 2]);
+		kernel->pixel[b] = reinterpret_cast<JITFunction>(
+			memory + offsets[b * 2 + 1]);
+	}
+
+	cache.push_back(kernel);
+	return kernel;
+}
+
+size_t filterJITCodeSize(const FilterJITKernel &kernel)
+{
+	return kernel.codeSize;
+}
+
+bool filterJITProcess(const FilterJITKernel &kernel, const float *input,
+	cv::Size size, float *output, int beginningBlock, int nOutputBlocks,
+	int beginningRow, int nRows)
+{
+	size_t rowStride = static_cast<size_t>(size.width) * CB;
+	size_t blockStride = rowStride * size.height;
+	size_t weightStride = static_cast<size_t>(kernel.nInputPlanes) * 9 * CB;
+
+	JITArgs args;
+	args.blockStride = blockStride * sizeof(float);
+	args.slope = 0.1f;
+
+	for (int y = beginningRow; y < beginningRow + nRows; y++) {
+		const float *rows[3];
+		for (int ky = 0; ky < 3; ky++) {
+			int yy = std::min(std::max(y - 1 + ky, 0), size.height - 1);
+			rows[ky] = input + yy * rowStride;
+		}
+
+		// output blocks in pairs, the odd one alone
+		for (int block = beginningBlock;
+				block < beginningBlock + nOutputBlocks; block += 2) {
+			int b = std::min(2, beginningBlock + nOutputBlocks - block) - 1;
+			float *dst = output + block * blockStride + y * rowStride;
+			args.weights = kernel.weights + block * weightStride;
+			args.bias = kernel.biases + block * CB;
+
+			// strips of the columns which need no clamping, from x = 1
+			int P = kernel.stripPixels[b];
+			int nStrips = std::max(size.width - 2, 0) / P;
+			if (nStrips > 0) {
+				for (int ky = 0; ky < 3; ky++) {
+					args.rows[ky] = rows[ky];
+				}
+				args.dst = dst + CB;
+				args.nStrips = nStrips;
+				kernel.strip[b](&args);
+			}
+
+			// the other pixels one by one
+			args.nStrips = 1;
+			for (int ky = 0; ky < 3; ky++) {
+				args.rows[ky] = rows[ky];
+			}
+			for (int x = 0; x < size.width;
+					x = (x == 0) ? 1 + nStrips * P : x + 1) {
+				for (int kx = 0; kx < 3; kx++) {
+					int xx = std::min(std::max(x - 1 + kx, 0), size.width - 1);
+					args.columns[kx] = xx * CB * sizeof(float);
+				}
+				args.dst = dst + x * CB;
+				kernel.pixel[b](&args);
+			}
+		}
+	}
+
+	return true;
+}
+
+#else
+
+FilterJITKernel::~FilterJITKernel()
+{
+}
+
+bool filterJITAvailable()
+{
+	return false;
+}
+
+std::shared_ptr<FilterJITKernel> filterJITCompile(const float *, const float *,
+	int, int)
+{
+	return nullptr;
+}
+
+size_t filterJITCodeSize(const FilterJITKernel &kernel)
+{
+	return kernel.codeSize;
+}
+
+bool filterJITProcess(const FilterJITKernel &, const float *, cv::Size,
+	float *, int, int, int, int)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,43 @@
+
+#ifndef FILTER_JIT_H_
+#define FILTER_JIT_H_
+
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+// Layer kernels generated at runtime for the NCHW8c cpu engine
+// (filterCPUBlocked.h) : x86-64 machine code with AVX2 + FMA.
+// Once the weights of a layer are packed, the code of its 3x3 convolution
+// + bias + leaky ReLU is emitted for the exact number of input planes :
+// the 8 channels x 3x3 taps of an input block are unrolled with constant
+// offsets, the loop over the input blocks has a constant trip count and
+// the weights and biases are a constant pool of the code buffer.
+// The block loop is not unrolled on purpose : the unrolled body of a
+// 128 plane layer is ~150 KB of code, which the decoders can't feed.
+// Kernels are cached for the process by shape and weights, so models
+// which are loaded again (scale iterations, modes) reuse them.
+
+// generated kernel of a layer (opaque)
+struct FilterJITKernel;
+
+// true if kernels can be generated : x86-64 and the selected cpu kernels
+// (filterKernels.h) use AVX2 or wider
+bool filterJITAvailable();
+
+// kernel of a nInputPlanes -> nOutputPlanes layer (nOutputPlanes >= 8)
+// with weights and biases packed by filterCPUBlockedPackWeights.
+// nullptr if the JIT is not available for it.
+std::shared_ptr<FilterJITKernel> filterJITCompile(const float *packedWeights,
+	const float *packedBiases, int nInputPlanes, int nOutputPlanes);
+
+// bytes of machine code of kernel (without the constant pool)
+size_t filterJITCodeSize(const FilterJITKernel &kernel);
+
+// rows [beginningRow, beginningRow + nRows) of the output blocks
+// [beginningBlock, beginningBlock + nOutputBlocks), same arguments as
+// filterCPUBlockedProcess otherwise. input and output point to block 0.
+bool filterJITProcess(const FilterJITKernel &kernel, const float *input,
+	cv::Size size, float *output, int beginningBlock, int nOutputBlocks,
+	int beginningRow, int nRows);
+
+#endif
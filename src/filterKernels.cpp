@@ -0,0 +1,137 @@
+#include "filterKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define FILTER_KERNELS_X86
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#endif
+
+namespace {
+
+struct CPUFeatures
+{
+	bool sse2;
+	bool avx2;
+	bool avx512;
+	bool avx512vnni;
+	bool neon;
+};
+
+#if defined(FILTER_KERNELS_X86)
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, subleaf);
+	for (int i = 0; i < 4; i++) {
+		regs[i] = static_cast<unsigned int>(r[i]);
+	}
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// register state the OS saves on context switches (XCR0)
+static unsigned long long xgetbv0()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+static CPUFeatures detectFeatures()
+{
+	CPUFeatures features = { false, false, false, false, false };
+
+#if defined(FILTER_KERNELS_X86)
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+
+	cpuid(1, 0, regs);
+	features.sse2 = (regs[3] & (1u << 26)) != 0;
+	bool fma = (regs[2] & (1u << 12)) != 0;
+	bool f16c = (regs[2] & (1u << 29)) != 0;
+	bool osxsave = (regs[2] & (1u << 27)) != 0;
+	bool avx = (regs[2] & (1u << 28)) != 0;
+
+	// ymm (bits 1, 2) and zmm / opmask state (bits 5 - 7) enabled by the OS
+	unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+	bool ymmState = (xcr0 & 0x06) == 0x06;
+	bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+	if (maxLeaf >= 7) {
+		cpuid(7, 0, regs);
+		features.avx2 = avx && fma && f16c && ymmState
+			&& (regs[1] & (1u << 5)) != 0;
+		features.avx512 = features.avx2 && zmmState && (regs[1] & (1u << 16)) != 0;
+		// AVX512BW, AVX512VL (256 bit forms) and AVX512_VNNI
+		features.avx512vnni = features.avx512 && (regs[1] & (1u << 30)) != 0
+			&& (regs[1] & (1u << 31)) != 0 && (regs[2] & (1u << 11)) != 0;
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+	// NEON is part of the baseline the binary is built for
+	features.neon = true;
+#endif
+
+	return features;
+}
+
+struct Variant
+{
+	const char *name;
+	const FilterKernels *(*kernels)();
+	bool CPUFeatures::*feature;
+};
+
+// widest first
+const Variant variants[] = {
+	{ "avx512vnni", &filterKernelsAVX512VNNI, &CPUFeatures::avx512vnni },
+	{ "avx512", &filterKernelsAVX512, &CPUFeatures::avx512 },
+	{ "avx2", &filterKernelsAVX2, &CPUFeatures::avx2 },
+	{ "sse", &filterKernelsSSE, &CPUFeatures::sse2 },
+	{ "neon", &filterKernelsNEON, &CPUFeatures::neon },
+	{ "scalar", &filterKernelsScalar, nullptr },
+};
+
+const FilterKernels *selectedKernels = nullptr;
+
+}
+
+bool filterKernelsSelect(const std::string &name)
+{
+	CPUFeatures features = detectFeatures();
+
+	for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+		const Variant &variant = variants[i];
+		if (name != "auto" && name != variant.name) {
+			continue;
+		}
+		const FilterKernels *kernels = variant.kernels();
+		if (kernels && (!variant.feature || features.*variant.feature)) {
+			selectedKernels = kernels;
+			return true;
+		}
+		if (name != "auto") {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+const FilterKernels &filterKernels()
+{
+	if (!selectedKernels) {
+		filterKernelsSelect("auto");
+	}
+	return *selectedKernels;
+}
@@ -0,0 +1,115 @@
+
+#ifndef FILTER_KERNELS_H_
+#define FILTER_KERNELS_H_
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
+#include "filterCPUBlocked.h"
+#include "filterINT8.h"
+
+// Instruction set variants of the cpu convolution kernels
+// (filterCPU.h, filterCPUBlocked.h, filterGEMM.h, filterWinograd.h and
+// filterINT8.h).
+// filterKernels<ISA>.cpp compiles the kernel bodies (*.inl) for one
+// instruction set each. The widest variant the processor supports is
+// selected at startup and the kernel functions forward to its table.
+// Only the kernel bodies are compiled for the instruction set (target
+// pragmas on GCC / clang), everything included before them is compiled for
+// the baseline of the build, so shared inline code never requires more.
+
+struct FilterKernels
+{
+	const char *name;
+
+	bool (*cpuProcess)(std::vector<cv::Mat> &inputPlanes,
+		const float *weights, float bias, cv::Mat &outputPlane,
+		int beginningRow, int nRows);
+	void (*cpuProcessRow)(const float * const *rows, int nInputPlanes,
+		int width, const float *weights, float bias, float *outputRow);
+	int (*cpuOutputBlock)();
+	void (*cpuPackWeights)(const std::vector<cv::Mat> &weightMatrices,
+		int nInputPlanes, int nOutputPlanes, AlignedBuffer &packedWeights);
+	bool (*cpuProcessBlock)(std::vector<cv::Mat> &inputPlanes,
+		const float *weights, const float *biases, cv::Mat *outputPlanes,
+		int beginningRow, int nRows);
+	void (*cpuProcessRowBlock)(const float * const *rows, int nInputPlanes,
+		int width, const float *weights, const float *biases,
+		float * const *outputRows);
+
+	int (*cpuBlockedChannels)();
+	void (*cpuBlockedPackWeights)(const std::vector<cv::Mat> &weightMatrices,
+		const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+		AlignedBuffer &packedWeights, AlignedBuffer &packedBiases);
+	bool (*cpuBlockedProcess)(const float *input, int nInputPlanes,
+		cv::Size size, const float *weights, const float *bias, float *output,
+		int nOutputBlocks, int beginningRow, int nRows);
+	bool (*cpuBlockedProcessNarrow)(const float *input, int nInputPlanes,
+		cv::Size size, const float *weights, const float *bias, float *output,
+		int nOutputPlanes, int beginningRow, int nRows);
+	FilterCPUBlockedKernel (*cpuBlockedSelectKernel)(int nInputPlanes,
+		int nOutputPlanes);
+	void (*cpuBlockedHalfToFloat)(const unsigned short *src, float *dst,
+		size_t n);
+	void (*cpuBlockedFloatToHalf)(const float *src, unsigned short *dst,
+		size_t n);
+	size_t (*cpuBlockedHalfScratchSize)(int nInputPlanes, int nOutputBlocks,
+		int width);
+	bool (*cpuBlockedProcessHalf)(FilterCPUBlockedKernel kernel,
+		const unsigned short *input, int nInputPlanes, cv::Size size,
+		const float *weights, const float *bias, unsigned short *output,
+		int nOutputs, int nOutputBlocks, int beginningRow, int nRows,
+		float *scratch);
+
+	int (*gemmBlockPixels)();
+	size_t (*gemmScratchSize)(int nInputPlanes, int kernelSize);
+	void (*gemmPackWeights)(const std::vector<cv::Mat> &weightMatrices,
+		int nInputPlanes, int nOutputPlanes, int kernelSize,
+		AlignedBuffer &packedWeights);
+	bool (*gemmProcess)(std::vector<cv::Mat> &inputPlanes,
+		const float *packedWeights, const float *biases, int kernelSize,
+		std::vector<cv::Mat> &outputPlanes,
+		int beginningPixel, int nPixels, float *scratch);
+
+	int (*winogradBlockTiles)();
+	size_t (*winogradScratchSize)(int nInputPlanes, int nOutputPlanes);
+	int (*winogradNumberOfTiles)(cv::Size size);
+	void (*winogradTransformWeights)(const std::vector<cv::Mat> &weightMatrices,
+		int nInputPlanes, int nOutputPlanes,
+		AlignedBuffer &transformedWeights);
+	bool (*winogradProcess)(std::vector<cv::Mat> &inputPlanes,
+		const float *transformedWeights, const float *biases,
+		std::vector<cv::Mat> &outputPlanes, int beginningTile, int nTiles,
+		float *scratch);
+
+	void (*int8PackWeights)(const std::vector<cv::Mat> &weightMatrices,
+		const std::vector<double> &biases, int nInputPlanes, int nOutputPlanes,
+		const FilterINT8Quantization &inputQuantization,
+		AlignedBuffer &packedWeights, AlignedBuffer &requantization);
+	bool (*int8Process)(const unsigned char *input, int nInputPlanes,
+		cv::Size size, const float *weights, const float *requantization,
+		void *output, const FilterINT8Quantization *outputQuantization,
+		int nOutputBlocks, int beginningRow, int nRows);
+};
+
+// kernel table of each instruction set,
+// nullptr if the variant is not built for this target
+const FilterKernels *filterKernelsScalar();
+const FilterKernels *filterKernelsSSE();
+const FilterKernels *filterKernelsAVX2();
+const FilterKernels *filterKernelsAVX512();
+const FilterKernels *filterKernelsAVX512VNNI();
+const FilterKernels *filterKernelsNEON();
+
+// select the kernels by name : "auto" (widest variant the processor
+// supports), "avx512vnni", "avx512", "avx2", "sse", "neon" or "scalar".
+// returns false if the variant is unknown, not built or not supported.
+// packed weights depend on the variant, select before loading models.
+bool filterKernelsSelect(const std::string &name);
+
+// the selected kernels, "auto" is selected on first use
+const FilterKernels &filterKernels();
+
+#endif
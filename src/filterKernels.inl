@@ -0,0 +1,48 @@
+// kernel table of one instruction set, included by filterKernels<ISA>.cpp
+// after FILTER_CPU_<ISA>, FILTER_KERNELS_NAMESPACE and FILTER_KERNELS_NAME
+// are defined
+
+#include "filterCPU.inl"
+#include "filterCPUBlocked.inl"
+#include "filterGEMM.inl"
+#include "filterWinograd.inl"
+#include "filterINT8.inl"
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+const FilterKernels table = {
+	FILTER_KERNELS_NAME,
+
+	&filterCPUProcess,
+	&filterCPUProcessRow,
+	&filterCPUOutputBlock,
+	&filterCPUPackWeights,
+	&filterCPUProcessBlock,
+	&filterCPUProcessRowBlock,
+
+	&filterCPUBlockedChannels,
+	&filterCPUBlockedPackWeights,
+	&filterCPUBlockedProcess,
+	&filterCPUBlockedProcessNarrow,
+	&filterCPUBlockedSelectKernel,
+	&filterCPUBlockedHalfToFloat,
+	&filterCPUBlockedFloatToHalf,
+	&filterCPUBlockedHalfScratchSize,
+	&filterCPUBlockedProcessHalf,
+
+	&filterGEMMBlockPixels,
+	&filterGEMMScratchSize,
+	&filterGEMMPackWeights,
+	&filterGEMMProcess,
+
+	&filterWinogradBlockTiles,
+	&filterWinogradScratchSize,
+	&filterWinogradNumberOfTiles,
+	&filterWinogradTransformWeights,
+	&filterWinogradProcess,
+
+	&filterINT8PackWeights,
+	&filterINT8Process,
+};
+
+}
@@ -0,0 +1,40 @@
+// AVX2 + FMA + F16C variant of the cpu kernels (see filterKernels.h)
+
+#include <algorithm>
+#include "filterKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+#define FILTER_CPU_AVX2
+#define FILTER_KERNELS_NAMESPACE kernelsAVX2
+#define FILTER_KERNELS_NAME "avx2"
+#include "filterKernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+const FilterKernels *filterKernelsAVX2()
+{
+	return &kernelsAVX2::table;
+}
+
+#else
+
+const FilterKernels *filterKernelsAVX2()
+{
+	return nullptr;
+}
+
+#endif
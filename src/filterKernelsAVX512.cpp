@@ -0,0 +1,44 @@
+// AVX-512F variant of the cpu kernels (see filterKernels.h).
+// its GEMM and Winograd paths use 16 wide vectors, the blocked kernels
+// stay at the 8 channels of a block (AVX2)
+
+#include <algorithm>
+#include "filterKernels.h"
+
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)) && \
+	(!defined(_MSC_VER) || _MSC_VER >= 1910)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx2,fma,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma,f16c")
+#endif
+
+#define FILTER_CPU_AVX512
+#define FILTER_CPU_AVX2
+#define FILTER_KERNELS_NAMESPACE kernelsAVX512
+#define FILTER_KERNELS_NAME "avx512"
+#include "filterKernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+const FilterKernels *filterKernelsAVX512()
+{
+	return &kernelsAVX512::table;
+}
+
+#else
+
+const FilterKernels *filterKernelsAVX512()
+{
+	return nullptr;
+}
+
+#endif
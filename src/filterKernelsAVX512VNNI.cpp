@@ -0,0 +1,46 @@
+// AVX-512F + VNNI variant of the cpu kernels (see filterKernels.h).
+// the float kernels are those of the avx512 variant, the int8 kernel
+// sums its products with vpdpbusd (256 bit form of AVX512VL)
+
+#include <algorithm>
+#include "filterKernels.h"
+
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)) && \
+	(!defined(_MSC_VER) || _MSC_VER >= 1920) && \
+	(!defined(__GNUC__) || defined(__clang__) || __GNUC__ >= 8)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni,avx2,fma,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vl,avx512vnni,avx2,fma,f16c")
+#endif
+
+#define FILTER_CPU_AVX512
+#define FILTER_CPU_AVX2
+#define FILTER_CPU_VNNI
+#define FILTER_KERNELS_NAMESPACE kernelsAVX512VNNI
+#define FILTER_KERNELS_NAME "avx512vnni"
+#include "filterKernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+const FilterKernels *filterKernelsAVX512VNNI()
+{
+	return &kernelsAVX512VNNI::table;
+}
+
+#else
+
+const FilterKernels *filterKernelsAVX512VNNI()
+{
+	return nullptr;
+}
+
+#endif
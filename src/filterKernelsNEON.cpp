@@ -0,0 +1,31 @@
+// NEON variant of the cpu kernels (see filterKernels.h)
+
+#include <algorithm>
+#include "filterKernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#else
+#include <arm_neon.h>
+#endif
+
+#define FILTER_CPU_NEON
+#define FILTER_KERNELS_NAMESPACE kernelsNEON
+#define FILTER_KERNELS_NAME "neon"
+#include "filterKernels.inl"
+
+const FilterKernels *filterKernelsNEON()
+{
+	return &kernelsNEON::table;
+}
+
+#else
+
+const FilterKernels *filterKernelsNEON()
+{
+	return nullptr;
+}
+
+#endif
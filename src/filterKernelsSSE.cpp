@@ -0,0 +1,40 @@
+// SSE2 variant of the cpu kernels (see filterKernels.h)
+
+#include <algorithm>
+#include "filterKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+#define FILTER_CPU_SSE
+#define FILTER_KERNELS_NAMESPACE kernelsSSE
+#define FILTER_KERNELS_NAME "sse"
+#include "filterKernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+const FilterKernels *filterKernelsSSE()
+{
+	return &kernelsSSE::table;
+}
+
+#else
+
+const FilterKernels *filterKernelsSSE()
+{
+	return nullptr;
+}
+
+#endif
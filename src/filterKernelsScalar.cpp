@@ -0,0 +1,14 @@
+// portable C++ variant of the cpu kernels (see filterKernels.h),
+// the fallback on every target
+
+#include <algorithm>
+#include "filterKernels.h"
+
+#define FILTER_KERNELS_NAMESPACE kernelsScalar
+#define FILTER_KERNELS_NAME "scalar"
+#include "filterKernels.inl"
+
+const FilterKernels *filterKernelsScalar()
+{
+	return &kernelsScalar::table;
+}
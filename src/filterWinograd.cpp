@@ -0,0 +1,34 @@
+#include "filterWinograd.h"
+#include "filterKernels.h"
+
+int filterWinogradBlockTiles()
+{
+	return filterKernels().winogradBlockTiles();
+}
+
+size_t filterWinogradScratchSize(int nInputPlanes, int nOutputPlanes)
+{
+	return filterKernels().winogradScratchSize(nInputPlanes, nOutputPlanes);
+}
+
+int filterWinogradNumberOfTiles(cv::Size size)
+{
+	return filterKernels().winogradNumberOfTiles(size);
+}
+
+void filterWinogradTransformWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &transformedWeights)
+{
+	filterKernels().winogradTransformWeights(weightMatrices, nInputPlanes,
+		nOutputPlanes, transformedWeights);
+}
+
+bool filterWinogradProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *transformedWeights, const float *biases,
+	std::vector<cv::Mat> &outputPlanes, int beginningTile, int nTiles,
+	float *scratch)
+{
+	return filterKernels().winogradProcess(inputPlanes, transformedWeights,
+		biases, outputPlanes, beginningTile, nTiles, scratch);
+}
@@ -0,0 +1,38 @@
+
+#ifndef FILTER_WINOGRAD_H_
+#define FILTER_WINOGRAD_H_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "alignedBuffer.h"
+
+// Winograd F(4x4, 3x3) convolution of a layer with 3x3 kernels.
+// The output is computed in 4x4 tiles from 6x6 input tiles :
+//   Y = A^T [ sum_ip (G g G^T) .* (B^T d B) ] A
+// The element-wise products of all 36 positions are 36 small GEMMs
+// (nOutputPlanes x nInputPlanes) * (nInputPlanes x tiles).
+
+// number of tiles handled by one filterWinogradProcess call at most
+int filterWinogradBlockTiles();
+
+// floats of scratch memory filterWinogradProcess needs
+size_t filterWinogradScratchSize(int nInputPlanes, int nOutputPlanes);
+
+// number of 4x4 output tiles of a plane
+int filterWinogradNumberOfTiles(cv::Size size);
+
+// G g G^T of every 3x3 weight matrix, layout (36, nOutputPlanes, nInputPlanes)
+void filterWinogradTransformWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &transformedWeights);
+
+// convolution + bias + leaky ReLU of the tiles
+// [beginningTile, beginningTile + nTiles) (row major over the tile grid).
+// nTiles must not exceed filterWinogradBlockTiles(),
+// scratch holds filterWinogradScratchSize() floats.
+bool filterWinogradProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *transformedWeights, const float *biases,
+	std::vector<cv::Mat> &outputPlanes, int beginningTile, int nTiles,
+	float *scratch);
+
+#endif
@@ -0,0 +1,233 @@
+// kernel bodies of filterWinograd.h, compiled once per instruction set inside
+// FILTER_KERNELS_NAMESPACE by filterKernels<ISA>.cpp (see filterKernels.h)
+
+#include "filterCPUSIMD.h"
+
+namespace FILTER_KERNELS_NAMESPACE {
+
+namespace {
+
+const int TILE = 4;		// output tile size
+const int ALPHA = 6;	// input tile size (TILE + 3 - 1)
+const int NPOS = ALPHA * ALPHA;
+
+// register block of the GEMMs : MRW output planes x NT tiles.
+// a block of NB tiles shares the weight rows loaded into L1.
+const int MRW = 4;
+const int NT = VecNative::width * 2;
+const int NB = NT * (VecNative::width > 8 ? 2 : 4);
+
+// v = G g  (3 -> 6), strided
+static void weightTransform1D(const float *g, int gStride, float *v, int vStride)
+{
+	float g0 = g[0], g1 = g[gStride], g2 = g[gStride * 2];
+	v[0 * vStride] = g0 / 4.0f;
+	v[1 * vStride] = -(g0 + g1 + g2) / 6.0f;
+	v[2 * vStride] = -(g0 - g1 + g2) / 6.0f;
+	v[3 * vStride] = g0 / 24.0f + g1 / 12.0f + g2 / 6.0f;
+	v[4 * vStride] = g0 / 24.0f - g1 / 12.0f + g2 / 6.0f;
+	v[5 * vStride] = g2;
+}
+
+// v = B^T d  (6 -> 6), strided
+static void inputTransform1D(const float *d, int dStride, float *v, int vStride)
+{
+	float d0 = d[0], d1 = d[dStride], d2 = d[dStride * 2];
+	float d3 = d[dStride * 3], d4 = d[dStride * 4], d5 = d[dStride * 5];
+	v[0 * vStride] = 4.0f * d0 - 5.0f * d2 + d4;
+	v[1 * vStride] = -4.0f * d1 - 4.0f * d2 + d3 + d4;
+	v[2 * vStride] = 4.0f * d1 - 4.0f * d2 - d3 + d4;
+	v[3 * vStride] = -2.0f * d1 - d2 + 2.0f * d3 + d4;
+	v[4 * vStride] = 2.0f * d1 - d2 - 2.0f * d3 + d4;
+	v[5 * vStride] = 4.0f * d1 - 5.0f * d3 + d5;
+}
+
+// v = A^T m  (6 -> 4), strided
+static void outputTransform1D(const float *m, int mStride, float *v, int vStride)
+{
+	float m0 = m[0], m1 = m[mStride], m2 = m[mStride * 2];
+	float m3 = m[mStride * 3], m4 = m[mStride * 4], m5 = m[mStride * 5];
+	v[0 * vStride] = m0 + m1 + m2 + m3 + m4;
+	v[1 * vStride] = m1 - m2 + 2.0f * m3 - 2.0f * m4;
+	v[2 * vStride] = m1 + m2 + 4.0f * m3 + 4.0f * m4;
+	v[3 * vStride] = m1 - m2 + 8.0f * m3 - 8.0f * m4 + m5;
+}
+
+// m(op, NT) = u(op, ip) * v(ip, NT) for nRows output planes,
+// rows of v and m are NB floats apart
+template <class V, int nRows>
+static void multiplyRows(int nInputPlanes, const float *u, const float *v, float *m)
+{
+	typename V::Reg acc[nRows][2];
+	for (int i = 0; i < nRows; i++) {
+		acc[i][0] = V::set1(0.0f);
+		acc[i][1] = V::set1(0.0f);
+	}
+
+	for (int ip = 0; ip < nInputPlanes; ip++) {
+		typename V::Reg v0 = V::load(v + ip * NB);
+		typename V::Reg v1 = V::load(v + ip * NB + V::width);
+		for (int i = 0; i < nRows; i++) {
+			typename V::Reg ui = V::set1(u[i * nInputPlanes + ip]);
+			acc[i][0] = V::fmadd(ui, v0, acc[i][0]);
+			acc[i][1] = V::fmadd(ui, v1, acc[i][1]);
+		}
+	}
+
+	for (int i = 0; i < nRows; i++) {
+		V::store(m + i * NB, acc[i][0]);
+		V::store(m + i * NB + V::width, acc[i][1]);
+	}
+}
+
+}
+
+int filterWinogradBlockTiles()
+{
+	return NB;
+}
+
+size_t filterWinogradScratchSize(int nInputPlanes, int nOutputPlanes)
+{
+	return static_cast<size_t>(NPOS) * (nInputPlanes + nOutputPlanes) * NB;
+}
+
+int filterWinogradNumberOfTiles(cv::Size size)
+{
+	return ((size.width + TILE - 1) / TILE) * ((size.height + TILE - 1) / TILE);
+}
+
+void filterWinogradTransformWeights(const std::vector<cv::Mat> &weightMatrices,
+	int nInputPlanes, int nOutputPlanes,
+	AlignedBuffer &transformedWeights)
+{
+	transformedWeights.resize(NPOS * nOutputPlanes * nInputPlanes);
+
+	for (int op = 0; op < nOutputPlanes; op++) {
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			const cv::Mat &weightMatrix = weightMatrices[op * nInputPlanes + ip];
+			float g[3 * 3], tmp[ALPHA * 3], u[NPOS];
+			for (int t = 0; t < 3 * 3; t++) {
+				g[t] = weightMatrix.at<float>(t / 3, t % 3);
+			}
+			// G g : columns, then (G g) G^T : rows
+			for (int col = 0; col < 3; col++) {
+				weightTransform1D(g + col, 3, tmp + col, 3);
+			}
+			for (int row = 0; row < ALPHA; row++) {
+				weightTransform1D(tmp + row * 3, 1, u + row * ALPHA, 1);
+			}
+			for (int pos = 0; pos < NPOS; pos++) {
+				transformedWeights[(pos * nOutputPlanes + op) * nInputPlanes + ip] = u[pos];
+			}
+		}
+	}
+}
+
+bool filterWinogradProcess(std::vector<cv::Mat> &inputPlanes,
+	const float *transformedWeights, const float *biases,
+	std::vector<cv::Mat> &outputPlanes, int beginningTile, int nTiles,
+	float *scratch)
+{
+	int nInputPlanes = (int)inputPlanes.size();
+	int nOutputPlanes = (int)outputPlanes.size();
+	cv::Size size = inputPlanes[0].size();
+	int tilesX = (size.width + TILE - 1) / TILE;
+
+	if (nTiles > NB) {
+		return false;
+	}
+
+	// transformed input (pos, ip, NB) and products (pos, op, NB)
+	float *v = scratch;
+	float *m = scratch + NPOS * nInputPlanes * NB;
+	if (nTiles < NB) {
+		// the tail columns of a partial block go through the GEMMs too
+		std::fill(v, v + NPOS * nInputPlanes * NB, 0.0f);
+	}
+	int nChunks = (nTiles + NT - 1) / NT;
+
+	// input transform B^T d B, borders replicated
+	for (int t = 0; t < nTiles; t++) {
+		int tileY = (beginningTile + t) / tilesX * TILE;
+		int tileX = (beginningTile + t) % tilesX * TILE;
+		int xs[ALPHA];
+		for (int j = 0; j < ALPHA; j++) {
+			xs[j] = std::min(std::max(tileX - 1 + j, 0), size.width - 1);
+		}
+
+		for (int ip = 0; ip < nInputPlanes; ip++) {
+			float d[NPOS], tmp[NPOS], vt[NPOS];
+			for (int i = 0; i < ALPHA; i++) {
+				int y = std::min(std::max(tileY - 1 + i, 0), size.height - 1);
+				const float *src = inputPlanes[ip].ptr<float>(y);
+				for (int j = 0; j < ALPHA; j++) {
+					d[i * ALPHA + j] = src[xs[j]];
+				}
+			}
+			for (int col = 0; col < ALPHA; col++) {
+				inputTransform1D(d + col, ALPHA, tmp + col, ALPHA);
+			}
+			for (int row = 0; row < ALPHA; row++) {
+				inputTransform1D(tmp + row * ALPHA, 1, vt + row * ALPHA, 1);
+			}
+			for (int pos = 0; pos < NPOS; pos++) {
+				v[(pos * nInputPlanes + ip) * NB + t] = vt[pos];
+			}
+		}
+	}
+
+	// element-wise products summed over the input planes
+	for (int pos = 0; pos < NPOS; pos++) {
+		const float *u = transformedWeights + pos * nOutputPlanes * nInputPlanes;
+		const float *vp = v + pos * nInputPlanes * NB;
+		float *mp = m + pos * nOutputPlanes * NB;
+
+		int op = 0;
+		for (; op + MRW <= nOutputPlanes; op += MRW) {
+			for (int chunk = 0; chunk < nChunks; chunk++) {
+				multiplyRows<VecNative, MRW>(nInputPlanes, u + op * nInputPlanes,
+					vp + chunk * NT, mp + op * NB + chunk * NT);
+			}
+		}
+		for (; op < nOutputPlanes; op++) {
+			for (int chunk = 0; chunk < nChunks; chunk++) {
+				multiplyRows<VecNative, 1>(nInputPlanes, u + op * nInputPlanes,
+					vp + chunk * NT, mp + op * NB + chunk * NT);
+			}
+		}
+	}
+
+	// output transform A^T m A, bias and leaky ReLU
+	for (int t = 0; t < nTiles; t++) {
+		int tileY = (beginningTile + t) / tilesX * TILE;
+		int tileX = (beginningTile + t) % tilesX * TILE;
+		int rows = std::min(TILE, size.height - tileY);
+		int cols = std::min(TILE, size.width - tileX);
+
+		for (int op = 0; op < nOutputPlanes; op++) {
+			float mt[NPOS], tmp[TILE * ALPHA], y[TILE * TILE];
+			for (int pos = 0; pos < NPOS; pos++) {
+				mt[pos] = m[(pos * nOutputPlanes + op) * NB + t];
+			}
+			for (int col = 0; col < ALPHA; col++) {
+				outputTransform1D(mt + col, ALPHA, tmp + col, ALPHA);
+			}
+			for (int row = 0; row < TILE; row++) {
+				outputTransform1D(tmp + row * ALPHA, 1, y + row * TILE, 1);
+			}
+
+			float bias = biases[op];
+			for (int row = 0; row < rows; row++) {
+				float *dst = outputPlanes[op].ptr<float>(tileY + row) + tileX;
+				for (int col = 0; col < cols; col++) {
+					dst[col] = VecScalar::leakyReLU(y[row * TILE + col] + bias);
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+}
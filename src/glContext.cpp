@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include "glContext.h"
+
+#if GL_CONTEXT_LOADER
+	#include <string.h>
+	#include <dlfcn.h>
+	#include <EGL/egl.h>
+	#include <EGL/eglext.h>
+#else
+	#include <GLFW/glfw3.h>
+#endif
+
+static GLContextBackend preferredBackend = GLContextAuto;
+static const char *contextName = nullptr;
+
+void glContextSetBackend(GLContextBackend backend)
+{
+	preferredBackend = backend;
+}
+
+const char *glContextName()
+{
+	return contextName;
+}
+
+#if GL_CONTEXT_LOADER
+
+#define GL_CONTEXT_DEFINE(type, name) type w2xc_##name = nullptr;
+GL_CONTEXT_FUNCTIONS(GL_CONTEXT_DEFINE)
+#undef GL_CONTEXT_DEFINE
+
+typedef void (*GLContextProc)();
+
+static bool loadFunctions(GLContextProc (*getProcAddress)(const char *))
+{
+	bool loaded = true;
+#define GL_CONTEXT_LOAD(type, name) \
+	w2xc_##name = reinterpret_cast<type>(getProcAddress(#name)); \
+	if (!w2xc_##name) { \
+		fprintf(stderr, "GL context : %s is missing\n", #name); \
+		loaded = false; \
+	}
+	GL_CONTEXT_FUNCTIONS(GL_CONTEXT_LOAD)
+#undef GL_CONTEXT_LOAD
+	return loaded;
+}
+
+// EGL
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+
+static GLContextProc eglProc(const char *name)
+{
+	return reinterpret_cast<GLContextProc>(eglGetProcAddress(name));
+}
+
+static bool hasExtension(const char *extensions, const char *name)
+{
+	size_t length = strlen(name);
+	for (const char *p = extensions; p && (p = strstr(p, name)); p += length) {
+		if ((p == extensions || p[-1] == ' ')
+				&& (p[length] == ' ' || p[length] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void destroyEGL()
+{
+	if (eglDisplay != EGL_NO_DISPLAY) {
+		eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			EGL_NO_CONTEXT);
+		if (eglSurface != EGL_NO_SURFACE) {
+			eglDestroySurface(eglDisplay, eglSurface);
+		}
+		if (eglContext != EGL_NO_CONTEXT) {
+			eglDestroyContext(eglDisplay, eglContext);
+		}
+		eglTerminate(eglDisplay);
+	}
+	eglDisplay = EGL_NO_DISPLAY;
+	eglContext = EGL_NO_CONTEXT;
+	eglSurface = EGL_NO_SURFACE;
+}
+
+static bool createEGL()
+{
+	// the surfaceless platform of Mesa needs neither X nor a GPU,
+	// the default display is the fallback of other implementations
+	const char *clientExtensions =
+		eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+			eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	if (getPlatformDisplay
+			&& hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+			EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (eglDisplay == EGL_NO_DISPLAY) {
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY
+			|| !eglInitialize(eglDisplay, &major, &minor)) {
+		eglDisplay = EGL_NO_DISPLAY;
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		destroyEGL();
+		return false;
+	}
+
+	// a pbuffer config, or any GL config when the context needs no surface
+	bool surfaceless = hasExtension(
+		eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+	const EGLint pbufferAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	const EGLint anyAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_DONT_CARE,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = nullptr;
+	EGLint nConfigs = 0;
+	bool pbuffer = eglChooseConfig(eglDisplay, pbufferAttributes, &config, 1,
+		&nConfigs) && nConfigs > 0;
+	if (!pbuffer && !(surfaceless && eglChooseConfig(eglDisplay,
+			anyAttributes, &config, 1, &nConfigs) && nConfigs > 0)) {
+		destroyEGL();
+		return false;
+	}
+
+	// 3.2 core, a compatibility context of the implementation otherwise
+	const EGLint coreAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 2,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+		EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+	eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT,
+		coreAttributes);
+	if (eglContext == EGL_NO_CONTEXT) {
+		eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT,
+			nullptr);
+	}
+	if (eglContext == EGL_NO_CONTEXT) {
+		destroyEGL();
+		return false;
+	}
+
+	if (surfaceless) {
+		contextName = "egl surfaceless";
+	} else {
+		const EGLint surfaceAttributes[] = {
+			EGL_WIDTH, 1,
+			EGL_HEIGHT, 1,
+			EGL_NONE
+		};
+		eglSurface = eglCreatePbufferSurface(eglDisplay, config,
+			surfaceAttributes);
+		contextName = "egl pbuffer";
+	}
+	if ((!surfaceless && eglSurface == EGL_NO_SURFACE)
+			|| !eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)
+			|| !loadFunctions(eglProc)) {
+		contextName = nullptr;
+		destroyEGL();
+		return false;
+	}
+	return true;
+}
+
+// OSMesa, loaded at run time so that the binary doesn't depend on it.
+// the values of GL/osmesa.h
+
+typedef struct osmesa_context *OSMesaContext;
+typedef OSMesaContext (*OSMesaCreateContextAttribsProc)(const int *,
+	OSMesaContext);
+typedef GLboolean (*OSMesaMakeCurrentProc)(OSMesaContext, void *, GLenum,
+	GLsizei, GLsizei);
+typedef void (*OSMesaDestroyContextProc)(OSMesaContext);
+typedef GLContextProc (*OSMesaGetProcAddressProc)(const char *);
+
+static const int OSMESA_FORMAT = 0x22;
+static const int OSMESA_DEPTH_BITS = 0x30;
+static const int OSMESA_PROFILE = 0x33;
+static const int OSMESA_CORE_PROFILE = 0x34;
+static const int OSMESA_CONTEXT_MAJOR_VERSION = 0x36;
+static const int OSMESA_CONTEXT_MINOR_VERSION = 0x37;
+
+static void *osmesaLibrary = nullptr;
+static OSMesaContext osmesaContext = nullptr;
+static OSMesaDestroyContextProc osmesaDestroyContext = nullptr;
+static OSMesaGetProcAddressProc osmesaGetProcAddress = nullptr;
+// the color buffer of OSMesaMakeCurrent, the engine renders to textures
+static unsigned char osmesaBuffer[4];
+
+static GLContextProc osmesaProc(const char *name)
+{
+	return osmesaGetProcAddress(name);
+}
+
+static void destroyOSMesa()
+{
+	if (osmesaContext) {
+		osmesaDestroyContext(osmesaContext);
+		osmesaContext = nullptr;
+	}
+	if (osmesaLibrary) {
+		dlclose(osmesaLibrary);
+		osmesaLibrary = nullptr;
+	}
+}
+
+static bool createOSMesa()
+{
+	const char *names[] = {"libOSMesa.so.8", "libOSMesa.so.6", "libOSMesa.so"};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]) && !osmesaLibrary; i++) {
+		osmesaLibrary = dlopen(names[i], RTLD_NOW | RTLD_LOCAL);
+	}
+	if (!osmesaLibrary) {
+		return false;
+	}
+
+	OSMesaCreateContextAttribsProc createContext =
+		reinterpret_cast<OSMesaCreateContextAttribsProc>(
+			dlsym(osmesaLibrary, "OSMesaCreateContextAttribs"));
+	OSMesaMakeCurrentProc makeCurrent = reinterpret_cast<OSMesaMakeCurrentProc>(
+		dlsym(osmesaLibrary, "OSMesaMakeCurrent"));
+	osmesaDestroyContext = reinterpret_cast<OSMesaDestroyContextProc>(
+		dlsym(osmesaLibrary, "OSMesaDestroyContext"));
+	osmesaGetProcAddress = reinterpret_cast<OSMesaGetProcAddressProc>(
+		dlsym(osmesaLibrary, "OSMesaGetProcAddress"));
+	if (!createContext || !makeCurrent || !osmesaDestroyContext
+			|| !osmesaGetProcAddress) {
+		destroyOSMesa();
+		return false;
+	}
+
+	const int attributes[] = {
+		OSMESA_FORMAT, GL_RGBA,
+		OSMESA_DEPTH_BITS, 0,
+		OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, 3,
+		OSMESA_CONTEXT_MINOR_VERSION, 2,
+		0
+	};
+	osmesaContext = createContext(attributes, nullptr);
+	if (!osmesaContext
+			|| !makeCurrent(osmesaContext, osmesaBuffer, GL_UNSIGNED_BYTE, 1, 1)
+			|| !loadFunctions(osmesaProc)) {
+		destroyOSMesa();
+		return false;
+	}
+	contextName = "osmesa";
+	return true;
+}
+
+bool glContextCreate()
+{
+	bool created = false;
+	if (preferredBackend == GLContextAuto || preferredBackend == GLContextEGL) {
+		created = createEGL();
+	}
+	if (!created && (preferredBackend == GLContextAuto
+			|| preferredBackend == GLContextOSMesa)) {
+		created = createOSMesa();
+	}
+	if (!created) {
+		fprintf(stderr, "Error : GL context : no EGL or OSMesa context "
+			"with OpenGL 3.2 (libEGL, Mesa llvmpipe)\n");
+	}
+	return created;
+}
+
+void glContextDestroy()
+{
+	destroyEGL();
+	destroyOSMesa();
+	contextName = nullptr;
+}
+
+#else
+
+// GLFW
+
+static GLFWwindow* window = nullptr;
+
+bool glContextCreate()
+{
+	if (preferredBackend != GLContextAuto && preferredBackend != GLContextGLFW) {
+		fprintf(stderr, "Error : GL context : only GLFW on this platform\n");
+		return false;
+	}
+	if (!glfwInit()) {
+		fprintf(stderr, "Error : GL context : glfwInit failed\n");
+		return false;
+	}
+
+#if __APPLE__
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#endif
+	glfwWindowHint(GLFW_VISIBLE, 0);
+	window = glfwCreateWindow(1, 1, "waifu2x-glsl", nullptr, nullptr);
+	if (!window) {
+		fprintf(stderr, "Error : GL context : no window with OpenGL 3.2\n");
+		glfwTerminate();
+		return false;
+	}
+
+	glfwMakeContextCurrent(window);
+
+#ifdef __glew_h__
+	GLenum glewResult = glewInit();
+	if (glewResult != GLEW_OK) {
+		fprintf(stderr, "Error : GL context : glewInit failed\n");
+		glContextDestroy();
+		return false;
+	}
+	glGetError();
+#endif
+
+	contextName = "glfw";
+	return true;
+}
+
+void glContextDestroy()
+{
+	glfwTerminate();
+	window = nullptr;
+	contextName = nullptr;
+}
+
+#endif
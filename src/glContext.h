@@ -0,0 +1,159 @@
+/*
+ * glContext.h
+ *   OpenGL context of the GL engine, without a window
+ *
+ *   Linux : a surfaceless EGL context (EGL_MESA_platform_surfaceless or
+ *   a 1x1 pbuffer), OSMesa loaded at run time if EGL fails. Both need no
+ *   X server and run on Mesa llvmpipe without a GPU. The GL entry points
+ *   are loaded from the backend (OSMesa has its own), the gl* names below
+ *   are macros of the loaded pointers, as with GLEW.
+ *   Windows, macOS : a hidden 1x1 GLFW window.
+ *   The context is OpenGL 3.2 core or compatible, for GLSL 1.40.
+ */
+
+#ifndef GL_CONTEXT_H_
+#define GL_CONTEXT_H_
+
+#if defined(_WIN32)
+	#include <GL/glew.h>
+#elif defined(__APPLE__)
+	#include <OpenGL/gl3.h>
+#else
+	// types and PFN typedefs only, no prototypes
+	#include <GL/glcorearb.h>
+	#define GL_CONTEXT_LOADER 1
+#endif
+
+enum GLContextBackend
+{
+	GLContextAuto,		// EGL then OSMesa (Linux), GLFW (Windows, macOS)
+	GLContextEGL,
+	GLContextOSMesa,
+	GLContextGLFW,
+};
+
+// backend of the next glContextCreate()
+void glContextSetBackend(GLContextBackend backend);
+
+// creates the context, makes it current on the calling thread and loads
+// the entry points. false (and a message on stderr) if no backend works
+bool glContextCreate();
+
+void glContextDestroy();
+
+// "egl surfaceless", "egl pbuffer", "osmesa", "glfw" of the current
+// context, nullptr without one
+const char *glContextName();
+
+#if GL_CONTEXT_LOADER
+
+#define GL_CONTEXT_FUNCTIONS(X) \
+	X(PFNGLACTIVETEXTUREPROC, glActiveTexture) \
+	X(PFNGLATTACHSHADERPROC, glAttachShader) \
+	X(PFNGLBINDATTRIBLOCATIONPROC, glBindAttribLocation) \
+	X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+	X(PFNGLBINDBUFFERRANGEPROC, glBindBufferRange) \
+	X(PFNGLBINDFRAGDATALOCATIONPROC, glBindFragDataLocation) \
+	X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+	X(PFNGLBINDTEXTUREPROC, glBindTexture) \
+	X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+	X(PFNGLBUFFERDATAPROC, glBufferData) \
+	X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+	X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+	X(PFNGLCREATESHADERPROC, glCreateShader) \
+	X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+	X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+	X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+	X(PFNGLDELETESHADERPROC, glDeleteShader) \
+	X(PFNGLDELETETEXTURESPROC, glDeleteTextures) \
+	X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays) \
+	X(PFNGLDISABLEPROC, glDisable) \
+	X(PFNGLDRAWARRAYSPROC, glDrawArrays) \
+	X(PFNGLDRAWBUFFERSPROC, glDrawBuffers) \
+	X(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray) \
+	X(PFNGLFINISHPROC, glFinish) \
+	X(PFNGLFRAMEBUFFERTEXTURELAYERPROC, glFramebufferTextureLayer) \
+	X(PFNGLGENBUFFERSPROC, glGenBuffers) \
+	X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
+	X(PFNGLGENTEXTURESPROC, glGenTextures) \
+	X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays) \
+	X(PFNGLGETERRORPROC, glGetError) \
+	X(PFNGLGETINTEGERVPROC, glGetIntegerv) \
+	X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+	X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+	X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+	X(PFNGLGETSTRINGPROC, glGetString) \
+	X(PFNGLGETUNIFORMBLOCKINDEXPROC, glGetUniformBlockIndex) \
+	X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+	X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+	X(PFNGLMAPBUFFERPROC, glMapBuffer) \
+	X(PFNGLREADPIXELSPROC, glReadPixels) \
+	X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+	X(PFNGLTEXIMAGE3DPROC, glTexImage3D) \
+	X(PFNGLTEXPARAMETERIPROC, glTexParameteri) \
+	X(PFNGLTEXSUBIMAGE3DPROC, glTexSubImage3D) \
+	X(PFNGLUNIFORM1IPROC, glUniform1i) \
+	X(PFNGLUNIFORMBLOCKBINDINGPROC, glUniformBlockBinding) \
+	X(PFNGLUNMAPBUFFERPROC, glUnmapBuffer) \
+	X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+	X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
+	X(PFNGLVIEWPORTPROC, glViewport)
+
+#define GL_CONTEXT_DECLARE(type, name) extern type w2xc_##name;
+GL_CONTEXT_FUNCTIONS(GL_CONTEXT_DECLARE)
+#undef GL_CONTEXT_DECLARE
+
+#define glActiveTexture w2xc_glActiveTexture
+#define glAttachShader w2xc_glAttachShader
+#define glBindAttribLocation w2xc_glBindAttribLocation
+#define glBindBuffer w2xc_glBindBuffer
+#define glBindBufferRange w2xc_glBindBufferRange
+#define glBindFragDataLocation w2xc_glBindFragDataLocation
+#define glBindFramebuffer w2xc_glBindFramebuffer
+#define glBindTexture w2xc_glBindTexture
+#define glBindVertexArray w2xc_glBindVertexArray
+#define glBufferData w2xc_glBufferData
+#define glCompileShader w2xc_glCompileShader
+#define glCreateProgram w2xc_glCreateProgram
+#define glCreateShader w2xc_glCreateShader
+#define glDeleteBuffers w2xc_glDeleteBuffers
+#define glDeleteFramebuffers w2xc_glDeleteFramebuffers
+#define glDeleteProgram w2xc_glDeleteProgram
+#define glDeleteShader w2xc_glDeleteShader
+#define glDeleteTextures w2xc_glDeleteTextures
+#define glDeleteVertexArrays w2xc_glDeleteVertexArrays
+#define glDisable w2xc_glDisable
+#define glDrawArrays w2xc_glDrawArrays
+#define glDrawBuffers w2xc_glDrawBuffers
+#define glEnableVertexAttribArray w2xc_glEnableVertexAttribArray
+#define glFinish w2xc_glFinish
+#define glFramebufferTextureLayer w2xc_glFramebufferTextureLayer
+#define glGenBuffers w2xc_glGenBuffers
+#define glGenFramebuffers w2xc_glGenFramebuffers
+#define glGenTextures w2xc_glGenTextures
+#define glGenVertexArrays w2xc_glGenVertexArrays
+#define glGetError w2xc_glGetError
+#define glGetIntegerv w2xc_glGetIntegerv
+#define glGetProgramiv w2xc_glGetProgramiv
+#define glGetShaderInfoLog w2xc_glGetShaderInfoLog
+#define glGetShaderiv w2xc_glGetShaderiv
+#define glGetString w2xc_glGetString
+#define glGetUniformBlockIndex w2xc_glGetUniformBlockIndex
+#define glGetUniformLocation w2xc_glGetUniformLocation
+#define glLinkProgram w2xc_glLinkProgram
+#define glMapBuffer w2xc_glMapBuffer
+#define glReadPixels w2xc_glReadPixels
+#define glShaderSource w2xc_glShaderSource
+#define glTexImage3D w2xc_glTexImage3D
+#define glTexParameteri w2xc_glTexParameteri
+#define glTexSubImage3D w2xc_glTexSubImage3D
+#define glUniform1i w2xc_glUniform1i
+#define glUniformBlockBinding w2xc_glUniformBlockBinding
+#define glUnmapBuffer w2xc_glUnmapBuffer
+#define glUseProgram w2xc_glUseProgram
+#define glVertexAttribPointer w2xc_glVertexAttribPointer
+#define glViewport w2xc_glViewport
+
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+#include "lineBufferExecutor.hpp"
+#include <algorithm>
+
+namespace w2xc {
+
+LineBufferExecutor::LineBufferExecutor(
+		std::vector<std::unique_ptr<Model> > &models, int width) :
+		models(models), width(width), height(0),
+		inputPlane(nullptr), outputPlane(nullptr) {
+
+	// a row per thread, so that one run of the pool has work for all
+	const int maxBatchRows = 8;
+	int nThreads = modelUtility::getInstance().getThreadPool()
+			.getNumberOfThreads();
+	batchRows = std::min(nThreads, maxBatchRows);
+	// the rows y - 1 .. y + batchRows of the layer before
+	ringRows = batchRows + 2;
+
+	int maxInputPlanes = 0, maxOutputPlanes = 0;
+	for (auto& model : models) {
+		maxInputPlanes = std::max(maxInputPlanes, model->getNInputPlanes());
+		maxOutputPlanes = std::max(maxOutputPlanes, model->getNOutputPlanes());
+	}
+	inputRows.resize(batchRows * maxInputPlanes * 3);
+	outputRows.resize(batchRows * maxOutputPlanes);
+
+	// the last layer writes straight into the output plane
+	for (int layer = 0; layer + 1 < (int)models.size(); layer++) {
+		RingBuffer ring;
+		ring.nPlanes = models[layer]->getNOutputPlanes();
+		ring.nProducedRows = 0;
+		ring.data.resize(ringRows * ring.nPlanes * width);
+		rings.push_back(std::move(ring));
+	}
+}
+
+bool LineBufferExecutor::isApplicable(
+		std::vector<std::unique_ptr<Model> > &models) {
+	for (auto& model : models) {
+		if (model->getKernelSize() != 3) {
+			return false;
+		}
+	}
+	return !models.empty();
+}
+
+size_t LineBufferExecutor::getBufferBytes() {
+	size_t bytes = 0;
+	for (auto& ring : rings) {
+		bytes += ring.data.size() * sizeof(float);
+	}
+	return bytes;
+}
+
+float *LineBufferExecutor::ringRow(int layer, int plane, int y) {
+	RingBuffer &ring = rings[layer];
+	return &ring.data[((y % ringRows) * ring.nPlanes + plane) * width];
+}
+
+// compute the rows [y, y + nRows) of the output of layer in one run of
+// the thread pool. rows of the layer before are produced on demand, in
+// order and no further than needed, until the row y + nRows is there.
+// Its ring then holds the rows y - 1 .. y + nRows.
+bool LineBufferExecutor::produceRows(int layer, int y, int nRows) {
+
+	int lastRow = std::min(y + nRows, height - 1);
+	if (layer > 0) {
+		RingBuffer &ring = rings[layer - 1];
+		while (ring.nProducedRows <= lastRow) {
+			int firstRow = ring.nProducedRows;
+			if (!produceRows(layer - 1, firstRow,
+					std::min(batchRows, lastRow + 1 - firstRow))) {
+				return false;
+			}
+		}
+	}
+
+	Model &model = *models[layer];
+	int nInputPlanes = model.getNInputPlanes();
+	int nOutputPlanes = model.getNOutputPlanes();
+	bool lastLayer = (layer + 1 == (int)models.size());
+
+	for (int r = 0; r < nRows; r++) {
+		const float **rows = &inputRows[r * nInputPlanes * 3];
+		for (int ky = 0; ky < 3; ky++) {
+			int yy = std::min(std::max(y + r - 1 + ky, 0), height - 1);
+			for (int ip = 0; ip < nInputPlanes; ip++) {
+				rows[ip * 3 + ky] = (layer == 0) ?
+						inputPlane->ptr<float>(yy) : ringRow(layer - 1, ip, yy);
+			}
+		}
+		float **dst = &outputRows[r * nOutputPlanes];
+		for (int op = 0; op < nOutputPlanes; op++) {
+			dst[op] = lastLayer ?
+					outputPlane->ptr<float>(y + r) : ringRow(layer, op, y + r);
+		}
+	}
+
+	if (!model.filterRows(&inputRows[0], &outputRows[0], width, nRows)) {
+		return false;
+	}
+
+	if (!lastLayer) {
+		rings[layer].nProducedRows += nRows;
+	}
+	return true;
+}
+
+bool LineBufferExecutor::run(const cv::Mat &inputPlane, cv::Mat &outputPlane) {
+
+	if (inputPlane.size().width != width || !isApplicable(models)) {
+		std::cerr << "Error : LineBufferExecutor-run : \n"
+				"input width mismatch or unsupported models." << std::endl;
+		return false;
+	}
+	if (models.back()->getNOutputPlanes() != 1) {
+		std::cerr << "Error : LineBufferExecutor-run : \n"
+				"the last model must have one output plane." << std::endl;
+		return false;
+	}
+
+	height = inputPlane.size().height;
+	outputPlane = cv::Mat(inputPlane.size(), CV_32FC1);
+	this->inputPlane = &inputPlane;
+	this->outputPlane = &outputPlane;
+	for (auto& ring : rings) {
+		ring.nProducedRows = 0;
+	}
+
+	for (int y = 0; y < height; y += batchRows) {
+		int nRows = std::min(batchRows, height - y);
+		if (!produceRows((int)models.size() - 1, y, nRows)) {
+			return false;
+		}
+		if ((y + nRows) / 64 != y / 64 || y + nRows == height) {
+			std::cout << "\rrow " << (y + nRows) << "/" << height;
+			std::cout.flush();
+		}
+	}
+
+	std::cout << " ok" << std::endl;
+
+	return true;
+}
+
+}
@@ -0,0 +1,62 @@
+/*
+ * lineBufferExecutor.hpp
+ *   layer fused executor streaming image rows through a model chain
+ *
+ *   Every batch of rows of the last layer pulls the rows it needs from the
+ *   layer before it, depth first. A layer computes a batch of rows (one
+ *   per thread of the pool, up to 8) in one run of the thread pool. The
+ *   output of each intermediate layer is kept in a ring buffer of batch + 2
+ *   rows per plane only, so the activation memory is O(width x planes)
+ *   instead of O(area x planes).
+ */
+
+#ifndef LINE_BUFFER_EXECUTOR_HPP_
+#define LINE_BUFFER_EXECUTOR_HPP_
+
+#include "modelHandler.hpp"
+#include <memory>
+#include <vector>
+
+namespace w2xc {
+
+class LineBufferExecutor {
+
+private:
+	// the last ringRows rows of every output plane of a layer
+	struct RingBuffer {
+		int nPlanes;
+		int nProducedRows;
+		std::vector<float> data;
+	};
+
+	std::vector<std::unique_ptr<Model> > &models;
+	int width;
+	int height;
+	int batchRows;
+	int ringRows;
+	std::vector<RingBuffer> rings;
+	std::vector<const float *> inputRows;
+	std::vector<float *> outputRows;
+
+	const cv::Mat *inputPlane;
+	cv::Mat *outputPlane;
+
+	float *ringRow(int layer, int plane, int y);
+	bool produceRows(int layer, int y, int nRows);
+
+public:
+	LineBufferExecutor(std::vector<std::unique_ptr<Model> > &models, int width);
+
+	// all models must have 3x3 kernels
+	static bool isApplicable(std::vector<std::unique_ptr<Model> > &models);
+
+	// bytes of the ring buffers
+	size_t getBufferBytes();
+
+	// inputPlane must be width pixels wide, outputPlane is allocated
+	bool run(const cv::Mat &inputPlane, cv::Mat &outputPlane);
+};
+
+}
+
+#endif /* LINE_BUFFER_EXECUTOR_HPP_ */
@@ -10,6 +10,12 @@
 
 #include "modelHandler.hpp"
 #include "convertRoutine.hpp"
+#include "benchmark.hpp"
+#include "calibration.hpp"
+#include "filterKernels.h"
+#include "filterJIT.h"
+#include "alignedBuffer.h"
+#include "glContext.h"
 
 int main(int argc, char** argv) {
 
@@ -18,7 +24,23 @@ int main(int argc, char** argv) {
 
 	TCLAP::ValueArg<std::string> cmdInputFile("i", "input_file",
 			"path to input image file (you should input full path)", true, "",
-			"string", cmd);
+			"string");
+
+	TCLAP::ValueArg<int> cmdBenchmark("", "benchmark",
+			"run the models of the mode on random planes of this size "
+			"and report time and deviation from cv::filter2D (cpu engines)",
+			true, 0, "integer");
+
+	TCLAP::MultiArg<std::string> cmdCalibrate("", "calibrate",
+			"run the models of the mode in float on this sample image "
+			"(repeatable) and write the activation scales of the int8 engine "
+			"next to the model files", true, "string");
+
+	std::vector<TCLAP::Arg *> cmdActions;
+	cmdActions.push_back(&cmdInputFile);
+	cmdActions.push_back(&cmdBenchmark);
+	cmdActions.push_back(&cmdCalibrate);
+	cmd.xorAdd(cmdActions);
 
 	TCLAP::ValueArg<std::string> cmdOutputFile("o", "output_file",
 			"path to output image file (you should input full path)", false,
@@ -47,13 +69,86 @@ int main(int argc, char** argv) {
 			"models", "string", cmd);
 	
 	TCLAP::ValueArg<int> cmdNumberOfJobs("j", "jobs",
-			"number of threads launching at the same time (dummy command)", false, 4, "integer",
-			cmd);
+			"number of threads of the cpu engine. default=0 (number of logical cores)",
+			false, 0, "integer", cmd);
 	
 	TCLAP::ValueArg<int> cmdBlockSize("b", "block_size",
 			"block size of split processing. default=512", false, 512, "integer",
 			cmd);
 
+	std::vector<std::string> cmdEngineConstraintV;
+	cmdEngineConstraintV.push_back("gl");
+	cmdEngineConstraintV.push_back("cpu");
+	cmdEngineConstraintV.push_back("gemm");
+	cmdEngineConstraintV.push_back("winograd");
+	cmdEngineConstraintV.push_back("int8");
+	TCLAP::ValuesConstraint<std::string> cmdEngineConstraint(cmdEngineConstraintV);
+	TCLAP::ValueArg<std::string> cmdEngine("", "engine",
+			"filter engine (gl: OpenGL shader, cpu: SIMD on CPU, "
+			"gemm: im2col + SGEMM on CPU, winograd: Winograd F(4x4,3x3) on CPU, "
+			"int8: quantized on CPU, requires --calibrate once). "
+			"default=gl",
+			false, "gl", &cmdEngineConstraint, cmd);
+
+	std::vector<std::string> cmdGLContextConstraintV;
+	cmdGLContextConstraintV.push_back("auto");
+	cmdGLContextConstraintV.push_back("egl");
+	cmdGLContextConstraintV.push_back("osmesa");
+	cmdGLContextConstraintV.push_back("glfw");
+	TCLAP::ValuesConstraint<std::string> cmdGLContextConstraint(cmdGLContextConstraintV);
+	TCLAP::ValueArg<std::string> cmdGLContext("", "gl_context",
+			"OpenGL context of the gl engine (egl: surfaceless EGL, "
+			"osmesa: OSMesa, both Linux without X; glfw: hidden window, "
+			"Windows and macOS). default=auto",
+			false, "auto", &cmdGLContextConstraint, cmd);
+
+	std::vector<std::string> cmdCPUKernelConstraintV;
+	cmdCPUKernelConstraintV.push_back("auto");
+	cmdCPUKernelConstraintV.push_back("avx512vnni");
+	cmdCPUKernelConstraintV.push_back("avx512");
+	cmdCPUKernelConstraintV.push_back("avx2");
+	cmdCPUKernelConstraintV.push_back("sse");
+	cmdCPUKernelConstraintV.push_back("neon");
+	cmdCPUKernelConstraintV.push_back("scalar");
+	TCLAP::ValuesConstraint<std::string> cmdCPUKernelConstraint(cmdCPUKernelConstraintV);
+	TCLAP::ValueArg<std::string> cmdCPUKernel("", "cpu_kernel",
+			"instruction set of the cpu engines. "
+			"default=auto (widest one the processor supports)",
+			false, "auto", &cmdCPUKernelConstraint, cmd);
+
+	TCLAP::SwitchArg cmdLineBuffer("", "line_buffer",
+			"stream image rows through all layers keeping a few rows per layer "
+			"(cpu engine kernels, no block splitting)", cmd, false);
+
+	TCLAP::SwitchArg cmdHalfActivations("", "fp16",
+			"store the activations between the layers in half precision, "
+			"accumulate in single precision (cpu engines)", cmd, false);
+
+	TCLAP::SwitchArg cmdJIT("", "jit",
+			"generate the machine code of each layer at load time "
+			"(cpu engine, x86-64 with avx2 or wider)", cmd, false);
+
+	TCLAP::SwitchArg cmdPinThreads("", "pin_threads",
+			"pin the threads of the cpu engines to the cores, performance "
+			"cores first, spread over the NUMA nodes", cmd, false);
+
+	TCLAP::ValueArg<int> cmdPinNodes("", "pin_nodes",
+			"with --pin_threads, spread the threads over the first n NUMA "
+			"nodes only. default=0 (all nodes)", false, 0, "integer", cmd);
+
+	TCLAP::SwitchArg cmdHugePages("", "huge_pages",
+			"back the weights and activations of the cpu engines with 2 MB "
+			"pages (hugetlbfs or transparent huge pages)", cmd, false);
+
+	TCLAP::ValueArg<int> cmdTileBatch("", "tile_batch",
+			"run every layer on a batch of blocks before the next layer, "
+			"the activations of a batch in at most this many MiB "
+			"(cpu engines, 0 : one block at a time). default=0",
+			false, 0, "integer", cmd);
+
+	TCLAP::SwitchArg cmdPrintStatistics("", "stats",
+			"print statistics of the cpu engine scheduler", cmd, false);
+
 	// definition of command line argument : end
 
 	// parse command line arguments
@@ -65,6 +160,155 @@ int main(int argc, char** argv) {
 		std::exit(-1);
 	}
 
+	int blockSize = cmdBlockSize.getValue();
+	w2xc::modelUtility::getInstance().setBlockSize(cv::Size(blockSize, blockSize));
+
+	if (cmdNumberOfJobs.getValue() > 0) {
+		w2xc::modelUtility::getInstance().setNumberOfJobs(cmdNumberOfJobs.getValue());
+	}
+
+	if (cmdEngine.getValue() == "cpu") {
+		w2xc::modelUtility::getInstance().setFilterEngine(w2xc::FilterEngine::CPU);
+	} else if (cmdEngine.getValue() == "gemm") {
+		w2xc::modelUtility::getInstance().setFilterEngine(w2xc::FilterEngine::GEMM);
+	} else if (cmdEngine.getValue() == "winograd") {
+		w2xc::modelUtility::getInstance().setFilterEngine(w2xc::FilterEngine::Winograd);
+	} else if (cmdEngine.getValue() == "int8") {
+		w2xc::modelUtility::getInstance().setFilterEngine(w2xc::FilterEngine::INT8);
+	} else {
+		w2xc::modelUtility::getInstance().setFilterEngine(w2xc::FilterEngine::GL);
+	}
+
+	if (cmdGLContext.getValue() == "egl") {
+		glContextSetBackend(GLContextEGL);
+	} else if (cmdGLContext.getValue() == "osmesa") {
+		glContextSetBackend(GLContextOSMesa);
+	} else if (cmdGLContext.getValue() == "glfw") {
+		glContextSetBackend(GLContextGLFW);
+	}
+
+	w2xc::modelUtility::getInstance().setLineBufferEnabled(cmdLineBuffer.getValue());
+	if (cmdLineBuffer.getValue()) {
+		if (cmdEngine.getValue() == "gl" || cmdEngine.getValue() == "int8") {
+			std::cerr << "Warning : --line_buffer is not available for the "
+					<< cmdEngine.getValue() << " engine, ignored" << std::endl;
+		} else if (cmdEngine.getValue() != "cpu") {
+			// the rows are filtered by the fused 3x3 kernels
+			std::cerr << "Warning : --line_buffer filters the rows with the "
+					"kernels of the cpu engine, --engine "
+					<< cmdEngine.getValue() << " is not used" << std::endl;
+		}
+	}
+	w2xc::modelUtility::getInstance().setThreadPinning(cmdPinThreads.getValue(),
+			std::max(cmdPinNodes.getValue(), 0));
+	if (cmdPinNodes.getValue() > 0 && !cmdPinThreads.getValue()) {
+		std::cerr << "Warning : --pin_nodes needs --pin_threads, ignored"
+				<< std::endl;
+	}
+	w2xc::modelUtility::getInstance().setTileBatching(
+			cmdTileBatch.getValue() > 0,
+			static_cast<size_t>(std::max(cmdTileBatch.getValue(), 0)) * 1024 * 1024);
+	// the weights are packed when the models are loaded
+	alignedBufferSetHugePages(cmdHugePages.getValue());
+	w2xc::modelUtility::getInstance().setHalfActivationsEnabled(
+			cmdHalfActivations.getValue());
+
+	// the kernels have to be fixed before the models pack their weights
+	if (!filterKernelsSelect(cmdCPUKernel.getValue())) {
+		std::cerr << "Error : cpu kernel " << cmdCPUKernel.getValue()
+				<< " is not supported on this processor" << std::endl;
+		std::exit(-1);
+	}
+	if (cmdEngine.getValue() != "gl") {
+		std::cout << "cpu kernel : " << filterKernels().name << std::endl;
+	}
+	if (cmdJIT.getValue()) {
+		if (filterJITAvailable()) {
+			w2xc::modelUtility::getInstance().setJITEnabled(true);
+		} else {
+			std::cerr << "Warning : --jit is not available for the cpu kernel "
+					<< filterKernels().name << ", ignored" << std::endl;
+		}
+	}
+
+	if (cmdCalibrate.isSet()) {
+		// the ranges are taken from the float models on the cpu
+		w2xc::FilterEngine engine = w2xc::modelUtility::getInstance().getFilterEngine();
+		if (engine == w2xc::FilterEngine::GL || engine == w2xc::FilterEngine::INT8) {
+			w2xc::modelUtility::getInstance().setFilterEngine(w2xc::FilterEngine::CPU);
+		}
+
+		// Y planes as convertWithModels gets them in each phase
+		std::vector<cv::Mat> noisePlanes, scalePlanes;
+		for (auto& sampleFileName : cmdCalibrate.getValue()) {
+			cv::Mat sample = cv::imread(sampleFileName, cv::IMREAD_COLOR);
+			if (sample.size().width == 0 || sample.size().height == 0) {
+				std::cout << "Error : failed to open " << sampleFileName << std::endl;
+				return -1;
+			}
+			sample.convertTo(sample, CV_32F, 1.0 / 255.0);
+
+			cv::Mat sampleYUV;
+			std::vector<cv::Mat> sampleSplit;
+			cv::cvtColor(sample, sampleYUV, cv::COLOR_RGB2YUV);
+			cv::split(sampleYUV, sampleSplit);
+			noisePlanes.push_back(sampleSplit[0]);
+
+			cv::Mat sample2xNearest;
+			cv::resize(sample, sample2xNearest,
+					cv::Size(sample.size().width * 2, sample.size().height * 2),
+					0, 0, cv::INTER_NEAREST);
+			cv::cvtColor(sample2xNearest, sampleYUV, cv::COLOR_RGB2YUV);
+			cv::split(sampleYUV, sampleSplit);
+			scalePlanes.push_back(sampleSplit[0]);
+		}
+
+		std::vector<std::string> modelFileNames;
+		std::vector<std::vector<cv::Mat> *> modelSamples;
+		if (cmdMode.getValue() == "noise" || cmdMode.getValue() == "noise_scale") {
+			modelFileNames.push_back(cmdModelPath.getValue() + "/noise"
+					+ std::to_string(cmdNRLevel.getValue()) + "_model.bin");
+			modelSamples.push_back(&noisePlanes);
+		}
+		if (cmdMode.getValue() == "scale" || cmdMode.getValue() == "noise_scale") {
+			modelFileNames.push_back(cmdModelPath.getValue() + "/scale2.0x_model.bin");
+			modelSamples.push_back(&scalePlanes);
+		}
+
+		for (int i = 0; i < (int)modelFileNames.size(); i++) {
+			std::vector<std::unique_ptr<w2xc::Model> > models;
+			if (!w2xc::modelUtility::generateModelFromBin(modelFileNames[i], models))
+				std::exit(-1);
+
+			std::string calibrationFileName =
+					w2xc::calibrationFileName(modelFileNames[i]);
+			std::cout << "calibrating " << calibrationFileName << " ..." << std::endl;
+			if (!w2xc::calibrateModels(models, *modelSamples[i], calibrationFileName))
+				std::exit(-1);
+		}
+
+		return 0;
+	}
+
+	if (cmdBenchmark.isSet()) {
+		std::string modelFileName(cmdModelPath.getValue());
+		if (cmdMode.getValue() == "noise") {
+			modelFileName = modelFileName + "/noise"
+					+ std::to_string(cmdNRLevel.getValue()) + "_model.bin";
+		} else {
+			modelFileName = modelFileName + "/scale2.0x_model.bin";
+		}
+		std::vector<std::unique_ptr<w2xc::Model> > models;
+
+		if (!w2xc::modelUtility::generateModelFromBin(modelFileName, models))
+			std::exit(-1);
+
+		if (!w2xc::benchmarkModels(models, cmdBenchmark.getValue()))
+			std::exit(-1);
+
+		return 0;
+	}
+
 	// load image file
 	cv::Mat image = cv::imread(cmdInputFile.getValue(), cv::IMREAD_COLOR);
 	if (image.size().width == 0 || image.size().height == 0) {
@@ -73,9 +317,6 @@ int main(int argc, char** argv) {
 	}
 
 	image.convertTo(image, CV_32F, 1.0 / 255.0);
-
-	int blockSize = cmdBlockSize.getValue();
-	w2xc::modelUtility::getInstance().setBlockSize(cv::Size(blockSize, blockSize));
 	
 	// ===== Noise Reduction Phase =====
 	if (cmdMode.getValue() == "noise" || cmdMode.getValue() == "noise_scale") {
@@ -196,6 +437,24 @@ int main(int argc, char** argv) {
 	}
 	cv::imwrite(outputFileName, image);
 
+	// the GL session of all the phases
+	filterGLRelease();
+
+	if (cmdPrintStatistics.getValue()) {
+		w2xc::ThreadPool &threadPool = w2xc::modelUtility::getInstance().getThreadPool();
+		w2xc::ThreadPoolStatistics stats = threadPool.getStatistics();
+		std::cout << "scheduler : " << threadPool.getNumberOfThreads() << " threads, "
+				<< stats.nRuns << " layers, " << stats.nTasks << " tasks" << std::endl;
+		std::cout << "  steals : " << stats.nSteals
+				<< " (failed " << stats.nFailedSteals << ")" << std::endl;
+		std::cout << "  busy : " << stats.busySeconds << " sec, idle : "
+				<< stats.idleSeconds << " sec" << std::endl;
+		if (threadPool.isPinned()) {
+			std::cout << "  pinned on " << threadPool.getNumberOfNodes()
+					<< " NUMA node(s)" << std::endl;
+		}
+	}
+
 	std::cout << "process successfully done!" << std::endl;
 
 	return 0;
@@ -1,10 +1,19 @@
 ﻿
 #include "modelHandler.hpp"
+#include "filterCPU.h"
+#include "filterWinograd.h"
+#include "filterCPUBlocked.h"
+#include "filterGEMM.h"
+#include "filterINT8.h"
+#include "calibration.hpp"
 #include <fstream>
 #include <thread>
+#include <atomic>
 
 namespace w2xc {
 
+static std::atomic<uint64_t> lastModelSerial(0);
+
 int Model::getNInputPlanes() {
 	return nInputPlanes;
 }
@@ -13,7 +22,37 @@ int Model::getNOutputPlanes() {
 	return nOutputPlanes;
 }
 
-Model::Model(picojson::object &jsonObj) {
+int Model::getKernelSize() {
+	return kernelSize;
+}
+
+uint64_t Model::getSerial() {
+	return serial;
+}
+
+void Model::setQuantization(const FilterINT8Quantization &inputQuantization,
+		const FilterINT8Quantization *outputQuantization) {
+	this->inputQuantization = inputQuantization;
+	quantizedOutput = (outputQuantization != nullptr);
+	if (quantizedOutput) {
+		this->outputQuantization = *outputQuantization;
+	}
+	calibrated = true;
+	// the requantization folds the input quantization, pack again
+	int8Weights.clear();
+	int8Requantization.clear();
+}
+
+bool Model::isCalibrated() {
+	return calibrated;
+}
+
+const FilterINT8Quantization &Model::getInputQuantization() {
+	return inputQuantization;
+}
+
+Model::Model(picojson::object &jsonObj) :
+		serial(++lastModelSerial), calibrated(false), quantizedOutput(false) {
 	// preload nInputPlanes,nOutputPlanes, and preserve required size vector
 	nInputPlanes = static_cast<int>(jsonObj["nInputPlane"].get<double>());
 	nOutputPlanes =
@@ -28,7 +67,7 @@ Model::Model(picojson::object &jsonObj) {
 		std::exit(-1);
 	} // kH == kW
 
-	weights = std::vector<cv::Mat>(nInputPlanes * nOutputPlanes, cv::Mat(kernelSize,kernelSize,CV_32FC1));
+	allocateWeights();
 	biases = std::vector<double>(nOutputPlanes, 0.0);
 
 	if (!loadModelFromJSONObject(jsonObj)) {
@@ -39,7 +78,67 @@ Model::Model(picojson::object &jsonObj) {
 		std::exit(-1);
 	}
 
-	nJob = 4;
+	prepareWeights(modelUtility::getInstance().getFilterEngine());
+}
+
+void Model::allocateWeights() {
+	int kernelArea = kernelSize * kernelSize;
+	weightBuffer.assign(nOutputPlanes * nInputPlanes * kernelArea, 0.0f);
+	weights.clear();
+	for (int i = 0; i < nOutputPlanes * nInputPlanes; i++) {
+		weights.push_back(cv::Mat(kernelSize, kernelSize, CV_32FC1,
+				weightBuffer.data() + i * kernelArea));
+	}
+}
+
+void Model::prepareWeights(FilterEngine engine) {
+
+	if (biasBuffer.empty()) {
+		biasBuffer.resize(nOutputPlanes);
+		for (int i = 0; i < nOutputPlanes; i++) {
+			biasBuffer[i] = static_cast<float>(biases[i]);
+		}
+	}
+
+	// the planar kernel also filters the rows of the line buffer executor
+	if ((engine == FilterEngine::CPU
+			|| (engine != FilterEngine::GL
+			&& modelUtility::getInstance().getLineBufferEnabled()))
+			&& kernelSize == 3 && cpuWeights.empty()) {
+		filterCPUPackWeights(weights, nInputPlanes, nOutputPlanes, cpuWeights);
+	}
+	if (engine == FilterEngine::CPU && kernelSize == 3
+			&& blockedWeights.empty()) {
+		filterCPUBlockedPackWeights(weights, biases, nInputPlanes,
+				nOutputPlanes, blockedWeights, blockedBiases);
+		blockedKernel = filterCPUBlockedSelectKernel(nInputPlanes,
+				nOutputPlanes);
+		// narrow layers keep the compiled kernel
+		if (modelUtility::getInstance().getJITEnabled()
+				&& nOutputPlanes >= filterCPUBlockedChannels()) {
+			jitKernel = filterJITCompile(blockedWeights.data(),
+					blockedBiases.data(), nInputPlanes, nOutputPlanes);
+		}
+	}
+	if (engine == FilterEngine::GEMM && gemmWeights.empty()) {
+		filterGEMMPackWeights(weights, nInputPlanes, nOutputPlanes, kernelSize,
+				gemmWeights);
+	}
+	if (engine == FilterEngine::Winograd && kernelSize == 3
+			&& winogradWeights.empty()) {
+		filterWinogradTransformWeights(weights, nInputPlanes, nOutputPlanes,
+				winogradWeights);
+	}
+	if (engine == FilterEngine::GL && kernelSize == 3 && glWeights.empty()) {
+		filterGLPackWeights(weights, biases, nInputPlanes, nOutputPlanes,
+				glWeights, glBiases);
+	}
+	// quantized with the input scale, packed once the calibration is loaded
+	if (engine == FilterEngine::INT8 && kernelSize == 3 && calibrated
+			&& int8Weights.empty()) {
+		filterINT8PackWeights(weights, biases, nInputPlanes, nOutputPlanes,
+				inputQuantization, int8Weights, int8Requantization);
+	}
 }
 
 bool Model::loadModelFromJSONObject(picojson::object &jsonObj) {
@@ -55,8 +154,7 @@ bool Model::loadModelFromJSONObject(picojson::object &jsonObj) {
 
 		for (auto&& weightMatV : wInputPlane) {
 			picojson::array &weightMat = weightMatV.get<picojson::array>();
-			cv::Mat writeMatrix = cv::Mat::zeros(kernelSize, kernelSize,
-			CV_32FC1);
+			cv::Mat &writeMatrix = weights.at(matProgress);
 
 			for (int writingRow = 0; writingRow < kernelSize; writingRow++) {
 				auto& weightMatRowV = weightMat.at(writingRow);
@@ -70,7 +168,6 @@ bool Model::loadModelFromJSONObject(picojson::object &jsonObj) {
 
 			} // for(weightMat) (writing 1 matrix finished)
 
-			weights.at(matProgress) = std::move(writeMatrix);
 			matProgress++;
 		} // for(wInputPlane) (writing matrices in set of wInputPlane finished)
 
@@ -85,10 +182,6 @@ bool Model::loadModelFromJSONObject(picojson::object &jsonObj) {
 	return true;
 }
 
-void Model::setNumberOfJobs(int setNJob) {
-	nJob = setNJob;
-}
-
 bool modelUtility::generateModelFromJSON(const std::string &fileName,
 		std::vector<std::unique_ptr<Model> > &models) {
 
@@ -117,14 +210,15 @@ bool modelUtility::generateModelFromJSON(const std::string &fileName,
 }
 
 
-Model::Model(std::istream& binFile) {
+Model::Model(std::istream& binFile) :
+		serial(++lastModelSerial), calibrated(false), quantizedOutput(false) {
 	// preload nInputPlanes,nOutputPlanes, and preserve required size vector
 	
 	binFile.read((char*)&nInputPlanes, sizeof(int));
 	binFile.read((char*)&nOutputPlanes, sizeof(int));
 	binFile.read((char*)&kernelSize, sizeof(int));
 
-	weights = std::vector<cv::Mat>(nInputPlanes * nOutputPlanes, cv::Mat(kernelSize,kernelSize,CV_32FC1));
+	allocateWeights();
 	biases = std::vector<double>(nOutputPlanes, 0.0);
 
 	if (!loadModelFromBin(binFile)) {
@@ -135,7 +229,7 @@ Model::Model(std::istream& binFile) {
 		std::exit(-1);
 	}
 
-	nJob = 4;
+	prepareWeights(modelUtility::getInstance().getFilterEngine());
 }
 
 
@@ -145,7 +239,7 @@ bool Model::loadModelFromBin(std::istream& binFile)
 	int matProgress = 0;
 	for (int i = 0; i < nOutputPlanes; i++) {
 		for (int j = 0; j < nInputPlanes; j++) {
-			cv::Mat writeMatrix = cv::Mat::zeros(kernelSize, kernelSize, CV_32FC1);
+			cv::Mat &writeMatrix = weights.at(matProgress);
 
 			for (int writingRow = 0; writingRow < kernelSize; writingRow++) {
 				for (int index = 0; index < kernelSize; index++) {
@@ -154,7 +248,6 @@ bool Model::loadModelFromBin(std::istream& binFile)
 					writeMatrix.at<float>(writingRow, index) = data;
 				}
 			}
-			weights.at(matProgress) = std::move(writeMatrix);
 			matProgress++;
 		}
 	}
@@ -197,6 +290,15 @@ bool Model::saveModelToBin(std::ostream& binFile)
 
 modelUtility * modelUtility::instance = nullptr;
 
+modelUtility::modelUtility() :
+		blockSplittingSize(512,512), filterEngine(FilterEngine::GL),
+		lineBufferEnabled(false), halfActivationsEnabled(false),
+		jitEnabled(false), threadPinningEnabled(false), maxNumberOfNodes(0),
+		tileBatchingEnabled(false), tileBatchMemory(1024 * 1024 * 1024) {
+	nJob = static_cast<int>(std::thread::hardware_concurrency());
+	if (nJob < 1) nJob = 4;
+}
+
 modelUtility& modelUtility::getInstance(){
 	if(instance == nullptr){
 		instance = new modelUtility();
@@ -221,6 +323,12 @@ bool modelUtility::generateModelFromBin(const std::string &fileName,
 		models.emplace_back(new Model(binFile));
 	}
 
+	// scales of the int8 engine, written next to the model by --calibrate
+	if (modelUtility::getInstance().getFilterEngine() == FilterEngine::INT8
+			&& !loadCalibration(calibrationFileName(fileName), models)) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -247,6 +355,7 @@ bool modelUtility::saveModelToBin(const std::string &fileName,
 
 bool modelUtility::setNumberOfJobs(int setNJob){
 	if(setNJob < 1)return false;
+	if(setNJob != nJob)threadPool.reset();
 	nJob = setNJob;
 	return true;
 };
@@ -255,6 +364,14 @@ int modelUtility::getNumberOfJobs(){
 	return nJob;
 }
 
+ThreadPool& modelUtility::getThreadPool(){
+	if(!threadPool){
+		threadPool.reset(new ThreadPool(nJob, threadPinningEnabled,
+				maxNumberOfNodes));
+	}
+	return *threadPool;
+}
+
 bool modelUtility::setBlockSize(cv::Size size){
 	if(size.width < 0 || size.height < 0)return false;
 	blockSplittingSize = size;
@@ -272,6 +389,67 @@ cv::Size modelUtility::getBlockSize(){
 	return blockSplittingSize;
 }
 
+void modelUtility::setFilterEngine(FilterEngine engine){
+	filterEngine = engine;
+}
+
+FilterEngine modelUtility::getFilterEngine(){
+	return filterEngine;
+}
+
+void modelUtility::setLineBufferEnabled(bool enabled){
+	lineBufferEnabled = enabled;
+}
+
+bool modelUtility::getLineBufferEnabled(){
+	return lineBufferEnabled;
+}
+
+void modelUtility::setHalfActivationsEnabled(bool enabled){
+	halfActivationsEnabled = enabled;
+}
+
+bool modelUtility::getHalfActivationsEnabled(){
+	return halfActivationsEnabled;
+}
+
+void modelUtility::setThreadPinning(bool enabled, int maxNodes){
+	if(enabled != threadPinningEnabled || maxNodes != maxNumberOfNodes){
+		threadPool.reset();
+	}
+	threadPinningEnabled = enabled;
+	maxNumberOfNodes = maxNodes;
+}
+
+bool modelUtility::getThreadPinningEnabled(){
+	return threadPinningEnabled;
+}
+
+int modelUtility::getThreadPinningNodes(){
+	return maxNumberOfNodes;
+}
+
+void modelUtility::setJITEnabled(bool enabled){
+	jitEnabled = enabled;
+}
+
+bool modelUtility::getJITEnabled(){
+	return jitEnabled;
+}
+
+void modelUtility::setTileBatching(bool enabled, size_t memoryBytes){
+	tileBatchingEnabled = enabled;
+	tileBatchMemory = memoryBytes;
+}
+
+bool modelUtility::getTileBatchingEnabled(){
+	return tileBatchingEnabled;
+}
+
+size_t modelUtility::getTileBatchMemory(){
+	return tileBatchMemory;
+}
+
 // for debugging
 
 void Model::printWeightMatrix() {
@@ -11,22 +11,73 @@
 #include <cstdlib>
 
 #include "filterGL.h"
+#include "filterCPUBlocked.h"
+#include "filterINT8.h"
+#include "filterJIT.h"
+#include "threadPool.hpp"
+#include "activationTensor.hpp"
+#include "alignedBuffer.h"
 
 namespace w2xc {
 
+// computing backend used by convertWithModels
+enum class FilterEngine {
+	GL,		// OpenGL shader
+	CPU,	// fused SIMD convolution on CPU (Model::filter)
+	GEMM,	// im2col + blocked SGEMM on CPU (Model::filter)
+	Winograd,	// Winograd F(4x4,3x3) on CPU (Model::filter)
+	Reference,	// cv::filter2D on CPU, baseline of the benchmark
+	INT8,	// quantized NCHW8c convolution on CPU (Model::filter, calibration.hpp)
+};
+
 class Model {
 
 private:
+	uint64_t serial;	// never reused by another Model of the process
 	int nInputPlanes;
 	int nOutputPlanes;
-	std::vector<cv::Mat> weights;
 	std::vector<double> biases;
 	int kernelSize;
-	int nJob;
+
+	// all weights in one buffer in (op, ip, kernelSize x kernelSize) order.
+	// this is the order of filterCPUProcess,
+	// weights are cv::Mat headers of the single kernels in it.
+	AlignedBuffer weightBuffer;
+	AlignedBuffer biasBuffer;
+	std::vector<cv::Mat> weights;
+
+	// layouts of the other engines, packed once by prepareWeights()
+	AlignedBuffer cpuWeights;		// register blocks of the planar kernel
+	AlignedBuffer blockedWeights;	// NCHW8c kernel
+	AlignedBuffer blockedBiases;
+	FilterCPUBlockedKernel blockedKernel;	// instance for this layer shape
+	std::shared_ptr<FilterJITKernel> jitKernel;	// generated, shared by the process
+	AlignedBuffer gemmWeights;		// row panels of the SGEMM
+	AlignedBuffer winogradWeights;	// G g G^T
+	AlignedBuffer int8Weights;		// s8 NCHW8c kernel
+	AlignedBuffer int8Requantization;
+	AlignedBuffer glWeights;		// RGBA texels, uploaded by loadGLShader
+	AlignedBuffer glBiases;
+
+	// int8 engine : quantization of the input from the calibration file
+	// and of the output, which is the input of the next layer.
+	// the last layer has no output quantization and writes floats.
+	bool calibrated;
+	bool quantizedOutput;
+	FilterINT8Quantization inputQuantization;
+	FilterINT8Quantization outputQuantization;
+
+	// plane headers of the activation tensors, reused over the calls
+	std::vector<cv::Mat> inputViews;
+	std::vector<cv::Mat> outputViews;
+
+	// quantized copies of the planes for the int8 engine on planes
+	ActivationTensor int8Input;
+	ActivationTensor int8Output;
 
 	Waifu2xShader shader;
 
-	Model(){}; // cannot use no-argument constructor
+	Model() : serial(0), calibrated(false), quantizedOutput(false) {}; // cannot use no-argument constructor
 
 	// class inside operation function
 	bool loadModelFromJSONObject(picojson::object& jsonObj);
@@ -34,16 +85,42 @@ private:
 	
 
 	// thread worker function
+	// (output planes [beginningIndex, +nWorks) x rows [beginningRow, +nRows))
 	bool filterWorker(std::vector<cv::Mat> &inputPlanes,
 			std::vector<cv::Mat> &weightMatrices,
 			std::vector<cv::Mat> &outputPlanes,
-			unsigned int beginningIndex, unsigned int nWorks);
+			unsigned int beginningIndex, unsigned int nWorks,
+			unsigned int beginningRow, unsigned int nRows);
+
+	// im2col + SGEMM engine
+	bool filterGEMM(std::vector<cv::Mat> &inputPlanes,
+			std::vector<cv::Mat> &outputPlanes);
+
+	// Winograd F(4x4,3x3) engine
+	bool filterWinograd(std::vector<cv::Mat> &inputPlanes,
+			std::vector<cv::Mat> &outputPlanes);
+
+	// fused SIMD engine on channel interleaved tensors, nTiles pairs
+	bool filterBlocked(ActivationTensor * const *inputs,
+			ActivationTensor * const *outputs, int nTiles);
+
+	// int8 engine on Int8 NCHW8c tensors, output of quantization
+	// (Float32 if nullptr)
+	bool filterINT8(ActivationTensor * const *inputs,
+			ActivationTensor * const *outputs, int nTiles,
+			const FilterINT8Quantization *quantization);
+
+	// weightBuffer and the headers of weights
+	void allocateWeights();
+
+	// 3x3 kernels go to filterCPUProcess unless the reference is requested
+	bool useFusedKernel();
 
 public:
 	// ctor and dtor
 	Model(picojson::object &jsonObj);
 	Model(std::istream& binFile);
-	~Model() {}
+	~Model() { filterGLReleaseShader(shader); }
 
 	// for debugging
 	void printWeightMatrix();
@@ -52,14 +129,50 @@ public:
 	// getter function
 	int getNInputPlanes();
 	int getNOutputPlanes();
+	int getKernelSize();
+	// tells a model from one created later at the same address
+	uint64_t getSerial();
 
-	// setter function
-	void setNumberOfJobs(int setNJob);
+	// quantization of the int8 engine, set from the calibration file.
+	// outputQuantization nullptr : the layer writes float activations.
+	void setQuantization(const FilterINT8Quantization &inputQuantization,
+			const FilterINT8Quantization *outputQuantization);
+	bool isCalibrated();
+	const FilterINT8Quantization &getInputQuantization();
 
 	// public operation function
+	// outputPlanes are written in place when they already have
+	// the right number, size and type
 	bool filter(std::vector<cv::Mat> &inputPlanes,
 			std::vector<cv::Mat> &outputPlanes);
 
+	// same on activation tensors. output takes the layout of input.
+	// the cpu engine works on the NCHW8c layout directly, the other
+	// engines on the planes of the planar layout.
+	// the int8 engine takes Int8 tensors and writes Int8 tensors of the
+	// output quantization (Float32 for the last layer).
+	bool filter(ActivationTensor &input, ActivationTensor &output);
+
+	// same on nTiles tensors of the same layout (a batch of tiles).
+	// the cpu and int8 engines run the batch in one pass of the pool,
+	// the works of an output block of every tile next to each other, so
+	// that the weights of the block stay in the cache of the thread over
+	// the tiles. the other engines take the tiles one after the other.
+	bool filter(ActivationTensor * const *inputs,
+			ActivationTensor * const *outputs, int nTiles);
+
+	// nRows output rows of every output plane (3x3 kernels only), in one
+	// run of the thread pool.
+	// inputRows[(r * nInputPlanes + ip) * 3 + ky] points to the row
+	// (y_r - 1 + ky) of input plane ip, outputRows[r * nOutputPlanes + op]
+	// receives the row y_r of output plane op.
+	bool filterRows(const float * const *inputRows,
+			float * const *outputRows, int width, int nRows);
+
+	// pack the weights for engine unless it is done already
+	// (at load time, by the filters and by ExecutionPlan)
+	void prepareWeights(FilterEngine engine);
+
 	bool loadGLShader();
 
 	bool filterGL(int modelIndex);
@@ -74,9 +187,16 @@ private:
 	static modelUtility* instance;
 	int nJob;
 	cv::Size blockSplittingSize;
-	modelUtility() :
-			nJob(4), blockSplittingSize(512,512) {
-	}
+	FilterEngine filterEngine;
+	bool lineBufferEnabled;
+	bool halfActivationsEnabled;
+	bool jitEnabled;
+	bool threadPinningEnabled;
+	int maxNumberOfNodes;
+	bool tileBatchingEnabled;
+	size_t tileBatchMemory;
+	std::unique_ptr<ThreadPool> threadPool;
+	modelUtility();
 	;
 
 public:
@@ -90,9 +210,31 @@ public:
 	static modelUtility& getInstance();
 	bool setNumberOfJobs(int setNJob);
 	int getNumberOfJobs();
+	ThreadPool& getThreadPool();
 	bool setBlockSize(cv::Size size);
 	bool setBlockSizeExp2Square(int exp);
 	cv::Size getBlockSize();
+	void setFilterEngine(FilterEngine engine);
+	FilterEngine getFilterEngine();
+	void setLineBufferEnabled(bool enabled);
+	bool getLineBufferEnabled();
+	// activations of the arena in half precision (cpu engines)
+	void setHalfActivationsEnabled(bool enabled);
+	bool getHalfActivationsEnabled();
+	// pin the threads of the pool (cpuTopology.hpp) to the processors of
+	// the first maxNodes NUMA nodes (0 : all), the pool is created again
+	void setThreadPinning(bool enabled, int maxNodes = 0);
+	bool getThreadPinningEnabled();
+	int getThreadPinningNodes();
+	// kernels of the cpu engine generated per layer (filterJIT.h)
+	void setJITEnabled(bool enabled);
+	bool getJITEnabled();
+	// blocks of the block splitting run layer by layer in batches, the
+	// activations of a batch in at most memoryBytes
+	// (ExecutionPlan::chooseBatchSize)
+	void setTileBatching(bool enabled, size_t memoryBytes);
+	bool getTileBatchingEnabled();
+	size_t getTileBatchMemory();
 
 };
 
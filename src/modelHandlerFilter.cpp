@@ -1,8 +1,14 @@
 ﻿
 #include "modelHandler.hpp"
+#include "filterCPU.h"
+#include "filterGEMM.h"
+#include "filterWinograd.h"
+#include "filterCPUBlocked.h"
+#include "filterINT8.h"
+#include "filterJIT.h"
 // #include <iostream> in modelHandler.hpp
 #include <fstream>
-#include <thread>
+#include <algorithm>
 
 namespace w2xc {
 
@@ -17,38 +23,90 @@ bool Model::filter(std::vector<cv::Mat> &inputPlanes,
 		return false;
 	}
 
-	outputPlanes.clear();
-	for (int i = 0; i < nOutputPlanes; i++) {
-		outputPlanes.push_back(cv::Mat::zeros(inputPlanes[0].size(), CV_32FC1));
+	FilterEngine engine = modelUtility::getInstance().getFilterEngine();
+	prepareWeights(engine);
+
+	// every output pixel is written by the workers
+	bool reusable = (outputPlanes.size() == static_cast<size_t>(nOutputPlanes));
+	for (auto& outputPlane : outputPlanes) {
+		reusable = reusable && outputPlane.size() == inputPlanes[0].size()
+				&& outputPlane.type() == CV_32FC1;
+	}
+	if (!reusable) {
+		outputPlanes.clear();
+		for (int i = 0; i < nOutputPlanes; i++) {
+			outputPlanes.push_back(cv::Mat(inputPlanes[0].size(), CV_32FC1));
+		}
 	}
 
-	// filter job issuing
-	std::vector<std::thread> workerThreads;
-	int worksPerThread = nOutputPlanes / nJob;
-	for (int idx = 0; idx < nJob; idx++) {
-		if (!(idx == (nJob - 1) && worksPerThread * nJob != nOutputPlanes)) {
-			workerThreads.push_back(
-					std::thread(&Model::filterWorker, this,
-							std::ref(inputPlanes), std::ref(weights),
-							std::ref(outputPlanes),
-							static_cast<unsigned int>(worksPerThread * idx),
-							static_cast<unsigned int>(worksPerThread)));
-		} else {
-			// worksPerThread * nJob != nOutputPlanes
-			workerThreads.push_back(
-					std::thread(&Model::filterWorker, this,
-							std::ref(inputPlanes), std::ref(weights),
-							std::ref(outputPlanes),
-							static_cast<unsigned int>(worksPerThread * idx),
-							static_cast<unsigned int>(nOutputPlanes
-									- worksPerThread * idx)));
+	if (engine == FilterEngine::GEMM) {
+		return filterGEMM(inputPlanes, outputPlanes);
+	}
+	// int8 on planes : quantized copy of the input, float output
+	if (engine == FilterEngine::INT8 && kernelSize == 3) {
+		if (!calibrated) {
+			std::cerr << "Error : Model-filter : \n"
+					"int8 engine requires the calibration file "
+					"(--calibrate)." << std::endl;
+			return false;
 		}
+		int8Input.setQuantization(inputQuantization);
+		int8Input.fromPlanes(inputPlanes, ActivationTensor::blockedChannels,
+				ActivationTensor::Int8);
+		int8Output.create(nOutputPlanes, int8Input.getSize(),
+				ActivationTensor::blockedChannels);
+		ActivationTensor *input = &int8Input;
+		ActivationTensor *output = &int8Output;
+		bool ret = filterINT8(&input, &output, 1, nullptr);
+		int8Output.toPlanes(outputPlanes);
+		return ret;
+	}
+	// Winograd is for 3x3 kernels only, others take the direct path
+	if (engine == FilterEngine::Winograd && kernelSize == 3) {
+		return filterWinograd(inputPlanes, outputPlanes);
 	}
-	// wait for finishing jobs
-	for (auto& th : workerThreads) {
-		th.join();
+
+	// filter job issuing
+	// the output is split into (output plane group) x (row band) works
+	// so that every thread gets a work even if nOutputPlanes is small.
+	// about worksPerThread works are issued per thread and balanced by
+	// the work stealing scheduler of the thread pool.
+	// the filter2D fallback for non 3x3 kernels can't be split by rows.
+	const int worksPerThread = 8;
+	const int minRowsPerBand = 8;
+	ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+	int nThreads = threadPool.getNumberOfThreads();
+	int height = inputPlanes[0].size().height;
+	int nWorksTarget = (nThreads == 1) ? 1 : nThreads * worksPerThread;
+
+	// the groups of the fused kernel consist of whole register blocks
+	int outputBlock = useFusedKernel() ? filterCPUOutputBlock() : 1;
+	int nOutputBlocks = (nOutputPlanes + outputBlock - 1) / outputBlock;
+	int nPlaneGroups = std::min(nOutputBlocks, nWorksTarget);
+	int nBands = 1;
+	if (useFusedKernel()) {
+		nBands = (nWorksTarget + nPlaneGroups - 1) / nPlaneGroups;
+		nBands = std::min(nBands, height / minRowsPerBand);
+		nBands = std::max(nBands, 1);
 	}
 
+	threadPool.run(nPlaneGroups * nBands, [&](int idx) {
+		int group = idx / nBands;
+		int band = idx % nBands;
+		int beginningIndex = std::min(nOutputBlocks * group / nPlaneGroups
+				* outputBlock, nOutputPlanes);
+		int endIndex = std::min(nOutputBlocks * (group + 1) / nPlaneGroups
+				* outputBlock, nOutputPlanes);
+		int beginningRow = height * band / nBands;
+		int endRow = height * (band + 1) / nBands;
+
+		filterWorker(inputPlanes, weights, outputPlanes,
+				static_cast<unsigned int>(beginningIndex),
+				static_cast<unsigned int>(endIndex - beginningIndex),
+				static_cast<unsigned int>(beginningRow),
+				static_cast<unsigned int>(endRow - beginningRow));
+	});
+
 	//filterWorker(
 	//	std::ref(inputPlanes), std::ref(weights),
 	//	std::ref(outputPlanes),
@@ -58,30 +116,377 @@ bool Model::filter(std::vector<cv::Mat> &inputPlanes,
 	return true;
 }
 
+bool Model::filter(ActivationTensor &input, ActivationTensor &output) {
+	ActivationTensor *inputs = &input;
+	ActivationTensor *outputs = &output;
+	return filter(&inputs, &outputs, 1);
+}
+
+bool Model::filter(ActivationTensor * const *inputs,
+		ActivationTensor * const *outputs, int nTiles) {
+
+	for (int t = 0; t < nTiles; t++) {
+		if (inputs[t]->getNChannels() != nInputPlanes) {
+			std::cerr << "Error : Model-filter : \n"
+					"number of input channels mismatch." << std::endl;
+			std::cerr << inputs[t]->getNChannels() << ","
+					<< nInputPlanes << std::endl;
+			return false;
+		}
+	}
+
+	FilterEngine engine = modelUtility::getInstance().getFilterEngine();
+	prepareWeights(engine);
+
+	int channelBlock = inputs[0]->getChannelBlock();
+	ActivationTensor::Precision precision = inputs[0]->getPrecision();
+
+	if (engine == FilterEngine::INT8 && kernelSize == 3
+			&& precision == ActivationTensor::Int8
+			&& channelBlock == ActivationTensor::blockedChannels) {
+		if (!calibrated) {
+			std::cerr << "Error : Model-filter : \n"
+					"int8 engine requires the calibration file "
+					"(--calibrate)." << std::endl;
+			return false;
+		}
+		for (int t = 0; t < nTiles; t++) {
+			if (quantizedOutput) {
+				outputs[t]->setQuantization(outputQuantization);
+			}
+			outputs[t]->create(nOutputPlanes, inputs[t]->getSize(),
+					channelBlock, quantizedOutput ?
+					ActivationTensor::Int8 : ActivationTensor::Float32);
+		}
+		return filterINT8(inputs, outputs, nTiles,
+				quantizedOutput ? &outputQuantization : nullptr);
+	}
+
+	bool halfPrecision = (precision == ActivationTensor::Float16);
+	for (int t = 0; t < nTiles; t++) {
+		outputs[t]->create(nOutputPlanes, inputs[t]->getSize(), channelBlock,
+				precision);
+	}
+
+	if (channelBlock == filterCPUBlockedChannels() && useFusedKernel()
+			&& modelUtility::getInstance().getFilterEngine() == FilterEngine::CPU) {
+		return filterBlocked(inputs, outputs, nTiles);
+	}
+
+	// the other engines work on planes : the planar float layout is used
+	// as it is, the interleaved and half precision ones go through copies.
+	// the vectors of plane headers keep their capacity over the calls.
+	for (int t = 0; t < nTiles; t++) {
+		ActivationTensor &input = *inputs[t];
+		ActivationTensor &output = *outputs[t];
+		inputViews.clear();
+		outputViews.clear();
+		if (channelBlock == 1 && !halfPrecision) {
+			for (int c = 0; c < nInputPlanes; c++) {
+				inputViews.push_back(input.plane(c));
+			}
+			for (int c = 0; c < nOutputPlanes; c++) {
+				outputViews.push_back(output.plane(c));
+			}
+			if (!filter(inputViews, outputViews)) {
+				return false;
+			}
+			continue;
+		}
+
+		input.toPlanes(inputViews);
+		if (!filter(inputViews, outputViews)) {
+			return false;
+		}
+		output.fromPlanes(outputViews, channelBlock, precision);
+	}
+	return true;
+}
+
+bool Model::filterBlocked(ActivationTensor * const *inputs,
+		ActivationTensor * const *outputs, int nTiles) {
+
+	// (pair of output blocks) x (tile) x (row band) works, as in the
+	// planar path. the pool deals contiguous ranges of works, so the works
+	// of a pair of blocks over the tiles of a batch go to the same thread.
+	const int worksPerThread = 8;
+	const int minRowsPerBand = 8;
+	const int blocksPerWork = 2;
+	ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+	int nThreads = threadPool.getNumberOfThreads();
+	int minHeight = inputs[0]->getSize().height;
+	for (int t = 1; t < nTiles; t++) {
+		minHeight = std::min(minHeight, inputs[t]->getSize().height);
+	}
+	int nBlocks = outputs[0]->getNBlocks();
+	int nBlockGroups = (nBlocks + blocksPerWork - 1) / blocksPerWork;
+	int blockChannels = filterCPUBlockedChannels();
+	int nWorksTarget = (nThreads == 1) ? 1 : nThreads * worksPerThread;
+
+	int nBands = (nWorksTarget + nBlockGroups * nTiles - 1)
+			/ (nBlockGroups * nTiles);
+	nBands = std::min(nBands, minHeight / minRowsPerBand);
+	nBands = std::max(nBands, 1);
+
+	// half precision tensors : the kernel runs on rows converted to float
+	// in the scratch buffer of the worker
+	auto runKernel = [&](int tile, int block, int nOutputs, int nOutputBlocks,
+			int band, int nTileBands) {
+		const ActivationTensor &input = *inputs[tile];
+		ActivationTensor &output = *outputs[tile];
+		cv::Size size = input.getSize();
+		int beginningRow = size.height * band / nTileBands;
+		int nRows = size.height * (band + 1) / nTileBands - beginningRow;
+		const float *weights = blockedWeights.data()
+				+ block * nInputPlanes * 9 * blockChannels;
+		const float *bias = blockedBiases.data() + block * blockChannels;
+		if (!input.isHalfPrecision() && jitKernel) {
+			filterJITProcess(*jitKernel, input.ptr(0, 0), size,
+					output.ptr(0, 0), block, nOutputs, beginningRow, nRows);
+			return;
+		}
+		if (!input.isHalfPrecision()) {
+			blockedKernel(input.ptr(0, 0), nInputPlanes, size, weights, bias,
+					output.ptr(block, 0), nOutputs, beginningRow, nRows);
+			return;
+		}
+		AlignedBuffer &scratch = threadPool.getScratchBuffer();
+		scratch.resize(filterCPUBlockedHalfScratchSize(nInputPlanes,
+				nOutputBlocks, size.width));
+		filterCPUBlockedProcessHalf(blockedKernel, input.halfPtr(0, 0),
+				nInputPlanes, size, weights, bias, output.halfPtr(block, 0),
+				nOutputs, nOutputBlocks, beginningRow, nRows, scratch.data());
+	};
+
+	if (nOutputPlanes < blockChannels) {
+		nBands = (nWorksTarget + nTiles - 1) / nTiles;
+		nBands = std::max(std::min(nBands, minHeight / minRowsPerBand), 1);
+		threadPool.run(nTiles * nBands, [&](int idx) {
+			runKernel(idx / nBands, 0, nOutputPlanes, 1, idx % nBands, nBands);
+		});
+		return true;
+	}
+
+	threadPool.run(nBlockGroups * nTiles * nBands, [&](int idx) {
+		int block = idx / (nTiles * nBands) * blocksPerWork;
+		int tile = idx / nBands % nTiles;
+		int band = idx % nBands;
+		int nWorkBlocks = std::min(blocksPerWork, nBlocks - block);
+
+		runKernel(tile, block, nWorkBlocks, nWorkBlocks, band, nBands);
+	});
+
+	return true;
+}
+
+bool Model::filterINT8(ActivationTensor * const *inputs,
+		ActivationTensor * const *outputs, int nTiles,
+		const FilterINT8Quantization *quantization) {
+
+	// (pair of output blocks) x (tile) x (row band) works, as in
+	// filterBlocked
+	const int worksPerThread = 8;
+	const int minRowsPerBand = 8;
+	const int blocksPerWork = 2;
+	ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+	int nThreads = threadPool.getNumberOfThreads();
+	int minHeight = inputs[0]->getSize().height;
+	for (int t = 1; t < nTiles; t++) {
+		minHeight = std::min(minHeight, inputs[t]->getSize().height);
+	}
+	int nBlocks = outputs[0]->getNBlocks();
+	int nBlockGroups = (nBlocks + blocksPerWork - 1) / blocksPerWork;
+	int nWorksTarget = (nThreads == 1) ? 1 : nThreads * worksPerThread;
+
+	int nBands = (nWorksTarget + nBlockGroups * nTiles - 1)
+			/ (nBlockGroups * nTiles);
+	nBands = std::min(nBands, minHeight / minRowsPerBand);
+	nBands = std::max(nBands, 1);
+
+	size_t weightStride = int8Weights.size() / nBlocks;
+
+	threadPool.run(nBlockGroups * nTiles * nBands, [&](int idx) {
+		int block = idx / (nTiles * nBands) * blocksPerWork;
+		int tile = idx / nBands % nTiles;
+		int band = idx % nBands;
+		const ActivationTensor &input = *inputs[tile];
+		ActivationTensor &output = *outputs[tile];
+		cv::Size size = input.getSize();
+		int beginningRow = size.height * band / nBands;
+		int endRow = size.height * (band + 1) / nBands;
+		int nWorkBlocks = std::min(blocksPerWork, nBlocks - block);
+
+		void *dst = quantization ? static_cast<void *>(output.bytePtr(block, 0))
+				: static_cast<void *>(output.ptr(block, 0));
+		filterINT8Process(input.bytePtr(0, 0), nInputPlanes, size,
+				int8Weights.data() + block * weightStride,
+				int8Requantization.data()
+				+ block * 2 * ActivationTensor::blockedChannels,
+				dst, quantization, nWorkBlocks, beginningRow,
+				endRow - beginningRow);
+	});
+
+	return true;
+}
+
+bool Model::filterGEMM(std::vector<cv::Mat> &inputPlanes,
+		std::vector<cv::Mat> &outputPlanes) {
+
+	// weights have been packed at load time, input is packed per block
+	ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+	int nPixels = inputPlanes[0].size().area();
+	int blockPixels = filterGEMMBlockPixels();
+	int nBlocks = (nPixels + blockPixels - 1) / blockPixels;
+
+	size_t scratchSize = filterGEMMScratchSize(nInputPlanes, kernelSize);
+
+	threadPool.run(nBlocks, [&](int idx) {
+		int beginningPixel = blockPixels * idx;
+		AlignedBuffer &scratch = threadPool.getScratchBuffer();
+		scratch.resize(scratchSize);
+		filterGEMMProcess(inputPlanes, gemmWeights.data(), biasBuffer.data(),
+				kernelSize, outputPlanes, beginningPixel,
+				std::min(blockPixels, nPixels - beginningPixel), scratch.data());
+	});
+
+	return true;
+}
+
+bool Model::filterWinograd(std::vector<cv::Mat> &inputPlanes,
+		std::vector<cv::Mat> &outputPlanes) {
+
+	// weights have been transformed at load time, tiles are processed
+	// in blocks sharing the transformed weights of each position
+	ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+	int nTiles = filterWinogradNumberOfTiles(inputPlanes[0].size());
+	int blockTiles = filterWinogradBlockTiles();
+	int nBlocks = (nTiles + blockTiles - 1) / blockTiles;
+
+	size_t scratchSize = filterWinogradScratchSize(nInputPlanes, nOutputPlanes);
+
+	threadPool.run(nBlocks, [&](int idx) {
+		int beginningTile = blockTiles * idx;
+		AlignedBuffer &scratch = threadPool.getScratchBuffer();
+		scratch.resize(scratchSize);
+		filterWinogradProcess(inputPlanes, winogradWeights.data(),
+				biasBuffer.data(), outputPlanes, beginningTile,
+				std::min(blockTiles, nTiles - beginningTile), scratch.data());
+	});
+
+	return true;
+}
+
+bool Model::filterRows(const float * const *inputRows,
+		float * const *outputRows, int width, int nRows) {
+
+	if (kernelSize != 3) {
+		std::cerr << "Error : Model-filterRows : \n"
+				"only 3x3 kernels can be filtered by rows." << std::endl;
+		return false;
+	}
+
+	// a row is short, so the output planes of each row are split into a
+	// few groups only, fewer the more rows there are
+	const int worksPerThread = 2;
+	ThreadPool &threadPool = modelUtility::getInstance().getThreadPool();
+	int nThreads = threadPool.getNumberOfThreads();
+	int nGroups = (nThreads == 1) ? 1 :
+			std::min(nOutputPlanes,
+			(nThreads * worksPerThread + nRows - 1) / nRows);
+
+	// groups consist of whole register blocks, as in filter()
+	int outputBlock = filterCPUOutputBlock();
+	int nOutputBlocks = (nOutputPlanes + outputBlock - 1) / outputBlock;
+	nGroups = std::min(nGroups, nOutputBlocks);
+
+	auto filterGroup = [&](int work) {
+		int row = work / nGroups, group = work % nGroups;
+		const float * const *rows = inputRows + row * nInputPlanes * 3;
+		float * const *dst = outputRows + row * nOutputPlanes;
+		int beginningIndex = std::min(nOutputBlocks * group / nGroups
+				* outputBlock, nOutputPlanes);
+		int endIndex = std::min(nOutputBlocks * (group + 1) / nGroups
+				* outputBlock, nOutputPlanes);
+		int opIndex = beginningIndex;
+		for (; opIndex + outputBlock <= endIndex && !cpuWeights.empty();
+				opIndex += outputBlock) {
+			filterCPUProcessRowBlock(rows, nInputPlanes, width,
+					cpuWeights.data() + opIndex * nInputPlanes * 9,
+					biasBuffer.data() + opIndex, dst + opIndex);
+		}
+		for (; opIndex < endIndex; opIndex++) {
+			filterCPUProcessRow(rows, nInputPlanes, width,
+					weightBuffer.data() + opIndex * nInputPlanes * 9,
+					biasBuffer[opIndex], dst[opIndex]);
+		}
+	};
+
+	if (nRows * nGroups == 1) {
+		filterGroup(0);
+	} else {
+		threadPool.run(nRows * nGroups, filterGroup);
+	}
+
+	return true;
+}
+
+bool Model::useFusedKernel() {
+	return kernelSize == 3 && modelUtility::getInstance().getFilterEngine()
+			!= FilterEngine::Reference;
+}
+
 bool Model::filterWorker(std::vector<cv::Mat> &inputPlanes,
 		std::vector<cv::Mat> &weightMatrices,
 		std::vector<cv::Mat> &outputPlanes, unsigned int beginningIndex,
-		unsigned int nWorks) {
+		unsigned int nWorks, unsigned int beginningRow, unsigned int nRows) {
 
 	cv::Size ipSize = inputPlanes[0].size();
+
+	if (useFusedKernel()) {
+		// fused SIMD path : convolution, bias and leaky ReLU in one pass.
+		// whole register blocks sweep the input planes once per block,
+		// the remaining planes of the layer are filtered one by one.
+		int outputBlock = filterCPUOutputBlock();
+		unsigned int opIndex = beginningIndex;
+		for (; opIndex + outputBlock <= beginningIndex + nWorks
+				&& !cpuWeights.empty(); opIndex += outputBlock) {
+			filterCPUProcessBlock(inputPlanes,
+					cpuWeights.data() + opIndex * nInputPlanes * 9,
+					biasBuffer.data() + opIndex, &outputPlanes[opIndex],
+					static_cast<int>(beginningRow), static_cast<int>(nRows));
+		}
+		for (; opIndex < (beginningIndex + nWorks); opIndex++) {
+			filterCPUProcess(inputPlanes,
+					weightBuffer.data() + opIndex * nInputPlanes * 9,
+					biasBuffer[opIndex], outputPlanes[opIndex],
+					static_cast<int>(beginningRow), static_cast<int>(nRows));
+		}
+
+		return true;
+	}
 	
 	cv::ocl::setUseOpenCL(false); // disable OpenCL Support(temporary)
 	// filter processing
 	// input : inputPlanes
 	// kernel : weightMatrices
+	// temporaries are shared by all output planes of the work
+	cv::UMat uIntermediatePlane = cv::UMat(ipSize, CV_32FC1);
+	cv::UMat filterOutput = cv::UMat(ipSize, CV_32FC1);
+	cv::UMat moreThanZero = cv::UMat(ipSize, CV_32FC1);
+	cv::UMat lessThanZero = cv::UMat(ipSize, CV_32FC1);
+	cv::Mat outputPlane;
+
 	for (unsigned int opIndex = beginningIndex; opIndex < (beginningIndex + nWorks);
 			opIndex++) {
 
 		int wMatIndex = nInputPlanes * opIndex;
-		cv::Mat outputPlane = cv::Mat::zeros(ipSize, CV_32FC1);
-		cv::UMat uIntermediatePlane = outputPlane.getUMat(cv::ACCESS_WRITE); // all zero matrix
+		uIntermediatePlane.setTo(0.0); // all zero matrix
 
 		for (int ipIndex = 0; ipIndex < nInputPlanes; ipIndex++) {
 			cv::UMat uInputPlane = inputPlanes[ipIndex].getUMat(
 					cv::ACCESS_READ);
 			cv::UMat weightMatrix = weightMatrices[wMatIndex + ipIndex].getUMat(
 					cv::ACCESS_READ);
-			cv::UMat filterOutput = cv::UMat(ipSize, CV_32FC1);
 
 			cv::filter2D(uInputPlane, filterOutput, -1, weightMatrix,
 					cv::Point(-1, -1), 0.0, cv::BORDER_REPLICATE);
@@ -90,8 +495,6 @@ bool Model::filterWorker(std::vector<cv::Mat> &inputPlanes,
 		}
 
 		cv::add(uIntermediatePlane, biases[opIndex], uIntermediatePlane);
-		cv::UMat moreThanZero = cv::UMat(ipSize,CV_32FC1,0.0);
-		cv::UMat lessThanZero = cv::UMat(ipSize,CV_32FC1,0.0);
 		cv::max(uIntermediatePlane, 0.0, moreThanZero);
 		cv::min(uIntermediatePlane, 0.0, lessThanZero);
 		cv::scaleAdd(lessThanZero, 0.1, moreThanZero, uIntermediatePlane);
@@ -10,20 +10,43 @@ static bool loadShader(const char *preDefine, const char *vsPath, const char *fs
 
 bool w2xc::Model::loadGLShader()
 {
+	// compiled once per session
+	if (shader.program != 0 && shader.session == filterGLSession()) {
+		return true;
+	}
+	// the program and weights of an older session are gone with its context
+	filterGLReleaseShader(shader);
+
+	// the permutation of the shader : as many output texels per draw as
+	// there are draw buffers and room for their weights
+	int outputTexels = filterGLMaxDrawTexels(nInputPlanes, nOutputPlanes);
+	if (outputTexels == 0) {
+		std::cout << "GL uniform blocks are too small for " << nInputPlanes
+			<< " input planes." << std::endl;
+		return false;
+	}
+
 	std::ostringstream preDefine;
 	preDefine << "#version 140\n";
 	preDefine << "#define NUM_INPUT_PLANES	" << getNInputPlanes() << std::endl;
 	preDefine << "#define NUM_OUTPUT_PLANES	" << getNOutputPlanes() << std::endl;
+	preDefine << "#define NUM_INPUT_TEXELS	" << filterGLTexelGroups(getNInputPlanes()) << std::endl;
+	preDefine << "#define NUM_OUTPUT_TEXELS	" << outputTexels << std::endl;
 
 	if (!loadShader(preDefine.str().c_str(), "shaders/waifu2x_vs.glsl", "shaders/waifu2x_fs.glsl", &shader.program)) {
 		std::cout << "GL shader compile error." << std::endl;
 		return false;
 	}
-	shader.a_position = glGetAttribLocation(shader.program, "a_position");
-	shader.a_texCoord = glGetAttribLocation(shader.program, "a_texCoord");
-	shader.bias          = glGetUniformLocation(shader.program, "bias");
-	shader.weightMatrix  = glGetUniformLocation(shader.program, "weightMatrix");
+	shader.session = filterGLSession();
+	shader.outputTexels = outputTexels;
 	shader.inputTextures = glGetUniformLocation(shader.program, "inputTextures");
+	glUniformBlockBinding(shader.program,
+		glGetUniformBlockIndex(shader.program, "Weights"),
+		FILTER_GL_WEIGHTS_BINDING);
+
+	// the weights stay on the GPU for the session
+	filterGLUploadWeights(shader, nInputPlanes, nOutputPlanes,
+		glWeights.data(), glBiases.data());
 
 	return true;
 }
@@ -31,7 +54,7 @@ bool w2xc::Model::loadGLShader()
 bool w2xc::Model::filterGL(int modelIndex)
 {
 	// filter core process
-	return filterGLProcess(shader, nInputPlanes, nOutputPlanes, weights, biases, modelIndex);
+	return filterGLProcess(shader, nOutputPlanes, modelIndex);
 }
 
 
@@ -94,6 +117,10 @@ static bool loadShader(const char *preCode, const char *vsPath, const char *fsPa
 	*prog = glCreateProgram();
 	glAttachShader(*prog, vsh);
 	glAttachShader(*prog, fsh);
+	glBindAttribLocation(*prog, FILTER_GL_POSITION_LOCATION, "a_position");
+	glBindAttribLocation(*prog, FILTER_GL_TEXCOORD_LOCATION, "a_texCoord");
+	// o_pixel[i] on the draw buffer i
+	glBindFragDataLocation(*prog, 0, "o_pixel");
 	glLinkProgram(*prog);
 
 	glDeleteShader(vsh);
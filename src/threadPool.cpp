@@ -0,0 +1,290 @@
+
+#include "threadPool.hpp"
+#include <chrono>
+#include <algorithm>
+
+namespace w2xc {
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start) {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+ThreadPool::ThreadPool(int nThreads, bool pinned, int maxNodes) :
+		nRemaining(0), generation(0), terminating(false), stealing(true),
+		pinned(pinned), nRuns(0), runSeconds(0.0) {
+
+	if (nThreads < 1) nThreads = 1;
+	for (int i = 0; i < nThreads; i++) {
+		queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+
+	if (pinned) {
+		processors = CPUTopology::get().placement(nThreads, maxNodes);
+		if ((int)processors.size() != nThreads) {
+			processors.clear();
+			this->pinned = false;
+		}
+	}
+
+	// the other threads of the node first, then the other nodes
+	victims.resize(nThreads);
+	for (int t = 0; t < nThreads; t++) {
+		for (int sameNode = 1; sameNode >= 0; sameNode--) {
+			for (int i = 1; i < nThreads; i++) {
+				int victim = (t + i) % nThreads;
+				if ((getNode(victim) == getNode(t)) == (sameNode != 0)) {
+					victims[t].push_back(victim);
+				}
+			}
+		}
+	}
+
+	// the calling thread of run() is counted as thread 0
+	for (int i = 1; i < nThreads; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		terminating = true;
+	}
+	wakeCondition.notify_all();
+
+	for (auto& th : workers) {
+		th.join();
+	}
+}
+
+int ThreadPool::getNumberOfThreads() {
+	return static_cast<int>(queues.size());
+}
+
+bool ThreadPool::isPinned() {
+	return pinned;
+}
+
+int ThreadPool::getNode(int threadIndex) {
+	return pinned ? processors[threadIndex].node : 0;
+}
+
+int ThreadPool::getNumberOfNodes() {
+	int nNodes = 1;
+	for (auto& processor : processors) {
+		nNodes = std::max(nNodes, processor.node + 1);
+	}
+	return nNodes;
+}
+
+void ThreadPool::workerLoop(int threadIndex) {
+
+	if (pinned) {
+		CPUTopology::pinCurrentThread(processors[threadIndex]);
+	}
+
+	unsigned int seenGeneration = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] {
+				return terminating || generation != seenGeneration;
+			});
+			if (terminating) {
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		processJobs(threadIndex);
+	}
+}
+
+// take one job from the front of own deque
+bool ThreadPool::popJob(int threadIndex,
+		JobRef &job, int &index) {
+
+	WorkQueue &queue = *queues[threadIndex];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	if (queue.begin >= queue.end) {
+		return false;
+	}
+	job = queue.job;
+	index = queue.begin++;
+	return true;
+}
+
+// move the back half of another deque into own (empty) deque
+bool ThreadPool::stealJobs(int threadIndex) {
+
+	for (int victimIndex : victims[threadIndex]) {
+		WorkQueue &victim = *queues[victimIndex];
+		JobRef job;
+		int begin, end;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			// checked again under the lock : a thread still stealing
+			// from the last run must not split the ranges of a
+			// runOnEachThread() dealt meanwhile
+			if (!stealing) {
+				return false;
+			}
+			int n = victim.end - victim.begin;
+			if (n <= 0) {
+				continue;
+			}
+			job = victim.job;
+			end = victim.end;
+			begin = end - (n + 1) / 2;
+			victim.end = begin;
+		}
+
+		WorkQueue &queue = *queues[threadIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.job = job;
+		queue.begin = begin;
+		queue.end = end;
+		queue.nSteals++;
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(queues[threadIndex]->mutex);
+	queues[threadIndex]->nFailedSteals++;
+	return false;
+}
+
+void ThreadPool::processJobs(int threadIndex) {
+
+	WorkQueue &queue = *queues[threadIndex];
+
+	for (;;) {
+		JobRef job;
+		int index;
+
+		if (!popJob(threadIndex, job, index)) {
+			if (!stealing || !stealJobs(threadIndex)) {
+				return;
+			}
+			continue;
+		}
+
+		// the job pointer travels with the index, so a thread which is
+		// still stealing from a finished run can't mix two runs up
+		auto start = std::chrono::steady_clock::now();
+		job.invoke(job.object, index);
+		double seconds = secondsSince(start);
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.nTasks++;
+			queue.busySeconds += seconds;
+		}
+
+		if (--nRemaining == 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			doneCondition.notify_all();
+		}
+	}
+}
+
+void ThreadPool::runJobs(int nJobs, const JobRef &job, bool allowStealing) {
+
+	if (nJobs <= 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> runLock(runMutex);
+	auto start = std::chrono::steady_clock::now();
+	stealing = allowStealing;
+
+	// the calling thread is thread 0 only for the run : image I/O and
+	// the GL driver on it are not held on one processor
+	ThreadAffinity callerAffinity;
+	if (pinned) {
+		CPUTopology::pinCurrentThread(processors[0], &callerAffinity);
+	}
+
+	// deal contiguous ranges to every deque
+	int nThreads = getNumberOfThreads();
+	nRemaining = nJobs;
+	for (int i = 0; i < nThreads; i++) {
+		WorkQueue &queue = *queues[i];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.job = job;
+		queue.begin = static_cast<int>(static_cast<int64_t>(nJobs) * i / nThreads);
+		queue.end = static_cast<int>(static_cast<int64_t>(nJobs) * (i + 1) / nThreads);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	// take jobs on this thread too
+	processJobs(0);
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [this] {
+			return nRemaining == 0;
+		});
+		nRuns++;
+		runSeconds += secondsSince(start);
+	}
+
+	CPUTopology::restoreCurrentThread(callerAffinity);
+}
+
+AlignedBuffer& ThreadPool::getScratchBuffer() {
+
+	// the thread calling run() is thread 0
+	std::thread::id id = std::this_thread::get_id();
+	for (size_t i = 0; i < workers.size(); i++) {
+		if (workers[i].get_id() == id) {
+			return queues[i + 1]->scratch;
+		}
+	}
+	return queues[0]->scratch;
+}
+
+ThreadPoolStatistics ThreadPool::getStatistics() {
+
+	std::lock_guard<std::mutex> runLock(runMutex);
+	ThreadPoolStatistics stats = ThreadPoolStatistics();
+
+	for (auto& queue : queues) {
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		stats.nTasks += queue->nTasks;
+		stats.nSteals += queue->nSteals;
+		stats.nFailedSteals += queue->nFailedSteals;
+		stats.busySeconds += queue->busySeconds;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.nRuns = nRuns;
+	stats.idleSeconds = runSeconds * getNumberOfThreads() - stats.busySeconds;
+	if (stats.idleSeconds < 0.0) stats.idleSeconds = 0.0;
+
+	return stats;
+}
+
+void ThreadPool::resetStatistics() {
+
+	std::lock_guard<std::mutex> runLock(runMutex);
+
+	for (auto& queue : queues) {
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->nTasks = 0;
+		queue->nSteals = 0;
+		queue->nFailedSteals = 0;
+		queue->busySeconds = 0.0;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	nRuns = 0;
+	runSeconds = 0.0;
+}
+
+}
@@ -0,0 +1,148 @@
+
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include "alignedBuffer.h"
+#include "cpuTopology.hpp"
+
+namespace w2xc {
+
+struct ThreadPoolStatistics {
+	uint64_t nRuns;			// number of run() calls
+	uint64_t nTasks;		// number of executed jobs
+	uint64_t nSteals;		// successful steals from other threads' deques
+	uint64_t nFailedSteals;	// steal rounds which found every deque empty
+	double busySeconds;		// time spent in jobs (sum over threads)
+	double idleSeconds;		// time threads had no job while run() was active
+};
+
+/**
+ * fixed size pool of worker threads which stays alive across
+ * layers, blocks and images.
+ * the thread calling run() works as one of the threads.
+ *
+ * jobs are scheduled by work stealing : run() deals contiguous ranges
+ * of job indices to per-thread deques, each thread takes jobs from the
+ * front of its own deque and, once it is empty, steals the back half
+ * of another thread's deque.
+ *
+ * pinned pools place their threads with CPUTopology::placement() : the
+ * threads of a NUMA node have contiguous indices, so the jobs of a node
+ * are a contiguous range (the per node queue), and threads steal from
+ * the deques of their own node before the other nodes.
+ */
+class ThreadPool {
+
+private:
+	// non-owning reference to the job of a run, so that passing a
+	// lambda doesn't allocate a std::function on every run
+	struct JobRef {
+		void (*invoke)(const void *object, int index);
+		const void *object;
+	};
+
+	template <class Job>
+	static void invokeJob(const void *object, int index) {
+		(*static_cast<const Job*>(object))(index);
+	}
+
+	// per-thread deque of job indices [begin, end) of job
+	struct WorkQueue {
+		std::mutex mutex;
+		JobRef job;
+		int begin;
+		int end;
+
+		// scratch memory of the thread, see getScratchBuffer()
+		AlignedBuffer scratch;
+
+		uint64_t nTasks;
+		uint64_t nSteals;
+		uint64_t nFailedSteals;
+		double busySeconds;
+
+		WorkQueue() : begin(0), end(0),
+				nTasks(0), nSteals(0), nFailedSteals(0), busySeconds(0.0) {}
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue> > queues;
+	std::mutex mutex;
+	std::mutex runMutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+
+	std::atomic<int> nRemaining;
+	unsigned int generation;
+	bool terminating;
+	std::atomic<bool> stealing;	// false : every thread runs its own jobs
+
+	// placement of the threads, victims of every thread in steal order
+	bool pinned;
+	std::vector<LogicalProcessor> processors;
+	std::vector<std::vector<int> > victims;
+
+	uint64_t nRuns;
+	double runSeconds;
+
+	ThreadPool(const ThreadPool&); // non-copyable
+	ThreadPool& operator=(const ThreadPool&);
+
+	void workerLoop(int threadIndex);
+	void processJobs(int threadIndex);
+	bool popJob(int threadIndex, JobRef &job, int &index);
+	void runJobs(int nJobs, const JobRef &job, bool allowStealing);
+	bool stealJobs(int threadIndex);
+
+public:
+	// pinned : threads pinned to the processors of the first maxNodes
+	// NUMA nodes (0 : all). the thread calling run() is thread 0, it is
+	// pinned for the duration of the run and gets its affinity back.
+	explicit ThreadPool(int nThreads, bool pinned = false, int maxNodes = 0);
+	~ThreadPool();
+
+	int getNumberOfThreads();
+	bool isPinned();
+	// NUMA node of thread threadIndex (0 unless pinned) and nodes in use
+	int getNode(int threadIndex);
+	int getNumberOfNodes();
+
+	// run job(0) ... job(nJobs - 1) on the pool and wait for all of them.
+	// not reentrant : job must not call run() of the same pool.
+	template <class Job>
+	void run(int nJobs, const Job &job) {
+		JobRef ref;
+		ref.invoke = &invokeJob<Job>;
+		ref.object = &job;
+		runJobs(nJobs, ref, true);
+	}
+
+	// run job(threadIndex) once on every thread and wait for them,
+	// e.g. to first touch memory from the threads which will use it
+	template <class Job>
+	void runOnEachThread(const Job &job) {
+		JobRef ref;
+		ref.invoke = &invokeJob<Job>;
+		ref.object = &job;
+		runJobs(getNumberOfThreads(), ref, false);
+	}
+
+	// scratch buffer of the calling thread, for use inside a job.
+	// it keeps its storage across runs, so kernels can resize() it to
+	// what they need without allocating in the steady state.
+	AlignedBuffer& getScratchBuffer();
+
+	ThreadPoolStatistics getStatistics();
+	void resetStatistics();
+};
+
+}
+
+#endif /* THREAD_POOL_HPP_ */